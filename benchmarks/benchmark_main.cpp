@@ -0,0 +1,342 @@
+#include "benchmark_utils.h"
+#include "frame_stamp.h"
+
+#include "ffmpeg_wrapper/videodecoder.h"
+#include "libavinc/libavinc.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+
+Benchmarks for the decoder and encoder hot paths.
+
+Usage:
+    ffmpeg_wrapper_benchmarks [--output results.json] [--frames N] [--iterations N] [--verify-stamps] [video ...]
+
+Every video is run through the same scenarios for each output format. Resolution and GOP length
+coverage comes from the videos passed on the command line (for instance a generated corpus);
+without arguments the decoder test video is used.
+
+Results are written as JSON with throughput, p50/p99 latency and the process peak memory, to stdout
+unless --output is given. Progress and errors go to stderr.
+With --verify-stamps, Gray8 random access and backward stepping also check the frame number embedded by
+ffmpeg_wrapper_generate_corpus and report the number of frames that did not match the request.
+
+*/
+
+using namespace ffmpeg_wrapper_benchmarks;
+
+namespace {
+
+struct Options {
+    std::string output_path;
+    int frames{300};
+    int iterations{100};
+    bool verify_stamps{false};
+    std::vector<std::string> videos;
+};
+
+struct VideoInfo {
+    std::string path;
+    int width{0};
+    int height{0};
+    int frame_count{0};
+    int max_gop{0};
+};
+
+char const * format_name(ffmpeg_wrapper::VideoDecoder::OutputFormat format) {
+    switch (format) {
+        case ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray8:
+            return "Gray8";
+        case ffmpeg_wrapper::VideoDecoder::OutputFormat::ARGB:
+            return "ARGB";
+        case ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray16:
+            return "Gray16";
+        case ffmpeg_wrapper::VideoDecoder::OutputFormat::RGB48:
+            return "RGB48";
+        default:
+            return "Unknown";
+    }
+}
+
+// Counts decoded frames whose embedded frame number differs from the requested one
+class StampChecker {
+public:
+    StampChecker(Options const & options, ffmpeg_wrapper::VideoDecoder::OutputFormat format, VideoInfo const & video)
+        : _enabled(options.verify_stamps && format == ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray8),
+          _width(video.width),
+          _height(video.height) {}
+
+    void check(std::vector<uint8_t> const & frame, int requested) {
+        if (!_enabled) return;
+        if (ffmpeg_wrapper_benchmarks::read_frame_stamp(frame.data(), _width, _height) != requested) {
+            _mismatches++;
+        }
+    }
+
+    void attach(ScenarioResult & result) const {
+        if (_enabled) result.extra.emplace_back("stamp_mismatches", static_cast<double>(_mismatches));
+    }
+
+private:
+    bool _enabled;
+    int _width;
+    int _height;
+    int _mismatches{0};
+};
+
+void attach_decoder_fields(ScenarioResult & result, ffmpeg_wrapper::VideoDecoder const & decoder) {
+    auto const stats = decoder.getStatistics();
+    result.extra.emplace_back("cache_hit_rate", stats.cacheHitRate());
+    result.extra.emplace_back("frames_decoded", static_cast<double>(stats.frames_decoded));
+    result.extra.emplace_back("seeks", static_cast<double>(stats.seeks));
+    result.extra.emplace_back("frame_allocations", static_cast<double>(stats.frame_allocations));
+    result.extra.emplace_back("packet_allocations", static_cast<double>(stats.packet_allocations));
+    result.extra.emplace_back("peak_memory_kb", static_cast<double>(peak_memory_kb()));
+}
+
+ScenarioResult bench_open(VideoInfo const & video, Options const & options) {
+    ScenarioResult result{"open", video.path, "", {}, {}};
+    int const opens = std::max(1, options.iterations / 20);
+    for (int i = 0; i < opens; ++i) {
+        ffmpeg_wrapper::VideoDecoder decoder;
+        result.samples.time([&]() { decoder.createMedia(video.path); });
+    }
+    result.extra.emplace_back("peak_memory_kb", static_cast<double>(peak_memory_kb()));
+    return result;
+}
+
+ScenarioResult bench_sequential(VideoInfo const & video, Options const & options,
+                                ffmpeg_wrapper::VideoDecoder::OutputFormat format, bool pipelined = false) {
+    ScenarioResult result{pipelined ? "sequential_decode_pipelined" : "sequential_decode", video.path,
+                          format_name(format), {}, {}};
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.setFormat(format);
+    decoder.createMedia(video.path);
+    decoder.setPipelined(pipelined);
+    decoder.resetStatistics();
+
+    int const last = std::min(video.frame_count, options.frames);
+    for (int i = 0; i < last; ++i) {
+        result.samples.time([&]() { decoder.getFrame(i); });
+    }
+    attach_decoder_fields(result, decoder);
+    return result;
+}
+
+ScenarioResult bench_random_access(VideoInfo const & video, Options const & options,
+                                   ffmpeg_wrapper::VideoDecoder::OutputFormat format) {
+    ScenarioResult result{"random_access", video.path, format_name(format), {}, {}};
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.setFormat(format);
+    decoder.createMedia(video.path);
+    decoder.resetStatistics();
+
+    std::mt19937 gen(42);// Fixed seed so runs are comparable
+    std::uniform_int_distribution<> dis(0, std::max(0, video.frame_count - 1));
+    int const requests = std::max(1, options.iterations / 2);
+    StampChecker checker(options, format, video);
+    for (int i = 0; i < requests; ++i) {
+        int const frame = dis(gen);
+        std::vector<uint8_t> image;
+        result.samples.time([&]() { image = decoder.getFrame(frame); });
+        checker.check(image, frame);
+    }
+    attach_decoder_fields(result, decoder);
+    checker.attach(result);
+    return result;
+}
+
+ScenarioResult bench_backward(VideoInfo const & video, Options const & options,
+                              ffmpeg_wrapper::VideoDecoder::OutputFormat format) {
+    ScenarioResult result{"backward_step", video.path, format_name(format), {}, {}};
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.setFormat(format);
+    decoder.createMedia(video.path);
+
+    int const start = std::min(video.frame_count, options.frames) - 1;
+    decoder.getFrame(start);
+    decoder.resetStatistics();
+
+    int const stop = std::max(0, start - options.iterations);
+    StampChecker checker(options, format, video);
+    for (int i = start - 1; i >= stop; --i) {
+        std::vector<uint8_t> image;
+        result.samples.time([&]() { image = decoder.getFrame(i); });
+        checker.check(image, i);
+    }
+    attach_decoder_fields(result, decoder);
+    checker.attach(result);
+    return result;
+}
+
+// Repeated requests for a buffered frame measure the cache lookup plus output conversion
+ScenarioResult bench_cached_conversion(VideoInfo const & video, Options const & options,
+                                       ffmpeg_wrapper::VideoDecoder::OutputFormat format) {
+    ScenarioResult result{"cached_conversion", video.path, format_name(format), {}, {}};
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.setFormat(format);
+    decoder.createMedia(video.path);
+    decoder.getFrame(0);
+    decoder.resetStatistics();
+
+    for (int i = 0; i < options.iterations; ++i) {
+        result.samples.time([&]() { decoder.getFrame(0); });
+    }
+    attach_decoder_fields(result, decoder);
+    return result;
+}
+
+// The GRAY8 -> NV12 conversion is the CPU side of VideoEncoder::writeFrameGray8 and does not need a GPU
+ScenarioResult bench_encoder_conversion(VideoInfo const & video, Options const & options) {
+    ScenarioResult result{"encoder_gray8_to_nv12", video.path, "Gray8", {}, {}};
+
+    auto gray = libav::av_frame_alloc();
+    gray->format = libav::AV_PIX_FMT_GRAY8;
+    gray->width = video.width;
+    gray->height = video.height;
+    libav::av_frame_get_buffer(gray);
+
+    auto nv12 = libav::av_frame_alloc();
+    nv12->format = libav::AV_PIX_FMT_NV12;
+    nv12->width = video.width;
+    nv12->height = video.height;
+    libav::av_frame_get_buffer(nv12);
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(0, 255);
+    for (int y = 0; y < video.height; ++y) {
+        for (int x = 0; x < video.width; ++x) {
+            gray->data[0][y * gray->linesize[0] + x] = static_cast<uint8_t>(dis(gen));
+        }
+    }
+
+    for (int i = 0; i < options.iterations; ++i) {
+        result.samples.time([&]() { libav::convert_frame(gray, nv12); });
+    }
+    result.extra.emplace_back("peak_memory_kb", static_cast<double>(peak_memory_kb()));
+    return result;
+}
+
+VideoInfo probe(std::string const & path) {
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(path);
+
+    VideoInfo info;
+    info.path = path;
+    info.width = decoder.getWidth();
+    info.height = decoder.getHeight();
+    info.frame_count = decoder.getFrameCount();
+
+    auto const keyframes = decoder.getKeyFrames();
+    int64_t previous = 0;
+    for (auto const k: keyframes) {
+        info.max_gop = std::max(info.max_gop, static_cast<int>(k - previous));
+        previous = k;
+    }
+    info.max_gop = std::max(info.max_gop, static_cast<int>(info.frame_count - previous));
+    return info;
+}
+
+bool parse_args(int argc, char ** argv, Options & options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if ((arg == "--output" || arg == "--frames" || arg == "--iterations") && i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        if (arg == "--output") {
+            options.output_path = argv[++i];
+        } else if (arg == "--frames") {
+            options.frames = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--iterations") {
+            options.iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--verify-stamps") {
+            options.verify_stamps = true;
+        } else if (arg == "--help" || arg == "-h") {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--output results.json] [--frames N] [--iterations N] [--verify-stamps] [video ...]"
+                      << std::endl;
+            return false;
+        } else {
+            options.videos.push_back(arg);
+        }
+    }
+    if (options.videos.empty()) {
+        options.videos.emplace_back("data/test_each_frame_number.mp4");
+    }
+    return true;
+}
+
+}// namespace
+
+int main(int argc, char ** argv) {
+
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        return 1;
+    }
+
+    // The library reports errors on std::cout. Route them to stderr with the other diagnostics, so that
+    // stdout carries nothing but the JSON.
+    std::ostream json_stdout(std::cout.rdbuf());
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    std::vector<VideoInfo> videos;
+    std::vector<ScenarioResult> results;
+
+    auto const formats = {ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray8,
+                          ffmpeg_wrapper::VideoDecoder::OutputFormat::ARGB};
+
+    for (auto const & path: options.videos) {
+        auto const video = probe(path);
+        if (video.frame_count == 0) {
+            std::cerr << "Skipping " << path << ": no decodable video frames" << std::endl;
+            continue;
+        }
+        videos.push_back(video);
+        std::cerr << "Benchmarking " << path << " (" << video.width << "x" << video.height
+                  << ", " << video.frame_count << " frames, max GOP " << video.max_gop << ")" << std::endl;
+
+        results.push_back(bench_open(video, options));
+        for (auto const format: formats) {
+            results.push_back(bench_sequential(video, options, format));
+            results.push_back(bench_sequential(video, options, format, true));
+            results.push_back(bench_random_access(video, options, format));
+            results.push_back(bench_backward(video, options, format));
+            results.push_back(bench_cached_conversion(video, options, format));
+        }
+        results.push_back(bench_encoder_conversion(video, options));
+    }
+
+    std::ofstream file;
+    if (!options.output_path.empty()) {
+        file.open(options.output_path);
+        if (!file) {
+            std::cerr << "Failed to open " << options.output_path << " for writing" << std::endl;
+            return 1;
+        }
+    }
+    std::ostream & os = options.output_path.empty() ? json_stdout : file;
+
+    os << "{\n  \"videos\": [\n";
+    for (size_t i = 0; i < videos.size(); ++i) {
+        auto const & v = videos[i];
+        os << "    {\"path\": \"" << json_escape(v.path) << "\", \"width\": " << v.width
+           << ", \"height\": " << v.height << ", \"frames\": " << v.frame_count
+           << ", \"max_gop\": " << v.max_gop << "}" << (i + 1 < videos.size() ? "," : "") << "\n";
+    }
+    os << "  ],\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].write_json(os);
+        os << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ],\n  \"peak_memory_kb\": " << peak_memory_kb() << "\n}\n";
+
+    return 0;
+}
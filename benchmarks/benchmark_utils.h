@@ -0,0 +1,125 @@
+#ifndef BENCHMARK_UTILS_H
+#define BENCHMARK_UTILS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined _WIN32
+// clang-format off
+#include <windows.h>
+#include <psapi.h>
+// clang-format on
+#else
+#include <sys/resource.h>
+#endif
+
+namespace ffmpeg_wrapper_benchmarks {
+
+/*
+Wall-clock samples for one scenario. Every sample is a single operation (one frame request, one open, ...)
+so throughput and tail latency come from the same data.
+*/
+class Samples {
+public:
+    template<typename F>
+    void time(F && operation) {
+        auto const t1 = std::chrono::steady_clock::now();
+        operation();
+        auto const t2 = std::chrono::steady_clock::now();
+        _ms.push_back(std::chrono::duration<double, std::milli>(t2 - t1).count());
+    }
+
+    size_t count() const { return _ms.size(); }
+
+    double total_ms() const {
+        double total = 0.0;
+        for (double const v: _ms) total += v;
+        return total;
+    }
+
+    double per_second() const {
+        double const total = total_ms();
+        return total > 0.0 ? static_cast<double>(_ms.size()) * 1000.0 / total : 0.0;
+    }
+
+    // Nearest-rank percentile, p in [0, 100]
+    double percentile_ms(double p) const {
+        if (_ms.empty()) return 0.0;
+        std::vector<double> sorted = _ms;
+        std::sort(sorted.begin(), sorted.end());
+        auto rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+        rank = std::clamp<size_t>(rank, 1, sorted.size());
+        return sorted[rank - 1];
+    }
+
+    double max_ms() const {
+        return _ms.empty() ? 0.0 : *std::max_element(_ms.begin(), _ms.end());
+    }
+
+private:
+    std::vector<double> _ms;
+};
+
+// Peak resident set size of the process so far, in kilobytes
+inline long peak_memory_kb() {
+#if defined _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+    }
+    return 0;
+#else
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined __APPLE__
+    return static_cast<long>(usage.ru_maxrss / 1024);// bytes on macOS
+#else
+    return static_cast<long>(usage.ru_maxrss);// kilobytes on Linux
+#endif
+#endif
+}
+
+inline std::string json_escape(std::string const & s) {
+    std::string out;
+    out.reserve(s.size());
+    for (char const c: s) {
+        if (c == '"' || c == '\\') out.push_back('\\');
+        out.push_back(c);
+    }
+    return out;
+}
+
+/*
+One benchmark scenario as a JSON object. Extra numeric fields can be attached before writing.
+*/
+struct ScenarioResult {
+    std::string name;
+    std::string video;
+    std::string format;
+    Samples samples;
+    std::vector<std::pair<std::string, double>> extra;
+
+    void write_json(std::ostream & os) const {
+        os << "    {\"name\": \"" << json_escape(name) << "\""
+           << ", \"video\": \"" << json_escape(video) << "\""
+           << ", \"format\": \"" << json_escape(format) << "\""
+           << ", \"operations\": " << samples.count()
+           << ", \"total_ms\": " << samples.total_ms()
+           << ", \"per_second\": " << samples.per_second()
+           << ", \"p50_ms\": " << samples.percentile_ms(50)
+           << ", \"p99_ms\": " << samples.percentile_ms(99)
+           << ", \"max_ms\": " << samples.max_ms();
+        for (auto const & field: extra) {
+            os << ", \"" << json_escape(field.first) << "\": " << field.second;
+        }
+        os << "}";
+    }
+};
+
+}// namespace ffmpeg_wrapper_benchmarks
+
+#endif// BENCHMARK_UTILS_H
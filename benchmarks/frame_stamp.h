@@ -0,0 +1,81 @@
+#ifndef FRAME_STAMP_H
+#define FRAME_STAMP_H
+
+#include <algorithm>
+#include <stdint.h>
+
+namespace ffmpeg_wrapper_benchmarks {
+
+/*
+
+Frame number ground truth embedded in the pixels of generated videos.
+
+The top band of the frame holds 32 square cells: 24 bits of frame number followed by an 8 bit check
+value, most significant bit first. Set bits are bright and cleared bits are dark. Cells are large enough
+to survive lossy compression at the bitrates used by the corpus generator, and reading only samples the
+centre of each cell, so a decoded Gray8 frame can be checked against the frame index that was requested.
+
+*/
+
+constexpr int kStampBits = 32;
+constexpr int kStampNumberBits = 24;
+
+inline int stamp_cell_size(int width) {
+    return std::max(2, width / kStampBits);
+}
+
+inline uint32_t stamp_check(uint32_t number) {
+    return ((number >> 16) ^ (number >> 8) ^ number ^ 0xA5u) & 0xFFu;
+}
+
+/**
+ *
+ * Draw the stamp for frame_number into the top band of a tightly packed Gray8 image
+ *
+ */
+inline void write_frame_stamp(uint8_t * gray, int width, int height, int frame_number) {
+    int const cell = stamp_cell_size(width);
+    auto const number = static_cast<uint32_t>(frame_number) & ((1u << kStampNumberBits) - 1);
+    uint32_t const word = (number << 8) | stamp_check(number);
+
+    for (int bit = 0; bit < kStampBits; ++bit) {
+        bool const set = (word >> (kStampBits - 1 - bit)) & 1u;
+        uint8_t const value = set ? 235 : 16;
+        for (int y = 0; y < std::min(cell, height); ++y) {
+            uint8_t * row = gray + y * width;
+            for (int x = bit * cell; x < std::min((bit + 1) * cell, width); ++x) {
+                row[x] = value;
+            }
+        }
+    }
+}
+
+/**
+ *
+ * Read the stamp from a tightly packed Gray8 image
+ *
+ * @return The embedded frame number, or -1 if the image carries no valid stamp
+ */
+inline int read_frame_stamp(uint8_t const * gray, int width, int height) {
+    int const cell = stamp_cell_size(width);
+    if (cell * kStampBits > width || cell > height) {
+        return -1;
+    }
+
+    uint32_t word = 0;
+    int const y = cell / 2;
+    for (int bit = 0; bit < kStampBits; ++bit) {
+        int const x = bit * cell + cell / 2;
+        word = (word << 1) | (gray[y * width + x] >= 128 ? 1u : 0u);
+    }
+
+    uint32_t const number = word >> 8;
+    if ((word & 0xFFu) != stamp_check(number)) {
+        return -1;
+    }
+    return static_cast<int>(number);
+}
+
+}// namespace ffmpeg_wrapper_benchmarks
+
+#endif// FRAME_STAMP_H
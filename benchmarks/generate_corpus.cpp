@@ -0,0 +1,281 @@
+#include "frame_stamp.h"
+
+#include "ffmpeg_wrapper/videoencoder.h"
+#include "libavinc/libavinc.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+
+Generates a matrix of synthetic test videos with the library's own software encoding path.
+
+Usage:
+    ffmpeg_wrapper_generate_corpus [--output-dir corpus] [--frames N] [--fps N]
+                                   [--codecs libx264,mpeg4] [--resolutions 640x480,1920x1080]
+                                   [--gops 1,12,60,250] [--bframes 0,2] [--timing cfr,vfr]
+
+Every frame carries its frame number in the stamp described in frame_stamp.h, on top of moving content
+with a scene change every 100 frames, so the output can be used for throughput benchmarks and for
+checking that seeks land on the requested frame. Output is deterministic for a given set of arguments.
+Variable frame rate files use a repeating pattern of frame durations with the nominal average rate.
+
+A manifest.json describing every file is written next to the videos.
+
+*/
+
+namespace {
+
+struct Resolution {
+    int width;
+    int height;
+};
+
+struct Options {
+    std::string output_dir{"corpus"};
+    int frames{300};
+    int fps{30};
+    std::vector<std::string> codecs;
+    std::vector<Resolution> resolutions{{320, 240}, {640, 480}, {1280, 720}, {1920, 1080}};
+    std::vector<int> gops{1, 12, 60, 250};
+    std::vector<int> bframes{0, 2};
+    std::vector<bool> vfr{false, true};
+};
+
+struct CorpusEntry {
+    std::string file;
+    std::string codec;
+    Resolution resolution;
+    int gop;
+    int bframes;
+    bool vfr;
+    int time_base_den;
+};
+
+// Durations in time base ticks for variable frame rate files. They average to kVfrTicksPerFrame.
+constexpr int kVfrTicksPerFrame = 4;
+constexpr int kVfrPattern[] = {4, 3, 5, 4, 2, 6, 4, 4};
+constexpr int kSceneLength = 100;
+
+std::vector<std::string> split(std::string const & list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+void render_frame(std::vector<uint8_t> & gray, int width, int height, int frame_number) {
+    int const scene = frame_number / kSceneLength;
+    int const block = std::max(8, width / 16);
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t * row = gray.data() + y * width;
+        for (int x = 0; x < width; ++x) {
+            int value;
+            if (scene % 2 == 0) {
+                value = 40 + ((x + y + 2 * frame_number) & 0x7F);// Drifting diagonal gradient
+            } else {
+                bool const checker = (((x + frame_number) / block) + (y / block)) % 2 == 0;// Panning checkerboard
+                value = checker ? 60 : 170;
+            }
+            row[x] = static_cast<uint8_t>(value);
+        }
+    }
+
+    // A bright square bouncing across the lower part of the frame
+    int const size = std::max(8, height / 6);
+    int const travel_x = std::max(1, width - size);
+    int const travel_y = std::max(1, height / 2 - size);
+    int const px = (frame_number * 7) % (2 * travel_x);
+    int const py = (frame_number * 3) % (2 * travel_y);
+    int const x0 = px < travel_x ? px : 2 * travel_x - px;
+    int const y0 = height / 2 + (py < travel_y ? py : 2 * travel_y - py);
+    for (int y = y0; y < std::min(height, y0 + size); ++y) {
+        for (int x = x0; x < std::min(width, x0 + size); ++x) {
+            gray[y * width + x] = 220;
+        }
+    }
+
+    ffmpeg_wrapper_benchmarks::write_frame_stamp(gray.data(), width, height, frame_number);
+}
+
+bool encode_entry(CorpusEntry const & entry, Options const & options) {
+    auto const path = (std::filesystem::path(options.output_dir) / entry.file).string();
+    int const width = entry.resolution.width;
+    int const height = entry.resolution.height;
+
+    ffmpeg_wrapper::VideoEncoder encoder;
+    encoder.setSavePath(path);
+    encoder.setHardwareEncode(false);
+    encoder.setEncoderName(entry.codec);
+    encoder.setGopSize(entry.gop);
+    encoder.setMaxBFrames(entry.bframes);
+    encoder.setTimeBase(1, entry.time_base_den);
+    // Single threaded encoding keeps the output identical between runs
+    encoder.setEncoderOption("threads", "1");
+    encoder.setEncoderOption("b", std::to_string(static_cast<int64_t>(width) * height * options.fps / 3));
+    if (entry.codec == "libx264") {
+        encoder.setEncoderOption("preset", "veryfast");
+    }
+
+    encoder.createContext(width, height, options.fps);
+    encoder.set_pixel_format(ffmpeg_wrapper::VideoEncoder::INPUT_PIXEL_FORMAT::GRAY8);
+    encoder.openFile();
+
+    std::vector<uint8_t> gray(static_cast<size_t>(width) * height);
+    int64_t pts = 0;
+    for (int i = 0; i < options.frames; ++i) {
+        render_frame(gray, width, height, i);
+        if (encoder.writeFrameGray8(gray, pts) < 0) {
+            std::cout << "Failed to encode frame " << i << " of " << path << std::endl;
+            return false;
+        }
+        pts += entry.vfr ? kVfrPattern[i % (sizeof(kVfrPattern) / sizeof(kVfrPattern[0]))] : 1;
+    }
+
+    encoder.enterDrainMode();
+    encoder.closeFile();
+    return true;
+}
+
+bool parse_args(int argc, char ** argv, Options & options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            std::cout << "Usage: " << argv[0]
+                      << " [--output-dir dir] [--frames N] [--fps N] [--codecs a,b] [--resolutions WxH,...]"
+                         " [--gops 1,12,...] [--bframes 0,2] [--timing cfr,vfr]"
+                      << std::endl;
+            return false;
+        }
+        if (i + 1 >= argc) {
+            std::cout << "Missing value for " << arg << std::endl;
+            return false;
+        }
+        std::string const value = argv[++i];
+        if (arg == "--output-dir") {
+            options.output_dir = value;
+        } else if (arg == "--frames") {
+            options.frames = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--fps") {
+            options.fps = std::max(1, std::atoi(value.c_str()));
+        } else if (arg == "--codecs") {
+            options.codecs = split(value);
+        } else if (arg == "--resolutions") {
+            options.resolutions.clear();
+            for (auto const & r: split(value)) {
+                auto const x = r.find('x');
+                if (x == std::string::npos) {
+                    std::cout << "Resolution " << r << " should look like 640x480" << std::endl;
+                    return false;
+                }
+                // Even dimensions keep 4:2:0 chroma subsampling exact
+                int const w = std::atoi(r.substr(0, x).c_str()) & ~1;
+                int const h = std::atoi(r.substr(x + 1).c_str()) & ~1;
+                if (w <= 0 || h <= 0) {
+                    std::cout << "Invalid resolution " << r << std::endl;
+                    return false;
+                }
+                options.resolutions.push_back({w, h});
+            }
+        } else if (arg == "--gops") {
+            options.gops.clear();
+            for (auto const & g: split(value)) options.gops.push_back(std::max(1, std::atoi(g.c_str())));
+        } else if (arg == "--bframes") {
+            options.bframes.clear();
+            for (auto const & b: split(value)) options.bframes.push_back(std::max(0, std::atoi(b.c_str())));
+        } else if (arg == "--timing") {
+            options.vfr.clear();
+            for (auto const & t: split(value)) options.vfr.push_back(t == "vfr");
+        } else {
+            std::cout << "Unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.codecs.empty()) {
+        for (char const * codec: {"libx264", "mpeg4"}) {
+            if (::avcodec_find_encoder_by_name(codec)) {
+                options.codecs.emplace_back(codec);
+            }
+        }
+    }
+    return true;
+}
+
+}// namespace
+
+int main(int argc, char ** argv) {
+
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        return 1;
+    }
+    if (options.codecs.empty()) {
+        std::cout << "No CPU encoder available. Pass --codecs with an encoder supported by this FFmpeg build" << std::endl;
+        return 1;
+    }
+
+    std::filesystem::create_directories(options.output_dir);
+
+    std::vector<CorpusEntry> entries;
+    for (auto const & codec: options.codecs) {
+        if (!::avcodec_find_encoder_by_name(codec.c_str())) {
+            std::cout << "Skipping unavailable encoder " << codec << std::endl;
+            continue;
+        }
+        for (auto const & resolution: options.resolutions) {
+            for (int const gop: options.gops) {
+                for (int const bframes: options.bframes) {
+                    // All-intra files have no B-frames, so only generate them once
+                    if (gop == 1 && bframes > 0) continue;
+                    for (bool const vfr: options.vfr) {
+                        CorpusEntry entry;
+                        entry.codec = codec;
+                        entry.resolution = resolution;
+                        entry.gop = gop;
+                        entry.bframes = bframes;
+                        entry.vfr = vfr;
+                        entry.time_base_den = vfr ? options.fps * kVfrTicksPerFrame : options.fps;
+                        entry.file = codec + "_" + std::to_string(resolution.width) + "x" +
+                                     std::to_string(resolution.height) + "_gop" + std::to_string(gop) +
+                                     "_b" + std::to_string(bframes) + (vfr ? "_vfr" : "_cfr") + ".mp4";
+                        entries.push_back(entry);
+                    }
+                }
+            }
+        }
+    }
+
+    std::ofstream manifest((std::filesystem::path(options.output_dir) / "manifest.json").string());
+    manifest << "{\n  \"frames\": " << options.frames << ",\n  \"fps\": " << options.fps << ",\n  \"videos\": [\n";
+
+    int failures = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        auto const & entry = entries[i];
+        std::cout << "Encoding " << entry.file << " (" << i + 1 << "/" << entries.size() << ")" << std::endl;
+        bool const ok = encode_entry(entry, options);
+        if (!ok) failures++;
+
+        manifest << "    {\"file\": \"" << entry.file << "\", \"codec\": \"" << entry.codec
+                 << "\", \"width\": " << entry.resolution.width << ", \"height\": " << entry.resolution.height
+                 << ", \"gop\": " << entry.gop << ", \"bframes\": " << entry.bframes
+                 << ", \"vfr\": " << (entry.vfr ? "true" : "false")
+                 << ", \"time_base\": \"1/" << entry.time_base_den << "\""
+                 << ", \"ok\": " << (ok ? "true" : "false") << "}"
+                 << (i + 1 < entries.size() ? "," : "") << "\n";
+    }
+    manifest << "  ]\n}\n";
+
+    std::cout << "Wrote " << entries.size() - failures << " videos to " << options.output_dir << std::endl;
+    return failures == 0 ? 0 : 1;
+}
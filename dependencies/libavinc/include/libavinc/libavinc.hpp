@@ -36,7 +36,9 @@ extern "C" {
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 #include <libswresample/swresample.h>
 #include <libswscale/swscale.h>
 }
@@ -47,12 +49,15 @@ extern "C" {
 #define DLLOPT __attribute__((visibility("default")))
 #endif
 
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace libav {
@@ -126,20 +131,21 @@ using AVIOContext = std::unique_ptr<::AVIOContext, void (*)(::AVIOContext *)>;
 *         with FFmpeg functions that require an AVIOContext. The custom deleter ensures that resources
 *         are properly freed when the context is no longer needed.
 */
-inline AVIOContext avio_alloc_context(std::function<int(uint8_t *, int)> read,
-                                      std::function<int(uint8_t *, int)> write,
-                                      std::function<int64_t(int64_t, int)> seek,
+template<class Read, class Write, class Seek>
+inline AVIOContext avio_alloc_context(Read && read,
+                                      Write && write,
+                                      Seek && seek,
                                       int buffer_size,
                                       int write_flag) {
     struct opaque_t {
-        std::function<int(uint8_t *, int)> read;
-        std::function<int(uint8_t *, int)> write;
-        std::function<int64_t(int64_t, int)> seek;
+        std::decay_t<Read> read;
+        std::decay_t<Write> write;
+        std::decay_t<Seek> seek;
     };
 
     // create a copy of the functions to enable captures
     auto buffer = (unsigned char *) ::av_malloc(buffer_size);
-    auto opaque = new opaque_t{read, write, seek};
+    auto opaque = new opaque_t{std::forward<Read>(read), std::forward<Write>(write), std::forward<Seek>(seek)};
 
     auto read_wrapper = [](void * opaque, uint8_t * buf, int buf_size) -> int {
         auto o = reinterpret_cast<opaque_t *>(opaque);
@@ -173,6 +179,21 @@ inline AVIOContext avio_alloc_context(std::function<int(uint8_t *, int)> read,
             });
 }
 
+/**
+* std::function version of the templated avio_alloc_context above, kept for existing callers.
+* Any callable can be passed to the template directly, which avoids the type-erased call per read.
+*/
+inline AVIOContext avio_alloc_context(std::function<int(uint8_t *, int)> read,
+                                      std::function<int(uint8_t *, int)> write,
+                                      std::function<int64_t(int64_t, int)> seek,
+                                      int buffer_size,
+                                      int write_flag) {
+    return libav::avio_alloc_context<std::function<int(uint8_t *, int)>,
+                                     std::function<int(uint8_t *, int)>,
+                                     std::function<int64_t(int64_t, int)>>(
+            std::move(read), std::move(write), std::move(seek), buffer_size, write_flag);
+}
+
 /**
 * Allocates and initializes an AVIOContext with custom read and seek operations, creating a read-only context.
 * This function is a convenience wrapper that sets up a read-only AVIOContext by providing custom read and seek
@@ -193,12 +214,20 @@ inline AVIOContext avio_alloc_context(std::function<int(uint8_t *, int)> read,
 * @return Returns an AVIOContext object wrapped in a std::unique_ptr with a custom deleter. The AVIOContext is
 *         configured for read-only access with the provided read and seek functions.
 */
-inline AVIOContext avio_alloc_context(std::function<int(uint8_t *, int)> read,
-                                      std::function<int64_t(int64_t, int)> seek,
+template<class Read, class Seek>
+inline AVIOContext avio_alloc_context(Read && read,
+                                      Seek && seek,
                                       int buffer_size) {
     auto write = [](uint8_t *, int) { return 0; };
     return libav::avio_alloc_context(
-            read, write, seek, 0, buffer_size);
+            std::forward<Read>(read), write, std::forward<Seek>(seek), buffer_size, 0);
+}
+
+inline AVIOContext avio_alloc_context(std::function<int(uint8_t *, int)> read,
+                                      std::function<int64_t(int64_t, int)> seek,
+                                      int buffer_size) {
+    return libav::avio_alloc_context<std::function<int(uint8_t *, int)>, std::function<int64_t(int64_t, int)>>(
+            std::move(read), std::move(seek), buffer_size);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -309,6 +338,174 @@ public:
         : AVBufferRefBase(nullptr, [](::AVBufferRef *) {}) {
     }
 };
+///////////////////////////////////////////////////////////////////////////////
+using AVFrame = std::shared_ptr<::AVFrame>;
+
+inline AVFrame av_frame_alloc() {
+    return AVFrame(::av_frame_alloc(), [](::AVFrame * frame) {
+        auto * pframe = &frame;
+        av_frame_free(pframe);
+    });
+}
+
+/**
+* Recycles AVFrame objects together with their shared_ptr control blocks.
+*
+* A pooled frame is free again once every copy handed out by acquire() has been released, so that the
+* pool holds the only reference. acquire() unreferences the frame data before returning it, and the
+* caller gets an empty frame just like av_frame_alloc(). If every pooled frame is still in use and the
+* pool is at capacity, an unpooled frame is allocated instead.
+*
+* Released frames keep their data references until they are acquired again or trim() is called;
+* retainedBytes() reports how much that is.
+* The pool itself is not thread safe, but the frames it hands out may be released on any thread.
+* A use count of one is followed by an acquire fence, which pairs with the release ordering of the
+* shared_ptr count decrement, so the last holder's accesses happen before the pool reuses the frame.
+*/
+class AVFramePool {
+public:
+    explicit AVFramePool(size_t capacity = 16)
+        : _capacity(capacity) {
+    }
+
+    AVFrame acquire() {
+        for (size_t n = 0; n < _frames.size(); ++n) {
+            auto & frame = _frames[_next];
+            _next = (_next + 1) % _frames.size();
+            if (frame.use_count() == 1) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                ::av_frame_unref(frame.get());
+                return frame;
+            }
+        }
+
+        _allocations++;
+        auto frame = av_frame_alloc();
+        if (_frames.size() < _capacity) {
+            _frames.push_back(frame);
+        }
+        return frame;
+    }
+
+    // Drop the data references held by frames nobody is using
+    void trim() {
+        for (auto & frame: _frames) {
+            if (frame.use_count() == 1) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                ::av_frame_unref(frame.get());
+            }
+        }
+    }
+
+    // Bytes of frame data still referenced by frames nobody is using
+    size_t retainedBytes() const {
+        size_t bytes = 0;
+        for (auto const & frame: _frames) {
+            if (frame.use_count() != 1) continue;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            for (auto const * buf: frame->buf) {
+                if (buf) bytes += buf->size;
+            }
+        }
+        return bytes;
+    }
+
+    void setCapacity(size_t capacity) {
+        _capacity = capacity;
+        if (_frames.size() > _capacity) {
+            _frames.resize(_capacity);
+            _next = 0;
+        }
+    }
+
+    size_t capacity() const { return _capacity; }
+    size_t size() const { return _frames.size(); }
+    // Frames allocated by this pool since it was created
+    size_t allocations() const { return _allocations; }
+
+private:
+    std::vector<AVFrame> _frames;
+    size_t _capacity;
+    size_t _next{0};
+    size_t _allocations{0};
+};
+
+/**
+* Recycles AVPacket objects. acquire() returns an empty packet that is unreferenced and handed back
+* to the pool when the returned pointer goes out of scope. Packets must be released before the pool
+* is destroyed. The pool is not thread safe.
+*/
+class AVPacketPool {
+public:
+    struct Release {
+        AVPacketPool * pool;
+        void operator()(::AVPacket * pkt) const { pool->_release(pkt); }
+    };
+    using Packet = std::unique_ptr<::AVPacket, Release>;
+
+    explicit AVPacketPool(size_t capacity = 8)
+        : _capacity(capacity) {
+    }
+
+    AVPacketPool(AVPacketPool const &) = delete;
+    AVPacketPool & operator=(AVPacketPool const &) = delete;
+    AVPacketPool(AVPacketPool && other) noexcept
+        : _free(std::move(other._free)),
+          _capacity(other._capacity),
+          _allocations(other._allocations) {
+        other._free.clear();
+    }
+    AVPacketPool & operator=(AVPacketPool && other) noexcept {
+        if (this != &other) {
+            _freeAll();
+            _free = std::move(other._free);
+            other._free.clear();
+            _capacity = other._capacity;
+            _allocations = other._allocations;
+        }
+        return *this;
+    }
+
+    ~AVPacketPool() { _freeAll(); }
+
+    Packet acquire() {
+        ::AVPacket * pkt = nullptr;
+        if (_free.empty()) {
+            _allocations++;
+            pkt = ::av_packet_alloc();
+        } else {
+            pkt = _free.back();
+            _free.pop_back();
+        }
+        return Packet(pkt, Release{this});
+    }
+
+    // Packets allocated by this pool since it was created
+    size_t allocations() const { return _allocations; }
+
+private:
+    std::vector<::AVPacket *> _free;
+    size_t _capacity;
+    size_t _allocations{0};
+
+    void _release(::AVPacket * pkt) {
+        if (!pkt) return;
+        ::av_packet_unref(pkt);
+        if (_free.size() < _capacity) {
+            _free.push_back(pkt);
+        } else {
+            ::av_packet_free(&pkt);
+        }
+    }
+
+    void _freeAll() {
+        for (auto * pkt: _free) {
+            ::av_packet_free(&pkt);
+        }
+        _free.clear();
+    }
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 using AVFormatContextBase = std::unique_ptr<::AVFormatContext, void (*)(::AVFormatContext *)>;
 using AVCodecContextBase = std::unique_ptr<::AVCodecContext, void (*)(::AVCodecContext *)>;
@@ -341,6 +538,9 @@ public:
     AVPacket end() { return AVPacket(); }
     AVPacket begin() { return AVPacket(get()); }
     std::map<int, AVCodecContext> open_streams;// Original
+    // Frames and packets reused by the decode and encode helpers below
+    AVFramePool frame_pool;
+    AVPacketPool packet_pool;
     //std::map<int, std::unique_ptr<::AVCodecContext, void (*)(::AVCodecContext*)>> open_streams; #From Video Lecture
 };
 
@@ -433,15 +633,6 @@ inline int av_interleaved_write_frame(AVFormatContext & fmtCtx, int stream_index
     return err;
 }
 ///////////////////////////////////////////////////////////////////////////////
-using AVFrame = std::shared_ptr<::AVFrame>;
-
-inline AVFrame av_frame_alloc() {
-    return AVFrame(::av_frame_alloc(), [](::AVFrame * frame) {
-        auto * pframe = &frame;
-        av_frame_free(pframe);
-    });
-}
-
 inline AVFrame av_frame_clone(::AVFrame const * frame) {
     auto newFrame = av_frame_alloc();
     if (::av_frame_ref(newFrame.get(), frame) < 0) {
@@ -527,19 +718,22 @@ inline void convert_frame(AVFrame & frame_in, AVFrame & frame_out) {
 
 
 ///////////////////////////////////////////////////////////////////////////////
-inline int av_open_best_stream(AVFormatContext & fmtCtx, AVMediaType type, int related_stream = -1) {
-    int idx = -1;
-
-    //https://www.mail-archive.com/debian-bugs-dist@lists.debian.org/msg1862296.html
-#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(59, 0, 100)
-    ::AVCodec * codec = nullptr;
-    ::AVCodec ** pcodec = &codec;
-#else
-    ::AVCodec const * codec = nullptr;
-    ::AVCodec const ** pcodec = &codec;
-#endif
+/**
+* Opens a decoder for stream idx and stores it in fmtCtx.open_streams.
+*
+* @param options Decoder options passed to avcodec_open2, such as {"lowres", "2"}
+* @return idx on success, -1 if the stream does not exist or no decoder could be opened
+*/
+inline int av_open_stream(AVFormatContext & fmtCtx, int idx, AVDictionary const & options = AVDictionary()) {
+    if (idx < 0 || idx >= static_cast<int>(fmtCtx->nb_streams)) {
+        return -1;
+    }
+    if (fmtCtx.open_streams.count(idx)) {
+        return idx;
+    }
 
-    if ((idx = ::av_find_best_stream(fmtCtx.get(), type, -1, related_stream, pcodec, 0)) < 0) {
+    auto codec = ::avcodec_find_decoder(fmtCtx->streams[idx]->codecpar->codec_id);
+    if (!codec) {
         return -1;
     }
     auto codecCtx = AVCodecContext(::avcodec_alloc_context3(codec),
@@ -550,7 +744,10 @@ inline int av_open_best_stream(AVFormatContext & fmtCtx, AVMediaType type, int r
     if (::avcodec_parameters_to_context(codecCtx.get(), fmtCtx->streams[idx]->codecpar) < 0) {
         return -1;
     }
-    if (::avcodec_open2(codecCtx.get(), codec, nullptr) < 0) {
+    auto avdict = libav::av_dictionary(options);
+    auto const err = ::avcodec_open2(codecCtx.get(), codec, &avdict);
+    libav::av_dict_free(avdict);
+    if (err < 0) {
         return -1;
     }
 
@@ -558,6 +755,14 @@ inline int av_open_best_stream(AVFormatContext & fmtCtx, AVMediaType type, int r
     return idx;
 }
 
+inline int av_open_best_stream(AVFormatContext & fmtCtx, AVMediaType type, int related_stream = -1) {
+    int idx = ::av_find_best_stream(fmtCtx.get(), type, -1, related_stream, nullptr, 0);
+    if (idx < 0) {
+        return -1;
+    }
+    return av_open_stream(fmtCtx, idx);
+}
+
 inline int av_open_best_streams(AVFormatContext & fmtCtx) {
     auto v = av_open_best_stream(fmtCtx, AVMEDIA_TYPE_VIDEO);
     auto a = av_open_best_stream(fmtCtx, AVMEDIA_TYPE_AUDIO, v);
@@ -566,6 +771,48 @@ inline int av_open_best_streams(AVFormatContext & fmtCtx) {
     return fmtCtx.open_streams.size();
 }
 
+/**
+* Indices of the video streams in the file, in container order. Cover art and other attached
+* pictures are excluded.
+*/
+inline std::vector<int> find_video_streams(AVFormatContext const & fmtCtx) {
+    std::vector<int> streams;
+    for (unsigned i = 0; i < fmtCtx->nb_streams; ++i) {
+        auto const * st = fmtCtx->streams[i];
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && !(st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+            streams.push_back(static_cast<int>(i));
+        }
+    }
+    return streams;
+}
+
+/**
+* Opens the decoder for a single video stream and marks every other stream AVDISCARD_ALL,
+* so the demuxer drops their packets instead of returning them from av_read_frame.
+*
+* @param stream_index Stream to decode, or -1 to pick the best video stream
+* @param options Decoder options passed to avcodec_open2
+* @return The opened stream index, or -1 if it is not a video stream or could not be opened
+*/
+inline int av_open_video_stream(AVFormatContext & fmtCtx, int stream_index = -1, AVDictionary const & options = AVDictionary()) {
+    if (stream_index < 0) {
+        stream_index = ::av_find_best_stream(fmtCtx.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    }
+    if (stream_index < 0 || stream_index >= static_cast<int>(fmtCtx->nb_streams) ||
+        fmtCtx->streams[stream_index]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+        return -1;
+    }
+
+    for (auto it = fmtCtx.open_streams.begin(); it != fmtCtx.open_streams.end();) {
+        it = (it->first == stream_index) ? std::next(it) : fmtCtx.open_streams.erase(it);
+    }
+    for (unsigned i = 0; i < fmtCtx->nb_streams; ++i) {
+        fmtCtx->streams[i]->discard = (static_cast<int>(i) == stream_index) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+
+    return av_open_stream(fmtCtx, stream_index, options);
+}
+
 inline AVCodecContext & find_open_audio_stream(AVFormatContext & fmtCtx) {
     for (auto & stream: fmtCtx.open_streams) {
         if (stream.second->codec_type == AVMEDIA_TYPE_AUDIO) {
@@ -604,52 +851,68 @@ inline AVCodecContext & find_open_video_stream(AVFormatContext & fmtCtx) {
 *
 * @param fmtCtx The format context containing the stream to which the packet belongs.
 * @param pkt The packet to be sent to the decoder. Must not be `nullptr`.
-* @param onFrame A callback function to be called for each decoded frame. The function signature should match
-*                `void(AVFrame)`, where the `AVFrame` is the decoded frame.
+* @param onFrame Any callable invoked for each decoded frame as `onFrame(AVFrame const &)`. The frame is
+*                passed by reference; copy it to keep it beyond the call. Lambdas are called directly, so
+*                tight decode loops compile down to inlined calls.
 * @return Returns 0 if the packet was processed successfully or if `AVERROR(EAGAIN)` was returned indicating that
 *         further input is needed. Any other error code is returned if an error occurred during processing.
 */
+template<class OnFrame>
 inline int avcodec_send_packet(AVFormatContext & fmtCtx,
                                ::AVPacket * pkt,
-                               std::function<void(AVFrame)> onFrame) {
+                               OnFrame && onFrame) {
     int err = AVERROR(1);
     auto codecCtx = fmtCtx.open_streams.find(pkt->stream_index);
 
     if (codecCtx != fmtCtx.open_streams.end()) {
         err = ::avcodec_send_packet(codecCtx->second.get(), pkt);
         while (err >= 0) {
-            auto frame = av_frame_alloc();
+            auto frame = fmtCtx.frame_pool.acquire();
             err = ::avcodec_receive_frame(codecCtx->second.get(), frame.get());
             if (err < 0) break;
-            onFrame(frame);
+            onFrame(static_cast<AVFrame const &>(frame));
         };
     }
     return err == AVERROR(EAGAIN) ? 0 : err;
 }
 
+/**
+* std::function version of avcodec_send_packet, kept for existing callers. The callback receives a copy of
+* the frame.
+*/
+inline int avcodec_send_packet(AVFormatContext & fmtCtx,
+                               ::AVPacket * pkt,
+                               std::function<void(AVFrame)> onFrame) {
+    return libav::avcodec_send_packet(fmtCtx, pkt, [&onFrame](AVFrame const & frame) { onFrame(frame); });
+}
+
 /**
 * Flushes the decoder by sending an empty packet.
 *
 * This function is designed to flush the internal buffers of the decoder. It allocates an empty packet
 * (both data and size set to zero) and sends it to the decoder through the `avcodec_send_packet` function.
 * This operation signals the decoder that there are no more packets to decode, prompting it to process
-* and return any frames that are still buffered within. The function then frees the allocated packet to
-* prevent memory leaks. This is particularly useful at the end of a decoding process to ensure all
+* and return any frames that are still buffered within. The empty packet comes from the packet pool of
+* the format context and is returned to it afterwards. This is particularly useful at the end of a decoding process to ensure all
 * buffered frames are processed and returned.
 *
 * @param fmtCtx The format context associated with the decoder. It contains the decoder's state and stream information.
-* @param onFrame A callback function that will be called for each frame that is flushed from the decoder. The callback
-*                function must accept an `AVFrame` as its parameter.
+* @param onFrame Any callable invoked for each frame flushed from the decoder as `onFrame(AVFrame const &)`.
+* @param stream_index The stream whose decoder is flushed.
 * @return Returns the result of the `avcodec_send_packet` function. A return value of 0 indicates success, while
 *         a negative value indicates an error.
 */
-inline int flush_decoder(AVFormatContext & fmtCtx, std::function<void(AVFrame)> onFrame) {
-    ::AVPacket * flushPkt = ::av_packet_alloc();
+template<class OnFrame>
+inline int flush_decoder(AVFormatContext & fmtCtx, OnFrame && onFrame, int stream_index = 0) {
+    auto flushPkt = fmtCtx.packet_pool.acquire();
     flushPkt->data = nullptr;
     flushPkt->size = 0;
-    int result = avcodec_send_packet(fmtCtx, flushPkt, onFrame);
-    ::av_packet_free(&flushPkt);
-    return result;
+    flushPkt->stream_index = stream_index;
+    return libav::avcodec_send_packet(fmtCtx, flushPkt.get(), std::forward<OnFrame>(onFrame));
+}
+
+inline int flush_decoder(AVFormatContext & fmtCtx, std::function<void(AVFrame)> onFrame) {
+    return libav::flush_decoder(fmtCtx, [&onFrame](AVFrame const & frame) { onFrame(frame); });
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -793,6 +1056,107 @@ inline AVCodecContext make_encode_context(AVFormatContext & media, std::string c
 inline AVCodecContext DLLOPT make_encode_context_nvenc(AVFormatContext & media, int width, int height, int fps) {
     return make_encode_context(media, "h264_nvenc", width, height, fps, ::AV_PIX_FMT_CUDA);
 }
+
+/**
+* Creates and opens a CPU encoder, and adds a matching stream to the output media.
+*
+* Unlike make_encode_context, the codec is opened here with its final settings, so packets can be
+* written with software_encode without reopening the codec for every frame. The stream time base is
+* set to the codec time base; the muxer may still change it when the header is written.
+*
+* @param media Output format context that receives the new stream
+* @param codec_name Encoder name as known to FFmpeg, such as "libx264", "mpeg4" or "mjpeg"
+* @param width Frame width in pixels
+* @param height Frame height in pixels
+* @param fps Nominal frame rate
+* @param time_base Time base of the frame timestamps that will be sent to the encoder
+* @param gop_size Maximum distance between keyframes
+* @param max_b_frames Maximum number of consecutive B-frames (ignored by codecs without B-frames)
+* @param options Private encoder options passed to avcodec_open2, such as {"preset", "veryfast"}
+* @return An open codec context, or an empty one if the encoder could not be found or opened
+*/
+inline AVCodecContext make_encode_context_software(AVFormatContext & media, std::string const & codec_name,
+                                                   int width, int height, int fps, ::AVRational time_base,
+                                                   int gop_size, int max_b_frames,
+                                                   AVDictionary const & options = AVDictionary()) {
+    ::AVCodec const * codec = ::avcodec_find_encoder_by_name(codec_name.c_str());
+    if (!codec) {
+        std::cout << "Could not find encoder " << codec_name << std::endl;
+        return AVCodecContext();
+    }
+    auto codecCtx = AVCodecContext(::avcodec_alloc_context3(codec),
+                                   [](::AVCodecContext * c) {
+                                       ::avcodec_free_context(&c);
+                                   });
+
+    codecCtx->width = width;
+    codecCtx->height = height;
+    // The MJPEG encoder expects full range input
+    codecCtx->pix_fmt = (codec->id == ::AV_CODEC_ID_MJPEG) ? ::AV_PIX_FMT_YUVJ420P : ::AV_PIX_FMT_YUV420P;
+    codecCtx->time_base = time_base;
+    codecCtx->framerate = ::AVRational({fps, 1});
+    codecCtx->gop_size = gop_size;
+    codecCtx->max_b_frames = max_b_frames;
+
+    if (media->oformat && (media->oformat->flags & AVFMT_GLOBALHEADER)) {
+        codecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    auto avdict = libav::av_dictionary(options);
+    auto err = ::avcodec_open2(codecCtx.get(), codec, &avdict);
+    libav::av_dict_free(avdict);
+    if (err < 0) {
+        std::cout << "Could not open encoder " << codec_name << std::endl;
+        return AVCodecContext();
+    }
+
+    ::AVStream * videoStream = ::avformat_new_stream(media.get(), nullptr);
+    ::avcodec_parameters_from_context(videoStream->codecpar, codecCtx.get());
+    videoStream->time_base = codecCtx->time_base;
+    videoStream->avg_frame_rate = codecCtx->framerate;
+
+    return codecCtx;
+}
+
+/**
+* Sends a frame to an encoder opened with make_encode_context_software and writes every packet it produces.
+*
+* Passing a null frame puts the encoder in drain mode, and all remaining packets are written.
+* Packet timestamps are rescaled from the codec time base to the stream time base before muxing.
+*
+* @return 0 on success or a negative AVERROR code
+*/
+inline int DLLOPT software_encode(AVFormatContext & media, AVCodecContext & ctx, ::AVFrame * frame, int stream_index = 0) {
+    auto err = ::avcodec_send_frame(ctx.get(), frame);
+    if (err < 0 && err != AVERROR_EOF) {
+        std::cout << "Error sending frame to encoder" << std::endl;
+        return err;
+    }
+
+    auto pkt = media.packet_pool.acquire();
+    while (true) {
+        err = ::avcodec_receive_packet(ctx.get(), pkt.get());
+        if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+            err = 0;
+            break;
+        }
+        if (err < 0) {
+            break;
+        }
+
+        pkt->stream_index = stream_index;
+        ::av_packet_rescale_ts(pkt.get(), ctx->time_base, media->streams[stream_index]->time_base);
+
+        // av_interleaved_write_frame takes ownership of the packet reference
+        err = ::av_interleaved_write_frame(media.get(), pkt.get());
+        if (err < 0) {
+            std::cout << "Error writing packet" << std::endl;
+            break;
+        }
+    }
+    return err;
+}
+
 /*
 inline AVCodecContext make_encode_context_h264(AVFormatContext& media,int width, int height, int fps) 
 {
@@ -825,7 +1189,10 @@ inline void bind_hardware_frames_context(AVCodecContext & ctx, int width, int he
 }
 
 inline void DLLOPT open_encode_stream_to_write(AVFormatContext & media, std::string file_name) {
-    ::avio_open(&media->pb, file_name.c_str(), AVIO_FLAG_WRITE);
+    // avformat_open_output already opens the file, so only open it here if that has not happened
+    if (!media->pb) {
+        ::avio_open(&media->pb, file_name.c_str(), AVIO_FLAG_WRITE);
+    }
 
     auto success = ::avformat_write_header(media.get(), NULL);
 }
@@ -848,7 +1215,7 @@ inline int DLLOPT hardware_encode_flush(AVFormatContext & media, AVCodecContext
     ::AVCodec const * codec = ::avcodec_find_encoder_by_name(codec_name.c_str());
     ::avcodec_open2(ctx.get(), codec, NULL);// Why does this have to happen with every write?
 
-    auto pkt = av_packet_alloc();
+    auto pkt = media.packet_pool.acquire();
 
     auto err = ::avcodec_receive_packet(ctx.get(), pkt.get());
 
@@ -883,7 +1250,8 @@ inline int DLLOPT hardware_encode_flush(AVFormatContext & media, AVCodecContext
 
 inline int DLLOPT hardware_encode(AVFormatContext & media, AVCodecContext & ctx, AVFrame & sw_frame, int frame_count) {
 
-    auto * hw_frame = ::av_frame_alloc();
+    auto hw_frame_ref = media.frame_pool.acquire();
+    auto * hw_frame = hw_frame_ref.get();
     auto err = ::av_hwframe_get_buffer(ctx->hw_frames_ctx, hw_frame, 0);
     if (err) {
         std::cout << "Could not get hardware frame buffer";
@@ -898,7 +1266,7 @@ inline int DLLOPT hardware_encode(AVFormatContext & media, AVCodecContext & ctx,
         std::cout << "Error transferring data frame to surface";
     }
 
-    auto pkt = av_packet_alloc();
+    auto pkt = media.packet_pool.acquire();
 
     ::avcodec_send_frame(ctx.get(), hw_frame);
 
@@ -924,7 +1292,8 @@ inline int DLLOPT hardware_encode(AVFormatContext & media, AVCodecContext & ctx,
     }
 
     ::av_packet_unref(pkt.get());
-    ::av_frame_free(&hw_frame);
+    // Return the surface to the hardware frame pool now rather than when the frame is next acquired
+    ::av_frame_unref(hw_frame);
 
     return err;
 }
@@ -0,0 +1,332 @@
+#include "frame_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace ffmpeg_wrapper_frame_server {
+
+namespace protocol = ffmpeg_wrapper::frame_server;
+
+namespace {
+
+// Offsets of images in the memfd are aligned so clients can use SIMD loads on them
+constexpr size_t kImageAlignment = 64;
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+}// namespace
+
+FrameServer::Connection::~Connection() {
+    ::close(fd);
+}
+
+FrameServer::FrameServer(ServerOptions options)
+    : _options(std::move(options)),
+      _manager(_options.manager) {
+}
+
+FrameServer::~FrameServer() {
+    stop();
+}
+
+bool FrameServer::start() {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (_options.socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Socket path is too long: " << _options.socket_path << std::endl;
+        return false;
+    }
+    std::memcpy(addr.sun_path, _options.socket_path.c_str(), _options.socket_path.size() + 1);
+
+    // A socket file nobody answers on is left over from a server that did not shut down cleanly
+    ffmpeg_wrapper::FrameServerClient probe;
+    if (::access(_options.socket_path.c_str(), F_OK) == 0) {
+        if (probe.connect(_options.socket_path)) {
+            std::cout << "A frame server is already running on " << _options.socket_path << std::endl;
+            return false;
+        }
+        ::unlink(_options.socket_path.c_str());
+    }
+
+    _listen_fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (_listen_fd < 0 || ::bind(_listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ::listen(_listen_fd, SOMAXCONN) != 0) {
+        std::cout << "Could not listen on " << _options.socket_path << ": " << std::strerror(errno) << std::endl;
+        if (_listen_fd >= 0) ::close(_listen_fd);
+        _listen_fd = -1;
+        return false;
+    }
+    if (::pipe2(_wake_pipe, O_CLOEXEC) != 0) {
+        ::close(_listen_fd);
+        _listen_fd = -1;
+        return false;
+    }
+
+    size_t workers = _options.workers;
+    if (workers == 0) {
+        workers = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    _stopping = false;
+    for (size_t i = 0; i < workers; ++i) {
+        _workers.emplace_back(&FrameServer::_workerLoop, this);
+    }
+    _io_thread = std::thread(&FrameServer::_ioLoop, this);
+    return true;
+}
+
+void FrameServer::stop() {
+    if (_listen_fd < 0) {
+        return;
+    }
+
+    char const wake = 1;
+    (void) !::write(_wake_pipe[1], &wake, 1);
+    _io_thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+    for (auto & worker: _workers) {
+        worker.join();
+    }
+    _workers.clear();
+
+    ::close(_listen_fd);
+    ::close(_wake_pipe[0]);
+    ::close(_wake_pipe[1]);
+    _listen_fd = -1;
+    _wake_pipe[0] = _wake_pipe[1] = -1;
+    ::unlink(_options.socket_path.c_str());
+}
+
+void FrameServer::_ioLoop() {
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::vector<pollfd> fds;
+
+    while (true) {
+        fds.clear();
+        fds.push_back({_wake_pipe[0], POLLIN, 0});
+        fds.push_back({_listen_fd, POLLIN, 0});
+        for (auto const & connection: connections) {
+            fds.push_back({connection->fd, POLLIN, 0});
+        }
+
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cout << "Frame server poll failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+        if (fds[0].revents != 0) {
+            return;
+        }
+
+        // Connections are dropped from the poll set here, and closed once no queued job refers to them
+        std::vector<std::shared_ptr<Connection>> open;
+        open.reserve(connections.size() + 1);
+        for (size_t i = 0; i < connections.size(); ++i) {
+            short const revents = fds[i + 2].revents;
+            bool keep = true;
+            if (revents & POLLIN) {
+                keep = _readRequest(connections[i]);
+            } else if (revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                keep = false;
+            }
+            if (keep) {
+                open.push_back(std::move(connections[i]));
+            }
+        }
+        connections.swap(open);
+
+        if (fds[1].revents & POLLIN) {
+            int const fd = ::accept4(_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                connections.push_back(std::make_shared<Connection>(fd));
+            }
+        }
+    }
+}
+
+bool FrameServer::_readRequest(std::shared_ptr<Connection> const & connection) {
+    std::vector<uint8_t> message(sizeof(protocol::FrameRequestHeader) + protocol::kMaxPathLength +
+                                 protocol::kMaxBatchFrames * sizeof(int32_t));
+    ssize_t const received = ::recv(connection->fd, message.data(), message.size(), MSG_TRUNC);
+    if (received <= 0) {
+        return false;// Client hung up
+    }
+
+    protocol::FrameRequestHeader header;
+    bool const has_header = static_cast<size_t>(received) >= sizeof(header);
+    bool valid = has_header && static_cast<size_t>(received) <= message.size();
+    if (has_header) {
+        std::memcpy(&header, message.data(), sizeof(header));
+    }
+    if (valid) {
+        valid = header.magic == protocol::kMagic && header.version == protocol::kVersion &&
+                (header.type == protocol::GetFrames || header.type == protocol::Prefetch) &&
+                header.path_length > 0 && header.path_length <= protocol::kMaxPathLength &&
+                header.count <= protocol::kMaxBatchFrames &&
+                static_cast<size_t>(received) == sizeof(header) + header.path_length + header.count * sizeof(int32_t);
+    }
+    if (!valid) {
+        // The client does not wait for an answer to a prefetch, so a reply would be taken as the answer to
+        // its next GetFrames request
+        if (has_header && header.type == protocol::Prefetch) {
+            return true;
+        }
+        protocol::FrameReplyHeader reply;
+        reply.status = protocol::BadRequest;
+        _reply(*connection, reply, {}, -1);
+        return true;
+    }
+
+    Job job;
+    job.priority = header.priority;
+    job.type = header.type;
+    job.path.assign(reinterpret_cast<char const *>(message.data() + sizeof(header)), header.path_length);
+    job.frames.resize(header.count);
+    std::memcpy(job.frames.data(), message.data() + sizeof(header) + header.path_length, header.count * sizeof(int32_t));
+    job.connection = connection;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        job.sequence = _next_sequence++;
+        _jobs.push(std::move(job));
+    }
+    _cv.notify_one();
+    return true;
+}
+
+void FrameServer::_workerLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _stopping || !_jobs.empty(); });
+            if (_jobs.empty()) {
+                return;
+            }
+            job = _jobs.top();
+            _jobs.pop();
+        }
+        _serve(job);
+    }
+}
+
+void FrameServer::_serve(Job const & job) {
+    // Decode in ascending frame order, reply in the order requested
+    std::vector<size_t> order(job.frames.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&job](size_t a, size_t b) { return job.frames[a] < job.frames[b]; });
+
+    if (job.type == protocol::Prefetch) {
+        int width;
+        int height;
+        if (_manager.getVideoSize(job.path, width, height)) {
+            for (size_t i: order) {
+                _manager.getFrame(job.path, job.frames[i]);
+            }
+        }
+        return;
+    }
+
+    protocol::FrameReplyHeader header;
+    header.format = static_cast<int32_t>(_options.manager.format);
+    if (!_manager.getVideoSize(job.path, header.width, header.height)) {
+        header.status = protocol::OpenFailed;
+        _reply(*job.connection, header, {}, -1);
+        return;
+    }
+
+    std::vector<std::vector<uint8_t>> images(job.frames.size());
+    for (size_t k = 0; k < order.size(); ++k) {
+        size_t const i = order[k];
+        if (k > 0 && job.frames[order[k - 1]] == job.frames[i]) {
+            images[i] = images[order[k - 1]];
+        } else {
+            images[i] = _manager.getFrame(job.path, job.frames[i]);
+        }
+    }
+
+    std::vector<protocol::FrameReplyEntry> entries(job.frames.size());
+    size_t total = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i].frame = job.frames[i];
+        entries[i].offset = total;
+        entries[i].size = images[i].size();
+        total = alignUp(total + images[i].size(), kImageAlignment);
+    }
+    header.count = static_cast<uint32_t>(entries.size());
+    header.total_bytes = total;
+
+    if (total == 0) {
+        _reply(*job.connection, header, entries, -1);
+        return;
+    }
+
+    int const memfd = ::memfd_create("ffmpeg_wrapper_frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    void * mapping = MAP_FAILED;
+    if (memfd >= 0 && ::ftruncate(memfd, static_cast<off_t>(total)) == 0) {
+        mapping = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        std::cout << "Could not create frame memfd: " << std::strerror(errno) << std::endl;
+        if (memfd >= 0) ::close(memfd);
+        header.status = protocol::ServerError;
+        header.count = 0;
+        header.total_bytes = 0;
+        _reply(*job.connection, header, {}, -1);
+        return;
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::memcpy(static_cast<uint8_t *>(mapping) + entries[i].offset, images[i].data(), images[i].size());
+    }
+    ::munmap(mapping, total);
+
+    // Sealed, so a client can map it without worrying that the server will change or truncate it
+    ::fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+
+    _reply(*job.connection, header, entries, memfd);
+    ::close(memfd);
+}
+
+void FrameServer::_reply(Connection const & connection, protocol::FrameReplyHeader header,
+                         std::vector<protocol::FrameReplyEntry> const & entries, int memfd) {
+    iovec iov[2] = {
+            {&header, sizeof(header)},
+            {const_cast<protocol::FrameReplyEntry *>(entries.data()), entries.size() * sizeof(protocol::FrameReplyEntry)},
+    };
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    if (memfd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr * c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(c), &memfd, sizeof(int));
+    }
+
+    // A failure means the client went away; the I/O thread notices and drops the connection
+    (void) ::sendmsg(connection.fd, &msg, MSG_NOSIGNAL);
+}
+
+}// namespace ffmpeg_wrapper_frame_server
@@ -0,0 +1,97 @@
+#ifndef FFMPEG_WRAPPER_FRAME_SERVER_H
+#define FFMPEG_WRAPPER_FRAME_SERVER_H
+
+#include "ffmpeg_wrapper/decodermanager.h"
+#include "ffmpeg_wrapper/frameserverclient.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ffmpeg_wrapper_frame_server {
+
+struct ServerOptions {
+    std::string socket_path{ffmpeg_wrapper::frame_server::defaultSocketPath()};
+    size_t workers{0};// Threads serving requests, 0 for one per hardware thread
+    ffmpeg_wrapper::DecoderManagerOptions manager;
+};
+
+/*
+
+Serves frames to local clients over the protocol in frameserverclient.h.
+
+One I/O thread accepts connections and reads requests into a priority queue. Worker threads take the
+most urgent request, decode its frames through a shared DecoderManager and send the images back in a
+memfd. Frames of a batch are decoded in ascending order, which keeps the decoder moving forward through
+each GOP, and are returned in the order the client asked for them.
+
+*/
+class FrameServer {
+public:
+    explicit FrameServer(ServerOptions options);
+    ~FrameServer();
+
+    FrameServer(FrameServer const &) = delete;
+    FrameServer & operator=(FrameServer const &) = delete;
+
+    // Bind the socket and start the I/O and worker threads
+    bool start();
+
+    // Stop accepting requests, finish the queued ones, and remove the socket
+    void stop();
+
+private:
+    struct Connection {
+        explicit Connection(int fd_)
+            : fd(fd_) {}
+        ~Connection();
+        int fd;
+    };
+
+    struct Job {
+        int priority{0};
+        uint64_t sequence{0};
+        uint16_t type{0};
+        std::string path;
+        std::vector<int> frames;
+        std::shared_ptr<Connection> connection;
+    };
+
+    struct JobOrder {
+        bool operator()(Job const & a, Job const & b) const {
+            // std::priority_queue pops the largest element: highest priority, then oldest
+            return a.priority != b.priority ? a.priority < b.priority : a.sequence > b.sequence;
+        }
+    };
+
+    ServerOptions _options;
+    ffmpeg_wrapper::DecoderManager _manager;
+
+    int _listen_fd{-1};
+    int _wake_pipe[2]{-1, -1};// Readable once stop() has been called
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::priority_queue<Job, std::vector<Job>, JobOrder> _jobs;
+    uint64_t _next_sequence{0};
+    bool _stopping{false};
+
+    std::thread _io_thread;
+    std::vector<std::thread> _workers;
+
+    void _ioLoop();
+    bool _readRequest(std::shared_ptr<Connection> const & connection);
+    void _workerLoop();
+    void _serve(Job const & job);
+    void _reply(Connection const & connection, ffmpeg_wrapper::frame_server::FrameReplyHeader header,
+                std::vector<ffmpeg_wrapper::frame_server::FrameReplyEntry> const & entries, int memfd);
+};
+
+}// namespace ffmpeg_wrapper_frame_server
+
+#endif// FFMPEG_WRAPPER_FRAME_SERVER_H
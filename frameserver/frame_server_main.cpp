@@ -0,0 +1,90 @@
+#include "frame_server.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <pthread.h>
+
+/*
+
+Local frame server.
+
+Usage:
+    ffmpeg_wrapper_frame_server [--socket path] [--workers N] [--max-open N] [--max-memory-mb N] [--format gray8|argb|gray16|rgb48]
+
+Serves frames of any video readable by this process to clients using ffmpeg_wrapper::FrameServerClient.
+Runs until it receives SIGINT or SIGTERM.
+
+*/
+
+using namespace ffmpeg_wrapper_frame_server;
+
+namespace {
+
+bool parse_args(int argc, char ** argv, ServerOptions & options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string const arg = argv[i];
+        bool const has_value = i + 1 < argc;
+        if (arg == "--socket" && has_value) {
+            options.socket_path = argv[++i];
+        } else if (arg == "--workers" && has_value) {
+            options.workers = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+        } else if (arg == "--max-open" && has_value) {
+            options.manager.max_open_decoders = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--max-memory-mb" && has_value) {
+            options.manager.max_memory_bytes = static_cast<size_t>(std::max(1, std::atoi(argv[++i]))) << 20;
+        } else if (arg == "--format" && has_value) {
+            std::string const format = argv[++i];
+            if (format == "gray8") {
+                options.manager.format = ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray8;
+            } else if (format == "argb") {
+                options.manager.format = ffmpeg_wrapper::VideoDecoder::OutputFormat::ARGB;
+            } else if (format == "gray16") {
+                options.manager.format = ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray16;
+            } else if (format == "rgb48") {
+                options.manager.format = ffmpeg_wrapper::VideoDecoder::OutputFormat::RGB48;
+            } else {
+                std::cout << "Unknown format " << format << std::endl;
+                return false;
+            }
+        } else {
+            std::cout << "Usage: " << argv[0]
+                      << " [--socket path] [--workers N] [--max-open N] [--max-memory-mb N] [--format gray8|argb|gray16|rgb48]"
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+}// namespace
+
+int main(int argc, char ** argv) {
+    ServerOptions options;
+    if (!parse_args(argc, argv, options)) {
+        return EXIT_FAILURE;
+    }
+
+    // Block the shutdown signals before any thread starts, so they all inherit the mask and sigwait gets them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    FrameServer server(options);
+    if (!server.start()) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "Serving frames on " << options.socket_path << std::endl;
+
+    int received = 0;
+    sigwait(&signals, &received);
+
+    std::cout << "Shutting down" << std::endl;
+    server.stop();
+    return EXIT_SUCCESS;
+}
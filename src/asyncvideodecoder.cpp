@@ -0,0 +1,158 @@
+#include "asyncvideodecoder.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace ffmpeg_wrapper {
+
+AsyncVideoDecoder::AsyncVideoDecoder()
+    : _worker(&AsyncVideoDecoder::_workerLoop, this) {
+}
+
+AsyncVideoDecoder::AsyncVideoDecoder(std::string const & filename)
+    : AsyncVideoDecoder() {
+    createMedia(filename);
+}
+
+AsyncVideoDecoder::~AsyncVideoDecoder() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    _worker.join();
+
+    // Nothing will serve what is left, so release the waiters rather than break their promises
+    cancelPending();
+}
+
+void AsyncVideoDecoder::createMedia(std::string const & filename) {
+    cancelPending();
+    std::lock_guard<std::mutex> lock(_decoder_mutex);
+    _decoder.createMedia(filename);
+}
+
+std::future<AsyncFrameResult> AsyncVideoDecoder::getFrameAsync(int frame) {
+    auto promise = std::make_shared<std::promise<AsyncFrameResult>>();
+    auto future = promise->get_future();
+    _enqueue(frame, Waiter{std::move(promise), nullptr});
+    return future;
+}
+
+void AsyncVideoDecoder::getFrameAsync(int frame, Callback callback) {
+    _enqueue(frame, Waiter{nullptr, std::move(callback)});
+}
+
+void AsyncVideoDecoder::cancelPending() {
+    std::deque<Request> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        cancelled.swap(_pending);
+        _cancelled += cancelled.size();
+    }
+    for (auto & request: cancelled) {
+        _complete(request.waiters, AsyncFrameResult{request.frame, {}, true});
+    }
+}
+
+void AsyncVideoDecoder::setMaxPending(size_t max_pending) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _max_pending = std::max<size_t>(max_pending, 1);
+}
+
+uint64_t AsyncVideoDecoder::requestsCoalesced() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _coalesced;
+}
+
+uint64_t AsyncVideoDecoder::requestsCancelled() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cancelled;
+}
+
+void AsyncVideoDecoder::_enqueue(int frame, Waiter waiter) {
+    std::vector<Request> cancelled;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_current && _current->frame == frame) {
+            _current->waiters.push_back(std::move(waiter));
+            _coalesced++;
+            return;
+        }
+        auto queued = std::find_if(_pending.begin(), _pending.end(),
+                                   [frame](Request const & r) { return r.frame == frame; });
+        if (queued != _pending.end()) {
+            queued->waiters.push_back(std::move(waiter));
+            _coalesced++;
+            return;
+        }
+
+        while (_pending.size() >= _max_pending) {
+            cancelled.push_back(std::move(_pending.front()));
+            _pending.pop_front();
+            _cancelled++;
+        }
+        Request request;
+        request.frame = frame;
+        request.waiters.push_back(std::move(waiter));
+        _pending.push_back(std::move(request));
+    }
+    _cv.notify_one();
+
+    // Complete cancelled requests outside the lock, since callbacks may issue new requests
+    for (auto & request: cancelled) {
+        _complete(request.waiters, AsyncFrameResult{request.frame, {}, true});
+    }
+}
+
+void AsyncVideoDecoder::_workerLoop() {
+    trace::setThreadName("async decoder");
+
+    while (true) {
+        int frame;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _stop || !_pending.empty(); });
+            if (_stop) {
+                return;
+            }
+            _current = std::make_unique<Request>(std::move(_pending.front()));
+            _pending.pop_front();
+            frame = _current->frame;
+        }
+
+        AsyncFrameResult result;
+        result.frame = frame;
+        {
+            trace::TraceScope const trace_scope("AsyncVideoDecoder::getFrame", "decoder", "frame", frame);
+            std::lock_guard<std::mutex> lock(_decoder_mutex);
+            result.data = _decoder.getFrame(frame);
+        }
+
+        std::unique_ptr<Request> done;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            done = std::move(_current);
+        }
+        _complete(done->waiters, std::move(result));
+    }
+}
+
+void AsyncVideoDecoder::_complete(std::vector<Waiter> & waiters, AsyncFrameResult result) {
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        auto & waiter = waiters[i];
+        // The last waiter can take the image instead of copying it
+        bool const last = (i + 1 == waiters.size());
+        AsyncFrameResult r = last ? std::move(result) : result;
+        if (waiter.promise) {
+            waiter.promise->set_value(std::move(r));
+        } else if (waiter.callback) {
+            waiter.callback(std::move(r));
+        }
+    }
+}
+
+}// namespace ffmpeg_wrapper
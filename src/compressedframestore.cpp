@@ -0,0 +1,344 @@
+#include "compressedframestore.h"
+
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+/*
+Run-length code, one control byte per run:
+  0..127    the next control + 1 bytes are copied as they are
+  128..254  control - 127 zero bytes
+  255       a LEB128 count of zero bytes follows
+*/
+constexpr uint8_t kMaxLiteral = 128;
+constexpr uint8_t kShortZeroRun = 128;
+constexpr uint8_t kLongZeroRun = 255;
+constexpr size_t kMaxShortZeroRun = kLongZeroRun - kShortZeroRun;
+
+size_t countZeros(uint8_t const * src, size_t size) {
+    size_t n = 0;
+    // Static regions produce long runs, so skip them a word at a time
+    while (n + sizeof(uint64_t) <= size) {
+        uint64_t word;
+        std::memcpy(&word, src + n, sizeof(word));
+        if (word != 0) break;
+        n += sizeof(word);
+    }
+    while (n < size && src[n] == 0) n++;
+    return n;
+}
+
+void rleEncode(uint8_t const * src, size_t size, std::vector<uint8_t> & out) {
+    out.clear();
+    size_t i = 0;
+    while (i < size) {
+        size_t const zeros = countZeros(src + i, size - i);
+        if (zeros >= 2) {
+            if (zeros <= kMaxShortZeroRun) {
+                out.push_back(static_cast<uint8_t>(kShortZeroRun + zeros - 1));
+            } else {
+                out.push_back(kLongZeroRun);
+                for (size_t n = zeros; ; n >>= 7) {
+                    uint8_t const low = static_cast<uint8_t>(n & 0x7f);
+                    if (n < 0x80) {
+                        out.push_back(low);
+                        break;
+                    }
+                    out.push_back(static_cast<uint8_t>(low | 0x80));
+                }
+            }
+            i += zeros;
+            continue;
+        }
+
+        // Copy up to the next pair of zeros; a lone zero is cheaper inside a literal
+        size_t const start = i;
+        while (i < size && i - start < kMaxLiteral) {
+            if (src[i] == 0 && i + 1 < size && src[i + 1] == 0) break;
+            i++;
+        }
+        out.push_back(static_cast<uint8_t>(i - start - 1));
+        out.insert(out.end(), src + start, src + i);
+    }
+}
+
+bool rleDecode(uint8_t const * src, size_t src_size, uint8_t * dst, size_t dst_size) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < src_size) {
+        uint8_t const control = src[i++];
+        if (control < kShortZeroRun) {
+            size_t const n = static_cast<size_t>(control) + 1;
+            if (i + n > src_size || o + n > dst_size) return false;
+            std::memcpy(dst + o, src + i, n);
+            i += n;
+            o += n;
+            continue;
+        }
+        size_t n = 0;
+        if (control < kLongZeroRun) {
+            n = static_cast<size_t>(control) - kShortZeroRun + 1;
+        } else {
+            for (int shift = 0;; shift += 7) {
+                if (i >= src_size || shift > 56) return false;
+                uint8_t const byte = src[i++];
+                n |= static_cast<size_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) break;
+            }
+        }
+        if (o + n > dst_size) return false;
+        std::memset(dst + o, 0, n);
+        o += n;
+    }
+    return o == dst_size;
+}
+
+size_t sideDataBytes(::AVFrame const * frame) {
+    size_t bytes = 0;
+    for (int i = 0; i < frame->nb_side_data; ++i) {
+        bytes += frame->side_data[i]->size;
+    }
+    return bytes;
+}
+
+}// namespace
+
+bool CompressedFrameStore::_makeLayout(::AVFrame const * frame, Layout & layout) {
+    auto const format = static_cast<::AVPixelFormat>(frame->format);
+    auto const * desc = av_pix_fmt_desc_get(format);
+    if (!desc || frame->width <= 0 || frame->height <= 0 ||
+        (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT))) {
+        return false;
+    }
+
+    int plane_count = 0;
+    for (int c = 0; c < desc->nb_components; ++c) {
+        plane_count = std::max(plane_count, desc->comp[c].plane + 1);
+    }
+
+    layout.format = frame->format;
+    layout.width = frame->width;
+    layout.height = frame->height;
+    layout.planes.assign(static_cast<size_t>(plane_count), Plane());
+    layout.bytes = 0;
+    for (int p = 0; p < plane_count; ++p) {
+        auto & plane = layout.planes[static_cast<size_t>(p)];
+        plane.row_bytes = av_image_get_linesize(format, frame->width, p);
+        // Planes 1 and 2 are the chroma planes of planar YUV and are subsampled vertically
+        int const shift = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+        plane.rows = (frame->height + (1 << shift) - 1) >> shift;
+        for (int c = 0; c < desc->nb_components; ++c) {
+            if (desc->comp[c].plane == p) plane.step = std::max(plane.step, desc->comp[c].step);
+        }
+        if (plane.row_bytes <= 0 || !frame->data[p]) {
+            return false;
+        }
+        layout.bytes += static_cast<size_t>(plane.row_bytes) * static_cast<size_t>(plane.rows);
+    }
+    return true;
+}
+
+void CompressedFrameStore::setCapacity(size_t capacity_bytes) {
+    _capacity = capacity_bytes;
+    _evict();
+    if (_capacity == 0) {
+        // Give back the scratch buffers too
+        _reference = std::vector<uint8_t>();
+        _raw = std::vector<uint8_t>();
+        _residual = std::vector<uint8_t>();
+    }
+}
+
+void CompressedFrameStore::store(int frame_id, ::AVFrame const * frame) {
+    if (!isEnabled() || !frame || contains(frame_id)) {
+        return;
+    }
+    Layout layout;
+    if (!_makeLayout(frame, layout)) {
+        return;
+    }
+
+    _raw.resize(layout.bytes);
+    size_t offset = 0;
+    for (size_t p = 0; p < layout.planes.size(); ++p) {
+        auto const & plane = layout.planes[p];
+        for (int row = 0; row < plane.rows; ++row) {
+            std::memcpy(_raw.data() + offset, frame->data[p] + static_cast<ptrdiff_t>(row) * frame->linesize[p],
+                        static_cast<size_t>(plane.row_bytes));
+            offset += static_cast<size_t>(plane.row_bytes);
+        }
+    }
+
+    Entry entry;
+    entry.frame_id = frame_id;
+    entry.props = libav::av_frame_alloc();
+    if (!entry.props || av_frame_copy_props(entry.props.get(), frame) < 0) {
+        return;
+    }
+    entry.props_bytes = sizeof(::AVFrame) + sideDataBytes(frame);
+
+    _residual.resize(layout.bytes);
+    bool as_delta = false;
+    if (_has_open_group && _open_group->layout.matches(frame) && _open_group->entries.size() < kMaxGroupFrames &&
+        _loadReference(*_open_group)) {
+        for (size_t i = 0; i < layout.bytes; ++i) {
+            _residual[i] = static_cast<uint8_t>(_raw[i] - _reference[i]);
+        }
+        rleEncode(_residual.data(), _residual.size(), entry.data);
+        as_delta = entry.data.size() < layout.bytes / 2;
+    }
+
+    if (!as_delta) {
+        offset = 0;
+        for (auto const & plane: layout.planes) {
+            size_t const step = static_cast<size_t>(plane.step);
+            for (int row = 0; row < plane.rows; ++row) {
+                uint8_t const * src = _raw.data() + offset;
+                uint8_t * dst = _residual.data() + offset;
+                size_t const row_bytes = static_cast<size_t>(plane.row_bytes);
+                std::memcpy(dst, src, std::min(step, row_bytes));
+                for (size_t x = step; x < row_bytes; ++x) {
+                    dst[x] = static_cast<uint8_t>(src[x] - src[x - step]);
+                }
+                offset += row_bytes;
+            }
+        }
+        rleEncode(_residual.data(), _residual.size(), entry.data);
+
+        Group group;
+        group.id = _next_group_id++;
+        group.layout = std::move(layout);
+        _groups.push_front(std::move(group));
+        _open_group = _groups.begin();
+        _has_open_group = true;
+        // The frame is the new group's reference, and it is already decompressed
+        _reference.swap(_raw);
+        _reference_group = _open_group->id;
+    }
+
+    entry.data.shrink_to_fit();
+    size_t const entry_bytes = entry.data.size() + entry.props_bytes;
+    _open_group->entries.push_back(std::move(entry));
+    _open_group->bytes += entry_bytes;
+    _bytes += entry_bytes;
+    _uncompressed_bytes += _open_group->layout.bytes;
+    _index.emplace(frame_id, _open_group);
+    _groups.splice(_groups.begin(), _groups, _open_group);
+    _evict();
+}
+
+libav::AVFrame CompressedFrameStore::retrieve(int frame_id) {
+    auto const it = _index.find(frame_id);
+    if (it == _index.end()) {
+        return libav::AVFrame();
+    }
+    auto const group = it->second;
+    _groups.splice(_groups.begin(), _groups, group);
+
+    auto const entry = std::find_if(group->entries.begin(), group->entries.end(),
+                                    [frame_id](Entry const & e) { return e.frame_id == frame_id; });
+    auto const & layout = group->layout;
+
+    auto frame = libav::av_frame_alloc();
+    if (!frame || av_frame_copy_props(frame.get(), entry->props.get()) < 0) {
+        return libav::AVFrame();
+    }
+    frame->format = layout.format;
+    frame->width = layout.width;
+    frame->height = layout.height;
+    if (av_frame_get_buffer(frame.get(), 0) < 0) {
+        return libav::AVFrame();
+    }
+
+    if (!_loadReference(*group)) {
+        return libav::AVFrame();
+    }
+    uint8_t const * pixels = _reference.data();
+    if (entry != group->entries.begin()) {
+        _raw.resize(layout.bytes);
+        if (!rleDecode(entry->data.data(), entry->data.size(), _raw.data(), _raw.size())) {
+            return libav::AVFrame();
+        }
+        for (size_t i = 0; i < layout.bytes; ++i) {
+            _raw[i] = static_cast<uint8_t>(_raw[i] + _reference[i]);
+        }
+        pixels = _raw.data();
+    }
+
+    size_t offset = 0;
+    for (size_t p = 0; p < layout.planes.size(); ++p) {
+        auto const & plane = layout.planes[p];
+        for (int row = 0; row < plane.rows; ++row) {
+            std::memcpy(frame->data[p] + static_cast<ptrdiff_t>(row) * frame->linesize[p], pixels + offset,
+                        static_cast<size_t>(plane.row_bytes));
+            offset += static_cast<size_t>(plane.row_bytes);
+        }
+    }
+    return frame;
+}
+
+bool CompressedFrameStore::_loadReference(Group const & group) {
+    if (_reference_group == group.id) {
+        return true;
+    }
+    auto const & layout = group.layout;
+    auto const & reference = group.entries.front();
+    _reference.resize(layout.bytes);
+    if (!rleDecode(reference.data.data(), reference.data.size(), _reference.data(), _reference.size())) {
+        _reference_group = UINT64_MAX;
+        return false;
+    }
+    size_t offset = 0;
+    for (auto const & plane: layout.planes) {
+        size_t const step = static_cast<size_t>(plane.step);
+        size_t const row_bytes = static_cast<size_t>(plane.row_bytes);
+        for (int row = 0; row < plane.rows; ++row) {
+            uint8_t * pixels = _reference.data() + offset;
+            for (size_t x = step; x < row_bytes; ++x) {
+                pixels[x] = static_cast<uint8_t>(pixels[x] + pixels[x - step]);
+            }
+            offset += row_bytes;
+        }
+    }
+    _reference_group = group.id;
+    return true;
+}
+
+void CompressedFrameStore::clear() {
+    _groups.clear();
+    _index.clear();
+    _has_open_group = false;
+    _reference_group = UINT64_MAX;
+    _bytes = 0;
+    _uncompressed_bytes = 0;
+}
+
+size_t CompressedFrameStore::memoryBytes() const {
+    return _bytes + _reference.capacity() + _raw.capacity() + _residual.capacity();
+}
+
+void CompressedFrameStore::_evict() {
+    while (!_groups.empty() && _bytes > _capacity) {
+        auto & group = _groups.back();
+        for (auto const & entry: group.entries) {
+            _index.erase(entry.frame_id);
+            _uncompressed_bytes -= group.layout.bytes;
+        }
+        _bytes -= group.bytes;
+        if (_has_open_group && _open_group == std::prev(_groups.end())) {
+            _has_open_group = false;
+        }
+        if (_reference_group == group.id) {
+            _reference_group = UINT64_MAX;
+        }
+        _groups.pop_back();
+    }
+}
+
+}// namespace ffmpeg_wrapper
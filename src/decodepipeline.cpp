@@ -0,0 +1,174 @@
+#include "decodepipeline.h"
+
+#include "trace.h"
+
+#include "libavcodec/packet.h"
+#include "libavutil/avutil.h"
+
+#include <iostream>
+#include <utility>
+
+namespace ffmpeg_wrapper {
+
+DecodePipeline::DecodePipeline(std::string filename, int stream_index, Converter converter, size_t image_size,
+                               Options options)
+    : _filename(std::move(filename)),
+      _stream_index(stream_index),
+      _converter(std::move(converter)),
+      _image_size(image_size),
+      _options(options) {
+}
+
+DecodePipeline::DecodePipeline(std::string filename, int stream_index, Converter converter, size_t image_size)
+    : DecodePipeline(std::move(filename), stream_index, std::move(converter), image_size, Options{}) {
+}
+
+DecodePipeline::~DecodePipeline() {
+    stop();
+}
+
+bool DecodePipeline::start(int64_t seek_pts, int64_t first_wanted_pts) {
+    trace::TraceScope const trace_scope("DecodePipeline::start", "pipeline");
+    stop();
+
+    if (!_media) {
+        _media = libav::avformat_open_input(_filename);
+        if (!_media) {
+            std::cout << "Pipeline could not open " << _filename << std::endl;
+            return false;
+        }
+        if (libav::av_open_video_stream(_media, _stream_index) < 0) {
+            std::cout << "Pipeline could not open video stream " << _stream_index << std::endl;
+            _media.reset();
+            return false;
+        }
+        // Frames in flight are bounded by the frame and output queues
+        constexpr size_t kSparePooledFrames = 4;
+        _media.frame_pool.setCapacity(_options.frame_queue_depth + _options.output_queue_depth + kSparePooledFrames);
+    } else {
+        // Restarting after a previous run, possibly one that drained the decoder at end of stream
+        _media.open_streams[_stream_index].flush_buffers();
+    }
+
+    libav::av_seek_frame(_media, libav::flicks(seek_pts), _stream_index, AVSEEK_FLAG_BACKWARD);
+    _first_wanted_pts = first_wanted_pts;
+
+    _packets = std::make_unique<SPSCQueue<Packet>>(_options.packet_queue_depth);
+    _recycled_packets = std::make_unique<SPSCQueue<Packet>>(_options.packet_queue_depth);
+    _frames = std::make_unique<SPSCQueue<Output>>(_options.frame_queue_depth);
+    _outputs = std::make_unique<SPSCQueue<Output>>(_options.output_queue_depth);
+
+    _stop.store(false);
+    _finished = false;
+
+    _demux_thread = std::thread(&DecodePipeline::_demuxLoop, this);
+    _decode_thread = std::thread(&DecodePipeline::_decodeLoop, this);
+    _convert_thread = std::thread(&DecodePipeline::_convertLoop, this);
+    return true;
+}
+
+bool DecodePipeline::next(Output & output) {
+    if (_finished || !_outputs) {
+        return false;
+    }
+    if (!popWait(*_outputs, output, _stop)) {
+        return false;
+    }
+    if (output.end_of_stream) {
+        _finished = true;
+        return false;
+    }
+    return true;
+}
+
+void DecodePipeline::stop() {
+    _stop.store(true);
+    for (auto * thread: {&_demux_thread, &_decode_thread, &_convert_thread}) {
+        if (thread->joinable()) {
+            thread->join();
+        }
+    }
+}
+
+/*
+Reads packets of the selected stream. Packets the decode thread has finished with come back through
+_recycled_packets, so in steady state no packet is allocated. A null packet marks the end of the stream.
+*/
+void DecodePipeline::_demuxLoop() {
+    trace::setThreadName("pipeline demux");
+
+    Packet pkt;
+    while (!_stop.load(std::memory_order_relaxed)) {
+        if (!pkt && !_recycled_packets->tryPop(pkt)) {
+            pkt.reset(::av_packet_alloc());
+        }
+
+        int err;
+        {
+            trace::TraceScope const read_trace("av_read_frame", "pipeline");
+            err = libav::av_read_frame(_media.get(), pkt.get());
+        }
+        if (err < 0) {
+            break;
+        }
+        if (pkt->stream_index != _stream_index) {
+            ::av_packet_unref(pkt.get());
+            continue;
+        }
+        if (!pushWait(*_packets, std::move(pkt), _stop)) {
+            return;
+        }
+    }
+
+    pushWait(*_packets, Packet(), _stop);
+}
+
+void DecodePipeline::_decodeLoop() {
+    trace::setThreadName("pipeline decode");
+
+    auto on_frame = [this](libav::AVFrame const & frame) {
+        Output item;
+        item.pts = (frame->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
+                           ? frame->best_effort_timestamp
+                           : frame->pts;
+        item.frame = frame;
+        pushWait(*_frames, std::move(item), _stop);
+    };
+
+    Packet pkt;
+    while (popWait(*_packets, pkt, _stop)) {
+        if (!pkt) {
+            libav::flush_decoder(_media, on_frame, _stream_index);
+            break;
+        }
+        {
+            trace::TraceScope const decode_trace("avcodec_send_packet", "pipeline");
+            libav::avcodec_send_packet(_media, pkt.get(), on_frame);
+        }
+        ::av_packet_unref(pkt.get());
+        _recycled_packets->tryPush(std::move(pkt));// Freed on the next pop if the recycle queue is full
+    }
+
+    Output end;
+    end.end_of_stream = true;
+    pushWait(*_frames, std::move(end), _stop);
+}
+
+void DecodePipeline::_convertLoop() {
+    trace::setThreadName("pipeline convert");
+
+    Output item;
+    while (popWait(*_frames, item, _stop)) {
+        bool const end = item.end_of_stream;
+        if (!end && item.pts >= _first_wanted_pts) {
+            trace::TraceScope const convert_trace("convert", "pipeline");
+            item.image.resize(_image_size);
+            _converter(item.frame.get(), item.image);
+        }
+        if (!pushWait(*_outputs, std::move(item), _stop) || end) {
+            break;
+        }
+    }
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,202 @@
+#include "decodermanager.h"
+
+#include "trace.h"
+
+#include <utility>
+
+namespace ffmpeg_wrapper {
+
+DecoderManager::DecoderManager()
+    : DecoderManager(DecoderManagerOptions{}) {
+}
+
+DecoderManager::DecoderManager(DecoderManagerOptions options)
+    : _options(options),
+      _pool(options.threads) {
+}
+
+DecoderManager::~DecoderManager() = default;
+
+std::vector<uint8_t> DecoderManager::getFrame(std::string const & path, int frame) {
+    trace::TraceScope const trace_scope("DecoderManager::getFrame", "manager", "frame", frame);
+
+    auto handle = _acquire(path);
+    if (!handle) {
+        return {};
+    }
+
+    std::vector<uint8_t> image;
+    size_t bytes;
+    {
+        std::lock_guard<std::mutex> lock(handle->mutex);
+        image = handle->decoder.getFrame(frame);
+        bytes = handle->decoder.estimateMemoryBytes();
+    }
+    _updateBytes(handle, bytes);
+    return image;
+}
+
+std::future<std::vector<uint8_t>> DecoderManager::getFrameAsync(std::string const & path, int frame) {
+    return _pool.submit([this, path, frame]() { return getFrame(path, frame); });
+}
+
+size_t DecoderManager::open(std::vector<std::string> const & paths) {
+    std::vector<std::future<bool>> pending;
+    pending.reserve(paths.size());
+    for (auto const & path: paths) {
+        pending.push_back(prefetch(path));
+    }
+    for (auto & p: pending) {
+        p.wait();
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t count = 0;
+    for (auto const & path: paths) {
+        count += _index.count(path);
+    }
+    return count;
+}
+
+std::future<bool> DecoderManager::prefetch(std::string const & path) {
+    // The open is claimed when the job starts rather than when it is queued, so a request that arrives
+    // first opens the file itself instead of waiting behind the queue
+    return _pool.submit([this, path]() { return _acquire(path) != nullptr; });
+}
+
+bool DecoderManager::getVideoSize(std::string const & path, int & width, int & height) {
+    auto handle = _acquire(path);
+    if (!handle) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(handle->mutex);
+    width = handle->decoder.getWidth();
+    height = handle->decoder.getHeight();
+    return true;
+}
+
+bool DecoderManager::isOpen(std::string const & path) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _index.count(path) > 0;
+}
+
+void DecoderManager::close(std::string const & path) {
+    HandlePtr closing;// Destroyed after the lock is released
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(path);
+    if (it == _index.end()) {
+        return;
+    }
+    closing = *it->second;
+    _total_bytes -= closing->bytes;
+    _lru.erase(it->second);
+    _index.erase(it);
+}
+
+void DecoderManager::clear() {
+    std::list<HandlePtr> closing;
+    std::lock_guard<std::mutex> lock(_mutex);
+    closing.swap(_lru);
+    _index.clear();
+    _total_bytes = 0;
+}
+
+size_t DecoderManager::openCount() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _lru.size();
+}
+
+size_t DecoderManager::memoryBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _total_bytes;
+}
+
+DecoderManagerStatistics DecoderManager::getStatistics() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+DecoderManager::HandlePtr DecoderManager::_acquire(std::string const & path) {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto open = _index.find(path);
+    if (open != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, open->second);
+        _stats.hits++;
+        return *open->second;
+    }
+
+    auto opening = _opening.find(path);
+    if (opening != _opening.end()) {
+        auto pending = opening->second;
+        _stats.hits++;
+        lock.unlock();
+        return pending.get();
+    }
+
+    _stats.misses++;
+    std::promise<HandlePtr> promise;
+    _opening.emplace(path, promise.get_future().share());
+    lock.unlock();
+
+    // The packet scan is the expensive part, so it runs without holding the lock
+    auto handle = _open(path);
+
+    std::vector<HandlePtr> evicted;// Destroyed after the lock is released
+    lock.lock();
+    _opening.erase(path);
+    if (handle) {
+        _stats.opens++;
+        _lru.push_front(handle);
+        _index.emplace(path, _lru.begin());
+        _total_bytes += handle->bytes;
+        _evictLocked(evicted);
+    } else {
+        _stats.failures++;
+    }
+    lock.unlock();
+
+    promise.set_value(handle);
+    return handle;
+}
+
+DecoderManager::HandlePtr DecoderManager::_open(std::string const & path) const {
+    trace::TraceScope const trace_scope("DecoderManager::_open", "manager");
+
+    auto handle = std::make_shared<Handle>();
+    handle->path = path;
+    handle->decoder.setFormat(_options.format);
+    handle->decoder.createMedia(path);
+    if (handle->decoder.getFrameCount() == 0) {
+        return nullptr;
+    }
+    handle->bytes = handle->decoder.estimateMemoryBytes();
+    return handle;
+}
+
+void DecoderManager::_updateBytes(HandlePtr const & handle, size_t bytes) {
+    std::vector<HandlePtr> evicted;
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(handle->path);
+    if (it == _index.end() || *it->second != handle) {
+        return;// Evicted or closed while decoding
+    }
+    _total_bytes = _total_bytes - handle->bytes + bytes;
+    handle->bytes = bytes;
+    _evictLocked(evicted);
+}
+
+void DecoderManager::_evictLocked(std::vector<HandlePtr> & evicted) {
+    // Never evict the most recently used decoder, which is the one that just served a request.
+    // Closing a file can be slow, so the caller releases the handles once it has dropped the lock.
+    while (_lru.size() > 1 &&
+           (_lru.size() > _options.max_open_decoders || _total_bytes > _options.max_memory_bytes)) {
+        evicted.push_back(std::move(_lru.back()));
+        _lru.pop_back();
+        _total_bytes -= evicted.back()->bytes;
+        _index.erase(evicted.back()->path);
+        _stats.evictions++;
+    }
+}
+
+}// namespace ffmpeg_wrapper
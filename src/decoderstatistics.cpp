@@ -0,0 +1,88 @@
+#include "decoderstatistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+namespace ffmpeg_wrapper {
+
+static int bucket_for_value(uint64_t value) {
+    int bucket = 0;
+    while (value != 0 && bucket < Histogram::kBucketCount - 1) {
+        value >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void Histogram::record(uint64_t value) {
+    _buckets[static_cast<size_t>(bucket_for_value(value))]++;
+    _count++;
+    _total += value;
+    _min = std::min(_min, value);
+    _max = std::max(_max, value);
+}
+
+void Histogram::reset() {
+    *this = Histogram();
+}
+
+double Histogram::mean() const {
+    if (_count == 0) return 0.0;
+    return static_cast<double>(_total) / static_cast<double>(_count);
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (_count == 0) return 0;
+
+    p = std::clamp(p, 0.0, 100.0);
+    auto const rank = static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(_count)));
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        seen += _buckets[static_cast<size_t>(i)];
+        if (seen >= rank && seen > 0) {
+            uint64_t const upper_edge = (i == 0) ? 0 : (uint64_t{1} << i) - 1;
+            return std::clamp(upper_edge, min(), _max);
+        }
+    }
+    return _max;
+}
+
+double DecoderStatistics::cacheHitRate() const {
+    uint64_t const lookups = cache_hits + cache_misses;
+    if (lookups == 0) return 0.0;
+    return static_cast<double>(cache_hits) / static_cast<double>(lookups);
+}
+
+static void print_latency(std::ostream & os, char const * name, Histogram const & h) {
+    constexpr double kNsPerUs = 1000.0;
+    os << "  " << name << ": n=" << h.count()
+       << " mean=" << h.mean() / kNsPerUs << "us"
+       << " p50=" << static_cast<double>(h.percentile(50)) / kNsPerUs << "us"
+       << " p99=" << static_cast<double>(h.percentile(99)) / kNsPerUs << "us"
+       << " max=" << static_cast<double>(h.max()) / kNsPerUs << "us" << std::endl;
+}
+
+void DecoderStatistics::print(std::ostream & os) const {
+    os << "Frame requests: " << frame_requests << std::endl;
+    os << "Cache hits: " << cache_hits << " misses: " << cache_misses
+       << " (hit rate " << cacheHitRate() * 100.0 << "%)" << std::endl;
+    os << "Frame cache backend hits: " << frame_cache_hits << std::endl;
+    os << "Output cache hits: " << output_cache_hits << std::endl;
+    os << "Seeks: " << seeks << std::endl;
+    os << "Packets read: " << packets_read << " sent to decoder: " << packets_sent << std::endl;
+    os << "Frames decoded: " << frames_decoded << " converted: " << frames_converted << std::endl;
+    os << "Pool allocations: frames=" << frame_allocations << " packets=" << packet_allocations << std::endl;
+    os << "Frames decoded per cache miss: mean=" << frames_decoded_per_request.mean()
+       << " max=" << frames_decoded_per_request.max() << std::endl;
+    os << "Latency:" << std::endl;
+    print_latency(os, "getFrame", get_frame_latency);
+    print_latency(os, "cache lookup", cache_lookup_latency);
+    print_latency(os, "seek", seek_latency);
+    print_latency(os, "demux", demux_latency);
+    print_latency(os, "decode", decode_latency);
+    print_latency(os, "conversion", conversion_latency);
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,60 @@
+#ifndef DECODEUTILS_H
+#define DECODEUTILS_H
+
+/*
+
+Helpers shared by the decoders in this library. Internal: not installed with the public headers.
+
+*/
+
+#include "libavinc/libavinc.hpp"
+
+#include "libavutil/frame.h"
+#include "libavutil/pixdesc.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdint.h>
+
+namespace ffmpeg_wrapper {
+
+// Limited (16..235) to full (0..255) range luma, (Y-16) * 255 / 219 with rounding
+inline std::array<uint8_t, 256> const kLimitedToFullRange = []() {
+    std::array<uint8_t, 256> lut{};
+    for (int v = 0; v < 256; ++v) {
+        int const scaled = (std::max(v - 16, 0) * 255 + 109) / 219;
+        lut[static_cast<size_t>(v)] = static_cast<uint8_t>(std::min(scaled, 255));
+    }
+    return lut;
+}();
+
+inline bool is_full_range(::AVFrame const * frame, AVPixFmtDescriptor const * desc) {
+    if (frame->color_range == AVCOL_RANGE_JPEG) return true;
+    if (frame->color_range == AVCOL_RANGE_MPEG) return false;
+    // Unspecified: RGB, gray and the deprecated YUVJ formats are full range, other YUV is limited
+    bool const is_gray = !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components <= 2;
+    bool const is_yuvj = std::strncmp(desc->name, "yuvj", 4) == 0;
+    return (desc->flags & AV_PIX_FMT_FLAG_RGB) || is_gray || is_yuvj;
+}
+
+/*
+Read every packet of media and call on_packet(::AVPacket const &) for the ones that become frames of the
+index: packets of stream_index with a timestamp and data that are not flagged corrupt. Timestamps are in
+flicks, as libav::av_read_frame returns them.
+*/
+template<typename OnPacket>
+void scan_index_packets(libav::AVFormatContext & media, int stream_index, OnPacket && on_packet) {
+    auto pkt = media.packet_pool.acquire();
+    while (libav::av_read_frame(media.get(), pkt.get()) >= 0) {
+        if (pkt->stream_index == stream_index && pkt->pts != static_cast<int64_t>(AV_NOPTS_VALUE) && pkt->size > 0 &&
+            !(pkt->flags & AV_PKT_FLAG_CORRUPT)) {
+            on_packet(*pkt);
+        }
+        ::av_packet_unref(pkt.get());
+    }
+}
+
+}// namespace ffmpeg_wrapper
+
+#endif// DECODEUTILS_H
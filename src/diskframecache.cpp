@@ -0,0 +1,340 @@
+#include "diskframecache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FFMPEG_WRAPPER_HAS_MMAP 1
+#endif
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+constexpr uint64_t kMagic = 0x314b534452574646ull;// "FFWRDSK1"
+constexpr uint32_t kVersion = 1;
+constexpr char kExtension[] = ".frame";
+constexpr char kTempMarker[] = ".tmp-";
+// Temporary files older than this were left by a writer that died; younger ones may still be in use
+constexpr auto kStaleTempAge = std::chrono::minutes(10);
+
+struct FileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t file_id;
+    int32_t stream;
+    int32_t frame;
+    int32_t format;
+    uint32_t conversion_revision;// kFrameConversionRevision of the writer
+    uint64_t size;    // Image bytes following the header
+    uint64_t checksum;// Of the image bytes
+};
+
+// FNV-1a over 64 bit words, then over the remaining bytes. Catches torn and zero-filled pages, not tampering.
+constexpr uint64_t kFnvOffset = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+uint64_t checksum(uint8_t const * data, size_t size) {
+    uint64_t hash = kFnvOffset;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * kFnvPrime;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ data[i]) * kFnvPrime;
+    }
+    return hash;
+}
+
+std::string keyName(FrameCacheKey const & key) {
+    char name[80];
+    std::snprintf(name, sizeof(name), "%016llx-%d-%d-%d%s", static_cast<unsigned long long>(key.file_id),
+                  key.stream, key.frame, key.format, kExtension);
+    return name;
+}
+
+bool endsWith(std::string const & s, std::string const & suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+#ifdef FFMPEG_WRAPPER_HAS_MMAP
+bool writeAll(int fd, void const * data, size_t size) {
+    auto const * bytes = static_cast<uint8_t const *>(data);
+    while (size > 0) {
+        ssize_t const written = ::write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+#endif
+
+}// namespace
+
+DiskFrameCache::DiskFrameCache(DiskFrameCacheOptions options)
+    : _options(std::move(options)) {
+#ifdef FFMPEG_WRAPPER_HAS_MMAP
+    std::error_code ec;
+    if (!_options.directory.empty()) {
+        std::filesystem::create_directories(_options.directory, ec);
+    }
+    if (_options.directory.empty() || ec) {
+        std::cout << "Could not open disk frame cache " << _options.directory << std::endl;
+        return;
+    }
+    _open = true;
+    _scan();
+#endif
+}
+
+std::string DiskFrameCache::_path(std::string const & name) const {
+    return (std::filesystem::path(_options.directory) / name).string();
+}
+
+/*
+Rebuild the index from the directory. Modification times give the order in which files were last used,
+by this process or an earlier one.
+*/
+void DiskFrameCache::_scan() {
+    struct Found {
+        std::string name;
+        size_t bytes;
+        std::filesystem::file_time_type used;
+    };
+    std::vector<Found> found;
+    auto const now = std::filesystem::file_time_type::clock::now();
+
+    std::error_code ec;
+    for (auto const & item: std::filesystem::directory_iterator(_options.directory, ec)) {
+        if (!item.is_regular_file(ec)) continue;
+        auto const name = item.path().filename().string();
+        auto const used = item.last_write_time(ec);
+        if (ec) continue;
+        if (name.find(kTempMarker) != std::string::npos) {
+            if (now - used > kStaleTempAge) std::filesystem::remove(item.path(), ec);
+        } else if (endsWith(name, kExtension)) {
+            found.push_back(Found{name, static_cast<size_t>(item.file_size(ec)), used});
+        }
+    }
+    std::sort(found.begin(), found.end(), [](Found const & a, Found const & b) { return a.used > b.used; });
+
+    std::vector<std::string> evicted;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto & file: found) {
+            _lru.push_back(Entry{std::move(file.name), file.bytes});
+            _index.emplace(_lru.back().name, std::prev(_lru.end()));
+            _total_bytes += _lru.back().bytes;
+        }
+        _evict(evicted);
+    }
+    for (auto const & name: evicted) {
+        std::filesystem::remove(_path(name), ec);
+    }
+}
+
+bool DiskFrameCache::lookup(FrameCacheKey const & key, std::vector<uint8_t> & output) {
+#ifdef FFMPEG_WRAPPER_HAS_MMAP
+    if (!_open) {
+        return false;
+    }
+    auto const name = keyName(key);
+    auto const path = _path(name);
+
+    int const fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        _forget(name);
+        return false;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+        ::close(fd);
+        ::unlink(path.c_str());
+        _forget(name);
+        return false;
+    }
+    size_t const file_bytes = static_cast<size_t>(st.st_size);
+    void * map = ::mmap(nullptr, file_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+
+    FileHeader header{};
+    std::memcpy(&header, map, sizeof(header));
+    auto const * image = static_cast<uint8_t const *>(map) + sizeof(FileHeader);
+    bool const valid = header.magic == kMagic && header.version == kVersion &&
+                       header.header_bytes == sizeof(FileHeader) && header.file_id == key.file_id &&
+                       header.stream == key.stream && header.frame == key.frame && header.format == key.format &&
+                       header.size == file_bytes - sizeof(FileHeader);
+    // A frame converted by a build with different conversion output is a miss but not damaged: another process
+    // sharing the directory may still use it, and storing the frame again replaces it
+    bool const current = header.conversion_revision == kFrameConversionRevision;
+    bool const intact = valid && (!current || !_options.verify_checksums ||
+                                  checksum(image, header.size) == header.checksum);
+    bool const hit = intact && current;
+    if (hit) {
+        output.assign(image, image + header.size);
+        ::futimens(fd, nullptr);// Record the use for the next session's LRU order
+    }
+    ::munmap(map, file_bytes);
+    ::close(fd);
+
+    if (!intact) {
+        std::cout << "Discarding damaged disk cache file " << path << std::endl;
+        ::unlink(path.c_str());
+        _forget(name);
+        return false;
+    }
+    if (!hit) {
+        return false;
+    }
+    _touch(name, file_bytes);
+    return true;
+#else
+    (void) key;
+    (void) output;
+    return false;
+#endif
+}
+
+void DiskFrameCache::store(FrameCacheKey const & key, uint8_t const * data, size_t size) {
+#ifdef FFMPEG_WRAPPER_HAS_MMAP
+    size_t const file_bytes = sizeof(FileHeader) + size;
+    if (!_open || !data || size == 0 || file_bytes > _options.capacity_bytes) {
+        return;
+    }
+    auto const name = keyName(key);
+    auto const path = _path(name);
+
+    uint64_t counter = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        counter = _temp_counter++;
+    }
+    auto const temp_path = path + kTempMarker + std::to_string(::getpid()) + "-" + std::to_string(counter);
+
+    FileHeader header{};
+    header.magic = kMagic;
+    header.version = kVersion;
+    header.header_bytes = sizeof(FileHeader);
+    header.file_id = key.file_id;
+    header.stream = key.stream;
+    header.frame = key.frame;
+    header.format = key.format;
+    header.conversion_revision = kFrameConversionRevision;
+    header.size = size;
+    header.checksum = checksum(data, size);
+
+    int const fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return;
+    }
+    bool const written = writeAll(fd, &header, sizeof(header)) && writeAll(fd, data, size);
+    bool const closed = ::close(fd) == 0;
+    // The rename is atomic, so readers see either no file or a complete one
+    if (!written || !closed || ::rename(temp_path.c_str(), path.c_str()) != 0) {
+        ::unlink(temp_path.c_str());
+        return;
+    }
+    _touch(name, file_bytes);
+#else
+    (void) key;
+    (void) data;
+    (void) size;
+#endif
+}
+
+void DiskFrameCache::clear() {
+    if (!_open) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _lru.clear();
+        _index.clear();
+        _total_bytes = 0;
+    }
+    std::error_code ec;
+    std::vector<std::filesystem::path> files;
+    for (auto const & item: std::filesystem::directory_iterator(_options.directory, ec)) {
+        if (endsWith(item.path().filename().string(), kExtension)) files.push_back(item.path());
+    }
+    for (auto const & file: files) {
+        std::filesystem::remove(file, ec);
+    }
+}
+
+size_t DiskFrameCache::fileCount() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _lru.size();
+}
+
+size_t DiskFrameCache::diskBytes() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _total_bytes;
+}
+
+void DiskFrameCache::_touch(std::string const & name, size_t bytes) {
+    std::vector<std::string> evicted;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(name);
+        if (it != _index.end()) {
+            _total_bytes -= it->second->bytes;
+            it->second->bytes = bytes;
+            _lru.splice(_lru.begin(), _lru, it->second);
+        } else {
+            // New, or written by another process since the scan
+            _lru.push_front(Entry{name, bytes});
+            _index.emplace(name, _lru.begin());
+        }
+        _total_bytes += bytes;
+        _evict(evicted);
+    }
+    std::error_code ec;
+    for (auto const & file: evicted) {
+        std::filesystem::remove(_path(file), ec);
+    }
+}
+
+void DiskFrameCache::_forget(std::string const & name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(name);
+    if (it == _index.end()) {
+        return;
+    }
+    _total_bytes -= it->second->bytes;
+    _lru.erase(it->second);
+    _index.erase(it);
+}
+
+void DiskFrameCache::_evict(std::vector<std::string> & evicted) {
+    // Deleting files is slow, so the caller removes them once it has dropped the lock
+    while (!_lru.empty() && _total_bytes > _options.capacity_bytes) {
+        _total_bytes -= _lru.back().bytes;
+        _index.erase(_lru.back().name);
+        evicted.push_back(std::move(_lru.back().name));
+        _lru.pop_back();
+    }
+}
+
+}// namespace ffmpeg_wrapper
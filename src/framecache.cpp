@@ -0,0 +1,47 @@
+#include "framecache.h"
+
+#include <filesystem>
+#include <system_error>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+// 64 bit FNV-1a
+constexpr uint64_t kFnvOffset = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+uint64_t fnv1a(void const * data, size_t size, uint64_t hash) {
+    auto const * bytes = static_cast<uint8_t const *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
+}// namespace
+
+uint64_t computeFileId(std::string const & path) {
+    std::error_code ec;
+    auto const canonical = std::filesystem::canonical(path, ec);
+    if (ec) {
+        return 0;
+    }
+    auto const size = static_cast<uint64_t>(std::filesystem::file_size(canonical, ec));
+    if (ec) {
+        return 0;
+    }
+    auto const mtime = static_cast<int64_t>(std::filesystem::last_write_time(canonical, ec).time_since_epoch().count());
+    if (ec) {
+        return 0;
+    }
+
+    auto const name = canonical.string();
+    uint64_t hash = fnv1a(name.data(), name.size(), kFnvOffset);
+    hash = fnv1a(&size, sizeof(size), hash);
+    hash = fnv1a(&mtime, sizeof(mtime), hash);
+    return hash != 0 ? hash : 1;// 0 is reserved for "no file"
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,236 @@
+#include "frameserverclient.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace ffmpeg_wrapper {
+
+namespace frame_server {
+
+std::string defaultSocketPath() {
+    char const * runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+    std::string const dir = (runtime_dir && *runtime_dir) ? runtime_dir : "/tmp";
+    return dir + "/ffmpeg_wrapper_frames.sock";
+}
+
+}// namespace frame_server
+
+FrameBatch::~FrameBatch() {
+    _reset();
+}
+
+FrameBatch::FrameBatch(FrameBatch && other) noexcept
+    : _status(other._status),
+      _width(other._width),
+      _height(other._height),
+      _format(other._format),
+      _entries(std::move(other._entries)),
+      _mapping(std::exchange(other._mapping, nullptr)),
+      _mapping_bytes(std::exchange(other._mapping_bytes, 0)) {
+}
+
+FrameBatch & FrameBatch::operator=(FrameBatch && other) noexcept {
+    if (this != &other) {
+        _reset();
+        _status = other._status;
+        _width = other._width;
+        _height = other._height;
+        _format = other._format;
+        _entries = std::move(other._entries);
+        _mapping = std::exchange(other._mapping, nullptr);
+        _mapping_bytes = std::exchange(other._mapping_bytes, 0);
+    }
+    return *this;
+}
+
+void FrameBatch::_reset() {
+#ifdef __linux__
+    if (_mapping) {
+        ::munmap(const_cast<uint8_t *>(_mapping), _mapping_bytes);
+    }
+#endif
+    _mapping = nullptr;
+    _mapping_bytes = 0;
+    _entries.clear();
+}
+
+FrameServerClient::~FrameServerClient() {
+    disconnect();
+}
+
+bool FrameServerClient::connect(std::string const & socket_path) {
+    disconnect();
+#ifdef __linux__
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cout << "Frame server socket path is too long: " << socket_path << std::endl;
+        return false;
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int const fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        std::cout << "Could not connect to frame server at " << socket_path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    _fd = fd;
+    return true;
+#else
+    (void) socket_path;
+    std::cout << "The frame server client is only available on Linux" << std::endl;
+    return false;
+#endif
+}
+
+void FrameServerClient::disconnect() {
+#ifdef __linux__
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+#endif
+    _fd = -1;
+}
+
+FrameBatch FrameServerClient::getFrames(std::string const & path, std::vector<int> const & frames, int priority) {
+    using namespace frame_server;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    FrameBatch batch;
+#ifdef __linux__
+    if (!_send(GetFrames, path, frames, priority)) {
+        return batch;
+    }
+
+    std::vector<uint8_t> message(sizeof(FrameReplyHeader) + kMaxBatchFrames * sizeof(FrameReplyEntry));
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    iovec iov{message.data(), message.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t const received = ::recvmsg(_fd, &msg, MSG_CMSG_CLOEXEC);
+
+    int memfd = -1;
+    for (cmsghdr * c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(&memfd, CMSG_DATA(c), sizeof(int));
+        }
+    }
+
+    FrameReplyHeader header;
+    if (received < static_cast<ssize_t>(sizeof(header))) {
+        std::cout << "Frame server closed the connection" << std::endl;
+        if (memfd >= 0) ::close(memfd);
+        disconnect();
+        return batch;
+    }
+    std::memcpy(&header, message.data(), sizeof(header));
+    size_t const entries_bytes = static_cast<size_t>(header.count) * sizeof(FrameReplyEntry);
+    if (header.magic != kMagic || static_cast<size_t>(received) < sizeof(header) + entries_bytes) {
+        std::cout << "Malformed reply from frame server" << std::endl;
+        if (memfd >= 0) ::close(memfd);
+        return batch;
+    }
+
+    batch._status = header.status;
+    batch._width = header.width;
+    batch._height = header.height;
+    batch._format = header.format;
+    if (header.status != Ok) {
+        if (memfd >= 0) ::close(memfd);
+        return batch;
+    }
+
+    if (memfd < 0 || header.total_bytes == 0) {
+        if (memfd >= 0) ::close(memfd);
+        batch._status = header.count == 0 ? Ok : ServerError;
+        return batch;
+    }
+    void * mapping = ::mmap(nullptr, header.total_bytes, PROT_READ, MAP_SHARED, memfd, 0);
+    ::close(memfd);
+    if (mapping == MAP_FAILED) {
+        batch._status = ServerError;
+        return batch;
+    }
+    batch._mapping = static_cast<uint8_t const *>(mapping);
+    batch._mapping_bytes = header.total_bytes;
+
+    batch._entries.resize(header.count);
+    std::memcpy(batch._entries.data(), message.data() + sizeof(header), entries_bytes);
+    for (auto const & entry: batch._entries) {
+        if (entry.offset + entry.size > header.total_bytes) {
+            std::cout << "Frame server reply points outside its memfd" << std::endl;
+            batch._reset();
+            batch._status = ServerError;
+            break;
+        }
+    }
+#else
+    (void) path;
+    (void) frames;
+    (void) priority;
+#endif
+    return batch;
+}
+
+bool FrameServerClient::prefetch(std::string const & path, std::vector<int> const & frames, int priority) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _send(frame_server::Prefetch, path, frames, priority);
+}
+
+bool FrameServerClient::_send(uint16_t type, std::string const & path, std::vector<int> const & frames, int priority) {
+    using namespace frame_server;
+#ifdef __linux__
+    // Requests the server would reject fail here instead. Prefetch requests never get an answer, so a
+    // rejected prefetch could not be reported any other way.
+    if (_fd < 0 || path.empty() || path.size() > kMaxPathLength || frames.size() > kMaxBatchFrames) {
+        return false;
+    }
+
+    FrameRequestHeader header;
+    header.type = type;
+    header.priority = priority;
+    header.path_length = static_cast<uint32_t>(path.size());
+    header.count = static_cast<uint32_t>(frames.size());
+
+    std::vector<int32_t> const indices(frames.begin(), frames.end());
+    iovec iov[3] = {
+            {&header, sizeof(header)},
+            {const_cast<char *>(path.data()), path.size()},
+            {const_cast<int32_t *>(indices.data()), indices.size() * sizeof(int32_t)},
+    };
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    if (::sendmsg(_fd, &msg, MSG_NOSIGNAL) < 0) {
+        std::cout << "Could not send request to frame server" << std::endl;
+        disconnect();
+        return false;
+    }
+    return true;
+#else
+    (void) type;
+    (void) path;
+    (void) frames;
+    (void) priority;
+    return false;
+#endif
+}
+
+}// namespace ffmpeg_wrapper
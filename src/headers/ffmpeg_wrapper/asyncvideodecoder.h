@@ -0,0 +1,127 @@
+#ifndef ASYNCVIDEODECODER_H
+#define ASYNCVIDEODECODER_H
+
+#include "videodecoder.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct AsyncFrameResult {
+    int frame{0};
+    std::vector<uint8_t> data;// Empty if the request was cancelled
+    bool cancelled{false};
+};
+
+/*
+
+Non-blocking front end for a VideoDecoder, for event loops that cannot wait for a cold getFrame.
+
+Requests are served one at a time by a worker thread owned by this object. While the worker is busy,
+new requests wait in a short queue:
+
+- A request for a frame that is already queued or being decoded is coalesced with it, and every
+  caller receives the same image.
+- When the queue is full, the oldest queued request is cancelled to make room. With the default depth
+  of one, only the latest request survives while the user scrubs, and the decoder never spends time on
+  frames nobody will look at. The request being decoded is always completed.
+
+Cancelled requests complete with cancelled set and no data. Callbacks of decoded requests run on the
+worker thread. Callbacks of cancelled requests run on the thread that cancelled them: the one calling
+getFrameAsync (when the queue overflows), cancelPending, createMedia or the destructor. A callback must
+therefore not assume which thread it is on, and must not destroy the AsyncVideoDecoder.
+
+*/
+class DLLOPT AsyncVideoDecoder {
+public:
+    using Callback = std::function<void(AsyncFrameResult)>;
+
+    AsyncVideoDecoder();
+    explicit AsyncVideoDecoder(std::string const & filename);
+    ~AsyncVideoDecoder();
+
+    AsyncVideoDecoder(AsyncVideoDecoder const &) = delete;
+    AsyncVideoDecoder & operator=(AsyncVideoDecoder const &) = delete;
+
+    /**
+     *
+     * Load a file. Queued requests for the previous file are cancelled and the call waits for the
+     * request in progress, if any, to finish.
+     */
+    void createMedia(std::string const & filename);
+
+    std::future<AsyncFrameResult> getFrameAsync(int frame);
+    void getFrameAsync(int frame, Callback callback);
+
+    // Cancel every queued request. The request being decoded still completes.
+    void cancelPending();
+
+    /**
+     *
+     * @param max_pending Number of queued requests kept behind the one being decoded (at least 1)
+     */
+    void setMaxPending(size_t max_pending);
+
+    /**
+     *
+     * Run f with exclusive access to the underlying decoder, for configuration (setFormat, setVerbose, ...)
+     * or queries (getFrameCount, getStatistics, ...). Blocks while a frame is being decoded.
+     */
+    template<class F>
+    auto withDecoder(F && f) -> decltype(f(std::declval<VideoDecoder &>())) {
+        std::lock_guard<std::mutex> lock(_decoder_mutex);
+        return f(_decoder);
+    }
+
+    uint64_t requestsCoalesced() const;
+    uint64_t requestsCancelled() const;
+
+private:
+    struct Waiter {
+        std::shared_ptr<std::promise<AsyncFrameResult>> promise;
+        Callback callback;
+    };
+
+    struct Request {
+        int frame{0};
+        std::vector<Waiter> waiters;
+    };
+
+    VideoDecoder _decoder;
+    std::mutex _decoder_mutex;// Held while the decoder is in use
+
+    mutable std::mutex _mutex;// Protects everything below
+    std::condition_variable _cv;
+    std::deque<Request> _pending;
+    std::unique_ptr<Request> _current;// Request being decoded, if any
+    size_t _max_pending{1};
+    bool _stop{false};
+    uint64_t _coalesced{0};
+    uint64_t _cancelled{0};
+
+    std::thread _worker;
+
+    void _enqueue(int frame, Waiter waiter);
+    void _workerLoop();
+    static void _complete(std::vector<Waiter> & waiters, AsyncFrameResult result);
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// ASYNCVIDEODECODER_H
@@ -0,0 +1,131 @@
+#ifndef COMPRESSEDFRAMESTORE_H
+#define COMPRESSEDFRAMESTORE_H
+
+#include "libavinc/libavinc.hpp"
+
+#include "libavutil/frame.h"
+
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Decoded frames kept losslessly compressed, as a second tier behind FrameBuffer.
+
+Frames are stored in groups of up to kMaxGroupFrames. The first frame of a group is the reference. It is
+coded on its own: each byte is replaced by its difference from the same channel of the pixel to its left.
+Every other frame in the group is coded as its byte-wise difference from the reference. Either residual
+is then run-length coded, with runs of zeros collapsed and everything else copied. A frame can therefore
+be restored from its own data and the group's reference, never from a chain of frames.
+
+The residuals are mostly zeros wherever the picture does not change. The decoder reproduces skipped
+blocks of the reference exactly, so static regions of a video cost almost nothing, whatever the sensor
+noise of the original recording. A frame whose difference from the reference does not compress to less
+than half its size starts a new group. This catches scene changes and camera motion.
+
+Groups are evicted whole, least recently used first, to stay within the byte budget. Frames in hardware,
+palette, bitstream and float formats are not stored.
+
+Not thread safe, like the FrameBuffer that owns it.
+
+*/
+class DLLOPT CompressedFrameStore {
+public:
+    static constexpr size_t kMaxGroupFrames = 32;
+
+    CompressedFrameStore() = default;
+
+    /**
+     *
+     * @param capacity_bytes Budget for compressed data, 0 to disable the store and release everything in it
+     */
+    void setCapacity(size_t capacity_bytes);
+    size_t capacity() const { return _capacity; }
+    bool isEnabled() const { return _capacity > 0; }
+
+    // Compress and keep a decoded frame under frame_id. Frames already stored are left as they are.
+    void store(int frame_id, ::AVFrame const * frame);
+
+    bool contains(int frame_id) const { return _index.count(frame_id) > 0; }
+
+    /**
+     *
+     * Restore a stored frame into a newly allocated AVFrame, with the properties and side data of the original
+     *
+     * @return The frame, or an empty pointer if frame_id is not stored
+     */
+    libav::AVFrame retrieve(int frame_id);
+
+    void clear();
+
+    size_t size() const { return _index.size(); }
+    // Compressed data, frame properties, and the decompressed reference and scratch buffers
+    size_t memoryBytes() const;
+    // Size the stored frames would have uncompressed, to judge the compression ratio
+    size_t uncompressedBytes() const { return _uncompressed_bytes; }
+
+private:
+    struct Plane {
+        int row_bytes{0};
+        int rows{0};
+        int step{1};// Bytes between samples of the same channel, the distance of the left predictor
+    };
+    struct Layout {
+        int format{-1};
+        int width{0};
+        int height{0};
+        std::vector<Plane> planes;
+        size_t bytes{0};
+
+        bool matches(::AVFrame const * frame) const {
+            return format == frame->format && width == frame->width && height == frame->height;
+        }
+    };
+    struct Entry {
+        int frame_id{0};
+        std::vector<uint8_t> data;// Run-length coded residual
+        libav::AVFrame props;     // No pixel data, only what av_frame_copy_props copies
+        size_t props_bytes{0};
+    };
+    struct Group {
+        uint64_t id{0};
+        Layout layout;
+        std::vector<Entry> entries;// entries[0] is the reference
+        size_t bytes{0};
+    };
+    using GroupList = std::list<Group>;
+
+    size_t _capacity{0};
+    size_t _bytes{0};
+    size_t _uncompressed_bytes{0};
+    uint64_t _next_group_id{0};
+    GroupList _groups;// Most recently used first
+    std::unordered_map<int, GroupList::iterator> _index;
+    GroupList::iterator _open_group;// Group new frames are added to, valid while _has_open_group
+    bool _has_open_group{false};
+
+    // Decompressed reference of one group, so consecutive frames of a group decode their reference once
+    uint64_t _reference_group{UINT64_MAX};
+    std::vector<uint8_t> _reference;
+    std::vector<uint8_t> _raw;     // Tightly packed planes of the frame being stored or restored
+    std::vector<uint8_t> _residual;// Residual of the frame being stored
+
+    static bool _makeLayout(::AVFrame const * frame, Layout & layout);
+    bool _loadReference(Group const & group);
+    void _evict();
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// COMPRESSEDFRAMESTORE_H
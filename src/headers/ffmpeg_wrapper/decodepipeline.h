@@ -0,0 +1,124 @@
+#ifndef DECODEPIPELINE_H
+#define DECODEPIPELINE_H
+
+#include "spscqueue.h"
+#include "libavinc/libavinc.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Three stage decode pipeline for sequential reads:
+
+    demux thread --packets--> decode thread --frames--> convert thread --images--> next()
+
+Each stage runs on its own thread and hands work to the next one through a bounded SPSCQueue, so
+throughput approaches that of the slowest stage rather than the sum of all three. A full queue makes
+the upstream stage wait (backpressure), which bounds memory to the queue depths.
+
+The pipeline opens its own AVFormatContext, so it never touches the demuxer or decoder state used for
+random access by VideoDecoder. Timestamps are in flicks, like everywhere else in libavinc.
+
+*/
+class DLLOPT DecodePipeline {
+public:
+    struct Options {
+        size_t packet_queue_depth{64};
+        size_t frame_queue_depth{8};
+        size_t output_queue_depth{8};
+    };
+
+    struct Output {
+        int64_t pts{0};              // Best effort timestamp of the frame, in flicks
+        libav::AVFrame frame;        // Decoded frame
+        std::vector<uint8_t> image;  // Converted image; empty for frames before the first wanted timestamp
+        bool end_of_stream{false};
+    };
+
+    using Converter = std::function<void(::AVFrame *, std::vector<uint8_t> &)>;
+
+    /**
+     *
+     * @param filename Media file to open
+     * @param stream_index Video stream to decode; every other stream is discarded
+     * @param converter Called on the convert thread for every frame that needs an image. It must be safe to
+     * call concurrently with the thread that owns the pipeline.
+     * @param image_size Size in bytes of the converted image
+     */
+    DecodePipeline(std::string filename, int stream_index, Converter converter, size_t image_size,
+                   Options options);
+    DecodePipeline(std::string filename, int stream_index, Converter converter, size_t image_size);
+    ~DecodePipeline();
+
+    DecodePipeline(DecodePipeline const &) = delete;
+    DecodePipeline & operator=(DecodePipeline const &) = delete;
+
+    /**
+     *
+     * Open the file, seek and start the worker threads
+     *
+     * @param seek_pts Timestamp to seek to (backwards to the previous keyframe)
+     * @param first_wanted_pts Frames with an earlier timestamp are decoded but not converted
+     * @return false if the file or stream could not be opened
+     */
+    bool start(int64_t seek_pts, int64_t first_wanted_pts);
+
+    /**
+     *
+     * Wait for the next decoded frame in presentation order
+     *
+     * @return false once the end of the stream has been reached
+     */
+    bool next(Output & output);
+
+    // Stop and join the worker threads. Called by the destructor.
+    void stop();
+
+    bool finished() const { return _finished; }
+
+private:
+    using Packet = libav::AVPacketBase;
+
+    std::string _filename;
+    int _stream_index;
+    Converter _converter;
+    size_t _image_size;
+    Options _options;
+    int64_t _first_wanted_pts{0};
+
+    libav::AVFormatContext _media;
+
+    std::unique_ptr<SPSCQueue<Packet>> _packets;
+    std::unique_ptr<SPSCQueue<Packet>> _recycled_packets;// Emptied packets handed back to the demux thread
+    std::unique_ptr<SPSCQueue<Output>> _frames;
+    std::unique_ptr<SPSCQueue<Output>> _outputs;
+
+    std::atomic<bool> _stop{false};
+    bool _finished{false};
+
+    std::thread _demux_thread;
+    std::thread _decode_thread;
+    std::thread _convert_thread;
+
+    void _demuxLoop();
+    void _decodeLoop();
+    void _convertLoop();
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// DECODEPIPELINE_H
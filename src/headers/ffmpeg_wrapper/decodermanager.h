@@ -0,0 +1,128 @@
+#ifndef DECODERMANAGER_H
+#define DECODERMANAGER_H
+
+#include "threadpool.h"
+#include "videodecoder.h"
+
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct DecoderManagerOptions {
+    size_t max_open_decoders{64};                // Open files (and so file handles) kept at once
+    size_t max_memory_bytes{size_t{2} << 30};    // Budget for VideoDecoder::estimateMemoryBytes over all decoders
+    size_t threads{0};                           // Worker threads for opening and async requests, 0 for one per core
+    VideoDecoder::OutputFormat format{VideoDecoder::OutputFormat::Gray8};
+};
+
+struct DecoderManagerStatistics {
+    uint64_t hits{0};     // Requests served by an already open decoder
+    uint64_t misses{0};   // Requests that had to open the file
+    uint64_t opens{0};    // Successful opens
+    uint64_t failures{0}; // Files that could not be opened or had no frames
+    uint64_t evictions{0};// Decoders closed to stay within the limits
+};
+
+/*
+
+Serves frames from many video files while keeping a bounded set of them open.
+
+Open decoders are kept in least-recently-used order. Whenever the number of open decoders or their
+estimated memory goes over the limits, the least recently used ones are closed. The decoder that
+served the latest request is never evicted, so a single very large file can exceed the memory budget
+on its own. A decoder that is evicted while another thread is still using it stays alive until that
+request finishes.
+
+All methods are thread safe. Requests for different files decode in parallel, and requests for the
+same file are serialized on that file's decoder. Concurrent requests for a cold file share a single open.
+
+*/
+class DLLOPT DecoderManager {
+public:
+    DecoderManager();
+    explicit DecoderManager(DecoderManagerOptions options);
+    ~DecoderManager();
+
+    DecoderManager(DecoderManager const &) = delete;
+    DecoderManager & operator=(DecoderManager const &) = delete;
+
+    /**
+     *
+     * Decode a frame, opening the file first if needed
+     *
+     * @return The image in the configured output format, or an empty vector if the file could not be opened
+     */
+    std::vector<uint8_t> getFrame(std::string const & path, int frame);
+
+    // getFrame on the manager's thread pool
+    std::future<std::vector<uint8_t>> getFrameAsync(std::string const & path, int frame);
+
+    /**
+     *
+     * Open and index files in parallel on the thread pool and wait for them
+     *
+     * @return Number of files that are open afterwards
+     */
+    size_t open(std::vector<std::string> const & paths);
+
+    // Start opening a file in the background. The future is true if it opened successfully.
+    std::future<bool> prefetch(std::string const & path);
+
+    /**
+     *
+     * Image size of a file, opening it if needed
+     *
+     * @return false if the file could not be opened
+     */
+    bool getVideoSize(std::string const & path, int & width, int & height);
+
+    bool isOpen(std::string const & path) const;
+    void close(std::string const & path);
+    void clear();
+
+    size_t openCount() const;
+    size_t memoryBytes() const;
+    DecoderManagerStatistics getStatistics() const;
+
+private:
+    struct Handle {
+        std::string path;
+        std::mutex mutex;// Serializes use of decoder
+        VideoDecoder decoder;
+        size_t bytes{0};// Last memory estimate, guarded by DecoderManager::_mutex
+    };
+    using HandlePtr = std::shared_ptr<Handle>;
+
+    DecoderManagerOptions _options;
+
+    mutable std::mutex _mutex;// Protects everything below
+    std::list<HandlePtr> _lru;// Most recently used first
+    std::unordered_map<std::string, std::list<HandlePtr>::iterator> _index;
+    std::unordered_map<std::string, std::shared_future<HandlePtr>> _opening;
+    size_t _total_bytes{0};
+    DecoderManagerStatistics _stats;
+
+    ThreadPool _pool;// Last, so queued jobs finish before the state they use is destroyed
+
+    HandlePtr _acquire(std::string const & path);
+    HandlePtr _open(std::string const & path) const;
+    void _updateBytes(HandlePtr const & handle, size_t bytes);
+    void _evictLocked(std::vector<HandlePtr> & evicted);
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// DECODERMANAGER_H
@@ -0,0 +1,123 @@
+#ifndef DECODERSTATISTICS_H
+#define DECODERSTATISTICS_H
+
+#include <array>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/**
+ *
+ * Histogram with power-of-two bucket boundaries.
+ *
+ * Bucket 0 counts zero values and bucket i counts values in [2^(i-1), 2^i).
+ * Latencies are recorded in nanoseconds, so the top bucket starts at roughly 4.5 minutes,
+ * which is far longer than anything a single decode call should take.
+ *
+ * Recording is a handful of integer operations so it can stay enabled on the hot path.
+ */
+class DLLOPT Histogram {
+public:
+    static constexpr int kBucketCount = 40;
+
+    void record(uint64_t value);
+    void reset();
+
+    uint64_t count() const { return _count; }
+    uint64_t total() const { return _total; }
+    uint64_t min() const { return _count > 0 ? _min : 0; }
+    uint64_t max() const { return _max; }
+    double mean() const;
+
+    /**
+     *
+     * Estimate a percentile from the bucket counts
+     *
+     * @param p percentile in the range [0, 100]
+     * @return upper edge of the bucket holding the p-th percentile, clamped to the largest recorded value
+     */
+    uint64_t percentile(double p) const;
+
+    std::array<uint64_t, kBucketCount> const & buckets() const { return _buckets; }
+
+private:
+    std::array<uint64_t, kBucketCount> _buckets{};
+    uint64_t _count{0};
+    uint64_t _total{0};
+    uint64_t _min{UINT64_MAX};
+    uint64_t _max{0};
+};
+
+/**
+ *
+ * Counters and latency histograms collected by a VideoDecoder.
+ *
+ * All latencies are in nanoseconds. VideoDecoder hands out copies of this structure, so a
+ * snapshot can be inspected or printed while the decoder keeps running.
+ */
+struct DLLOPT DecoderStatistics {
+    uint64_t frame_requests{0};
+    uint64_t cache_hits{0};
+    uint64_t cache_misses{0};
+    uint64_t frame_cache_hits{0}; // Cache misses answered by the FrameCacheBackend without decoding
+    uint64_t output_cache_hits{0};// Requests answered with an already converted image, before the FrameBuffer lookup
+    uint64_t seeks{0};
+    uint64_t packets_read{0};
+    uint64_t packets_sent{0};
+    uint64_t frames_decoded{0};
+    uint64_t frames_converted{0};
+    uint64_t frame_allocations{0}; // AVFrames the frame pool had to allocate; flat once decoding reaches steady state
+    uint64_t packet_allocations{0};// AVPackets the packet pool had to allocate
+
+    Histogram get_frame_latency;   // Whole getFrame call
+    Histogram cache_lookup_latency;// FrameBuffer search and retrieval
+    Histogram seek_latency;        // Decoder flush, av_seek_frame and reading up to the first usable packet
+    Histogram demux_latency;       // Reading a single packet from the container
+    Histogram decode_latency;      // Sending one packet and receiving all frames it produced
+    Histogram conversion_latency;  // Conversion of a decoded frame to the output format
+
+    // Number of frames that had to be decoded to answer a request that missed the cache
+    Histogram frames_decoded_per_request;
+
+    double cacheHitRate() const;
+
+    void reset() { *this = DecoderStatistics(); }
+
+    void print(std::ostream & os) const;
+};
+
+/**
+ *
+ * Records the lifetime of the object into a histogram
+ *
+ */
+class ScopedLatency {
+public:
+    explicit ScopedLatency(Histogram & histogram)
+        : _histogram(histogram),
+          _start(std::chrono::steady_clock::now()) {}
+
+    ~ScopedLatency() {
+        auto const elapsed = std::chrono::steady_clock::now() - _start;
+        _histogram.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    ScopedLatency(ScopedLatency const &) = delete;
+    ScopedLatency & operator=(ScopedLatency const &) = delete;
+
+private:
+    Histogram & _histogram;
+    std::chrono::steady_clock::time_point _start;
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// DECODERSTATISTICS_H
@@ -0,0 +1,94 @@
+#ifndef DISKFRAMECACHE_H
+#define DISKFRAMECACHE_H
+
+#include "framecache.h"
+
+#include <list>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct DiskFrameCacheOptions {
+    std::string directory;                    // Created if it does not exist
+    size_t capacity_bytes{size_t{4} << 30};   // Total size of the frame files
+    bool verify_checksums{true};              // Check every frame read against its checksum
+};
+
+/*
+
+Frame cache in a directory on disk, so converted frames survive from one session to the next.
+
+Every frame is a file named after its FrameCacheKey. The key includes computeFileId, so frames of a
+video that has been rewritten are never served. A file holds a header with its key, the
+kFrameConversionRevision it was converted with, its size and checksum, followed by the image. Frames of
+another revision are misses, and are replaced when the frame is stored again. Lookups map the file and
+copy the image out, so a frame that is in the page cache costs page faults and a copy.
+
+The directory is the only metadata, so there is nothing to repair after a crash. Files are written under
+a temporary name and renamed into place, so a frame file is either complete or absent. A file that was
+renamed before its data reached the disk fails its checksum and is deleted on first use.
+
+Files are evicted least recently used first, to stay within capacity_bytes. Every hit touches the file's
+modification time, so the order carries over to the next session, which rebuilds it from a directory scan.
+Several processes can share a directory. Each keeps its own index and budget, and a file another
+process has evicted is simply a miss.
+
+Only available on POSIX systems. Elsewhere isOpen() is always false.
+
+*/
+class DLLOPT DiskFrameCache : public FrameCacheBackend {
+public:
+    explicit DiskFrameCache(DiskFrameCacheOptions options);
+    ~DiskFrameCache() override = default;
+
+    DiskFrameCache(DiskFrameCache const &) = delete;
+    DiskFrameCache & operator=(DiskFrameCache const &) = delete;
+
+    bool isOpen() const { return _open; }
+
+    bool lookup(FrameCacheKey const & key, std::vector<uint8_t> & output) override;
+    void store(FrameCacheKey const & key, uint8_t const * data, size_t size) override;
+
+    // Delete every frame file in the directory, including those written by other processes
+    void clear();
+
+    size_t fileCount() const;
+    size_t diskBytes() const;
+
+private:
+    struct Entry {
+        std::string name;
+        size_t bytes{0};
+    };
+    using EntryList = std::list<Entry>;
+
+    DiskFrameCacheOptions _options;
+    bool _open{false};
+
+    mutable std::mutex _mutex;// Protects the index; file I/O happens outside it
+    EntryList _lru;           // Most recently used first
+    std::unordered_map<std::string, EntryList::iterator> _index;
+    size_t _total_bytes{0};
+    uint64_t _temp_counter{0};
+
+    std::string _path(std::string const & name) const;
+    void _scan();
+    void _touch(std::string const & name, size_t bytes);
+    void _forget(std::string const & name);
+    void _evict(std::vector<std::string> & evicted);
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// DISKFRAMECACHE_H
@@ -0,0 +1,73 @@
+#ifndef FRAMECACHE_H
+#define FRAMECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/**
+ *
+ * Identifies one converted frame: which file, which of its video streams, which frame and in which output format
+ */
+struct FrameCacheKey {
+    uint64_t file_id{0};
+    int32_t stream{0};
+    int32_t frame{0};
+    int32_t format{0};
+
+    bool operator==(FrameCacheKey const & other) const {
+        return file_id == other.file_id && stream == other.stream && frame == other.frame && format == other.format;
+    }
+};
+
+/*
+Revision of the images VideoDecoder converts frames to. Backends that keep frames across sessions store it with
+every frame and treat frames of another revision as misses. Bump it whenever the output for any format changes,
+such as a change to range expansion or scaling.
+*/
+constexpr uint32_t kFrameConversionRevision = 1;
+
+/**
+ *
+ * Storage for converted frames that outlives a single VideoDecoder, such as a cache shared between processes.
+ *
+ * A VideoDecoder consults its backend when a frame is not in its own FrameBuffer, and stores every frame
+ * it has to decode. Implementations must be safe to call from several threads.
+ */
+class DLLOPT FrameCacheBackend {
+public:
+    virtual ~FrameCacheBackend() = default;
+
+    /**
+     *
+     * @param key Frame to look up
+     * @param output Receives the image if it is cached. Its size is set to the cached size.
+     * @return true if the frame was found
+     */
+    virtual bool lookup(FrameCacheKey const & key, std::vector<uint8_t> & output) = 0;
+
+    // Store a converted frame. Backends may silently drop frames they have no room for.
+    virtual void store(FrameCacheKey const & key, uint8_t const * data, size_t size) = 0;
+};
+
+/**
+ *
+ * Identify a file by its canonical path, size and modification time, so that every process opening the same
+ * file gets the same id and a file that is rewritten gets a new one.
+ *
+ * @return A 64 bit hash, or 0 if the file does not exist
+ */
+DLLOPT uint64_t computeFileId(std::string const & path);
+
+}// namespace ffmpeg_wrapper
+
+#endif// FRAMECACHE_H
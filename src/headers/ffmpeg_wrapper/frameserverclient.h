@@ -0,0 +1,162 @@
+#ifndef FRAMESERVERCLIENT_H
+#define FRAMESERVERCLIENT_H
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Wire format of the local frame server (ffmpeg_wrapper_frame_server).
+
+Messages travel over an AF_UNIX SOCK_SEQPACKET socket, so each message arrives whole.
+
+A request is a FrameRequestHeader, followed by path_length bytes of file path and then count int32 frame
+indices. Every frame of a request is decoded from the same file, and a request is one batch.
+
+The server answers a GetFrames request with a FrameReplyHeader, followed by count FrameReplyEntry records.
+The images travel in a sealed memfd attached to the message with SCM_RIGHTS. Each entry gives the offset
+of its image in that memfd. Prefetch requests get no reply, not even when they are malformed.
+
+Requests with a higher priority are served first. Requests with equal priority are served in arrival order.
+
+*/
+namespace frame_server {
+
+constexpr uint32_t kMagic = 0x46575346;// "FSWF"
+constexpr uint16_t kVersion = 1;
+constexpr uint32_t kMaxPathLength = 4096;
+constexpr uint32_t kMaxBatchFrames = 4096;
+
+enum RequestType : uint16_t {
+    GetFrames = 1,
+    Prefetch = 2,// Open the file and decode the frames into the server caches, without replying
+};
+
+enum Status : int32_t {
+    Ok = 0,
+    BadRequest = 1,
+    OpenFailed = 2,
+    ServerError = 3,
+};
+
+struct FrameRequestHeader {
+    uint32_t magic{kMagic};
+    uint16_t version{kVersion};
+    uint16_t type{GetFrames};
+    int32_t priority{0};
+    uint32_t path_length{0};
+    uint32_t count{0};
+};
+
+struct FrameReplyHeader {
+    uint32_t magic{kMagic};
+    int32_t status{Ok};
+    int32_t width{0};
+    int32_t height{0};
+    int32_t format{0};// VideoDecoder::OutputFormat
+    uint32_t count{0};
+    uint64_t total_bytes{0};// Size of the attached memfd
+};
+
+struct FrameReplyEntry {
+    int32_t frame{0};
+    uint32_t reserved{0};
+    uint64_t offset{0};
+    uint64_t size{0};
+};
+
+// Default socket path: $XDG_RUNTIME_DIR/ffmpeg_wrapper_frames.sock, or /tmp when it is not set
+DLLOPT std::string defaultSocketPath();
+
+}// namespace frame_server
+
+/**
+ *
+ * Images returned by the frame server for one request. They are read directly from the memfd the server
+ * sent, which stays mapped for the lifetime of this object.
+ */
+class DLLOPT FrameBatch {
+public:
+    FrameBatch() = default;
+    ~FrameBatch();
+    FrameBatch(FrameBatch && other) noexcept;
+    FrameBatch & operator=(FrameBatch && other) noexcept;
+    FrameBatch(FrameBatch const &) = delete;
+    FrameBatch & operator=(FrameBatch const &) = delete;
+
+    int status() const { return _status; }
+    bool ok() const { return _status == frame_server::Ok; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int format() const { return _format; }
+
+    size_t size() const { return _entries.size(); }
+    int frameIndex(size_t i) const { return _entries[i].frame; }
+    uint8_t const * data(size_t i) const { return _mapping + _entries[i].offset; }
+    size_t bytes(size_t i) const { return static_cast<size_t>(_entries[i].size); }
+    std::vector<uint8_t> copy(size_t i) const { return std::vector<uint8_t>(data(i), data(i) + bytes(i)); }
+
+private:
+    friend class FrameServerClient;
+    void _reset();
+
+    int _status{frame_server::ServerError};
+    int _width{0};
+    int _height{0};
+    int _format{0};
+    std::vector<frame_server::FrameReplyEntry> _entries;
+    uint8_t const * _mapping{nullptr};
+    size_t _mapping_bytes{0};
+};
+
+/**
+ *
+ * Connection to a frame server. Requests on one client are sent one at a time; use several clients for
+ * concurrent requests. Only available on Linux, elsewhere connect() always fails.
+ */
+class DLLOPT FrameServerClient {
+public:
+    FrameServerClient() = default;
+    ~FrameServerClient();
+
+    FrameServerClient(FrameServerClient const &) = delete;
+    FrameServerClient & operator=(FrameServerClient const &) = delete;
+
+    bool connect(std::string const & socket_path = frame_server::defaultSocketPath());
+    void disconnect();
+    bool isConnected() const { return _fd >= 0; }
+
+    /**
+     *
+     * Decode a batch of frames from one file
+     *
+     * @param path Video file, as the server process sees it
+     * @param frames Frame indices. The reply keeps this order.
+     * @param priority Higher priorities are served before lower ones from other clients
+     */
+    FrameBatch getFrames(std::string const & path, std::vector<int> const & frames, int priority = 0);
+
+    // Ask the server to warm its caches. Returns as soon as the request is sent.
+    bool prefetch(std::string const & path, std::vector<int> const & frames, int priority = -1);
+
+private:
+    int _fd{-1};
+    std::mutex _mutex;
+
+    bool _send(uint16_t type, std::string const & path, std::vector<int> const & frames, int priority);
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// FRAMESERVERCLIENT_H
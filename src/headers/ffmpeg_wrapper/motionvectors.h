@@ -0,0 +1,69 @@
+#ifndef MOTIONVECTORS_H
+#define MOTIONVECTORS_H
+
+#include <stdint.h>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Motion vectors exported by the decoder (AV_CODEC_FLAG2_EXPORT_MVS). They are the encoder's block
+matches, chosen to minimise bits rather than to follow objects, so they are noisy on flat or
+repetitive texture and absent for intra-coded blocks. As a cheap motion-energy signal, or to seed
+a tracker, they come at no decoding cost beyond the frame itself.
+
+*/
+
+struct MotionVector {
+    int16_t x;    // Centre of the block in the current frame, in pixels
+    int16_t y;
+    float dx;     // Offset from the block to its match in the reference frame, in pixels.
+    float dy;     // Content moved by (-dx, -dy) between the reference and this frame.
+    uint8_t width;// Block size in pixels
+    uint8_t height;
+    int8_t source;// Negative for a past reference, positive for a future one (B frames)
+};
+
+struct MotionVectorField {
+    int frame{-1};
+    int width{0};// Frame size the vectors refer to
+    int height{0};
+    char picture_type{'?'};// 'I', 'P', 'B', ... as reported by the decoder
+    std::vector<MotionVector> vectors;
+};
+
+/*
+Magnitudes on a grid of cell_size x cell_size pixel cells, row major. Each cell holds the mean motion
+over its area, weighting vectors by how much of the cell their block covers. Pixels covered by no
+vector (intra blocks, I frames) count as still; pixels covered by two (bidirectional blocks) take the mean.
+*/
+struct MotionMagnitudeMap {
+    int cell_size{0};
+    int columns{0};
+    int rows{0};
+    std::vector<float> magnitude;
+};
+
+/**
+ *
+ * @param cell_size Cell size in pixels. 16, the macroblock size, keeps one value per block for H.264.
+ * @return An empty map if the field has no size or cell_size is not positive
+ */
+DLLOPT MotionMagnitudeMap rasterizeMotionMagnitude(MotionVectorField const & field, int cell_size = 16);
+
+/**
+ *
+ * Mean motion magnitude over the whole frame, in pixels, with the same weighting as rasterizeMotionMagnitude
+ */
+DLLOPT float motionEnergy(MotionVectorField const & field);
+
+}// namespace ffmpeg_wrapper
+
+#endif// MOTIONVECTORS_H
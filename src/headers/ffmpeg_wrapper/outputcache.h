@@ -0,0 +1,93 @@
+#ifndef OUTPUTCACHE_H
+#define OUTPUTCACHE_H
+
+#include <list>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/**
+ *
+ * Identifies one converted image of the open file: the frame, the output format and the region converted
+ */
+struct OutputCacheKey {
+    int32_t frame{0};
+    int32_t format{0};
+    int32_t x{0};
+    int32_t y{0};
+    int32_t width{0};
+    int32_t height{0};
+
+    bool operator==(OutputCacheKey const & other) const {
+        return frame == other.frame && format == other.format && x == other.x && y == other.y &&
+               width == other.width && height == other.height;
+    }
+};
+
+/*
+
+Converted images kept in least-recently-used order within a byte budget.
+
+FrameBuffer holds decoded frames, so a hit there still pays for the conversion to the output format.
+This cache sits in front of it and holds the converted result. Images are shared and immutable, so a
+hit can be handed out without copying; the image stays alive for as long as the caller holds it, even
+after eviction.
+
+Not thread safe, like the VideoDecoder that owns it.
+
+*/
+class DLLOPT OutputCache {
+public:
+    using Image = std::shared_ptr<std::vector<uint8_t> const>;
+
+    OutputCache() = default;
+
+    /**
+     *
+     * @param capacity_bytes Budget for the cached images. 0 disables the cache and releases every image.
+     */
+    void setCapacity(size_t capacity_bytes);
+    size_t capacity() const { return _capacity; }
+    bool isEnabled() const { return _capacity > 0; }
+
+    // The image stored under key, or nullptr. A hit makes the image the most recently used.
+    Image lookup(OutputCacheKey const & key);
+
+    // Store an image, replacing any image under the same key. Images larger than the whole budget are not kept.
+    void store(OutputCacheKey const & key, Image image);
+
+    void clear();
+
+    size_t size() const { return _lru.size(); }
+    size_t memoryBytes() const { return _bytes; }
+
+private:
+    struct KeyHash {
+        size_t operator()(OutputCacheKey const & key) const;
+    };
+    struct Entry {
+        OutputCacheKey key;
+        Image image;
+    };
+
+    size_t _capacity{0};
+    size_t _bytes{0};
+    std::list<Entry> _lru;// Most recently used first
+    std::unordered_map<OutputCacheKey, std::list<Entry>::iterator, KeyHash> _index;
+
+    void _evict();
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// OUTPUTCACHE_H
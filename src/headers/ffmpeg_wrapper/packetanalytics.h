@@ -0,0 +1,74 @@
+#ifndef PACKETANALYTICS_H
+#define PACKETANALYTICS_H
+
+#include "videodecoder.h"
+
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Compressed-domain analytics.
+
+Everything here works from the packet sizes and flags VideoDecoder records while indexing the file,
+so nothing is decoded and hours of footage take milliseconds. The proxies rest on how encoders spend
+bits: an inter frame of a static scene is small, motion and new content make it larger, and encoders
+insert keyframes at scene cuts. Constant bitrate encodes flatten these differences, and the proxies with them.
+
+*/
+
+struct BitratePoint {
+    double time{0.0};   // Start of the window, in seconds from the first frame
+    double bitrate{0.0};// Bits per second
+};
+
+struct ActivitySegment {
+    int first_frame{0};
+    int last_frame{0};// Inclusive
+};
+
+/**
+ *
+ * @param window_seconds Width of each window
+ * @return Bitrate over consecutive windows covering the video
+ */
+DLLOPT std::vector<BitratePoint> bitrateCurve(VideoDecoder const & decoder, double window_seconds = 1.0);
+
+/**
+ *
+ * Motion and activity proxy for every frame: packet size relative to the median inter frame packet of the
+ * whole video. Keyframes, whose size says little about motion, take the mean of their neighbours.
+ *
+ * @return Activity per frame, around 1 for typical frames of the video
+ */
+DLLOPT std::vector<float> frameActivity(VideoDecoder const & decoder);
+
+/**
+ *
+ * Frames likely to start a new scene: keyframes the encoder placed before its regular keyframe interval,
+ * and inter frames whose packet is threshold times the median of the preceding inter frames.
+ *
+ * @return Frame indices in increasing order
+ */
+DLLOPT std::vector<int> sceneChangeCandidates(VideoDecoder const & decoder, float threshold = 3.0f);
+
+/**
+ *
+ * Runs of frames whose smoothed activity stays above threshold, for triaging long recordings.
+ *
+ * @param min_seconds Shorter runs are dropped
+ * @return Segments in increasing order
+ */
+DLLOPT std::vector<ActivitySegment> activeSegments(VideoDecoder const & decoder, float threshold = 1.5f,
+                                                   double min_seconds = 1.0);
+
+}// namespace ffmpeg_wrapper
+
+#endif// PACKETANALYTICS_H
@@ -0,0 +1,106 @@
+#ifndef SHAREDFRAMECACHE_H
+#define SHAREDFRAMECACHE_H
+
+#include "framecache.h"
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct SharedFrameCacheOptions {
+    std::string name{"/ffmpeg_wrapper_frames"};// POSIX shared memory object name
+    size_t capacity_bytes{size_t{1} << 30};    // Total frame storage, used only by the process that creates the cache
+    size_t slot_bytes{size_t{8} << 20};        // Largest frame that can be stored; every slot reserves this much
+    uint32_t ways{8};                          // Slots per set
+};
+
+/*
+
+Frame cache in POSIX shared memory, so that processes on the same host decode each frame once.
+
+The shared memory object holds a set-associative table of fixed-size slots. A frame hashes to one set and
+can live in any slot of that set. Every process that opens the same name maps the same table, whichever
+process created it.
+
+Lookups take no locks. A reader pins a slot by incrementing its reference count and then checks that
+the slot still holds the key it wants. A writer only replaces a slot with no readers. It marks the slot
+as being written first and then checks that no reader has pinned it in between. A pinned slot is never
+overwritten, so acquire() can hand out a pointer into shared memory instead of a copy.
+
+When a set is full, the least recently used unpinned slot is replaced. If a process dies while holding a
+Handle, that slot stays pinned until the shared memory object is removed.
+
+Only available on POSIX systems. Elsewhere isOpen() is always false.
+
+*/
+class DLLOPT SharedFrameCache : public FrameCacheBackend {
+public:
+    /**
+     *
+     * Read-only view of a cached frame. The frame cannot be evicted while the handle exists.
+     */
+    class DLLOPT Handle {
+    public:
+        Handle() = default;
+        ~Handle();
+        Handle(Handle && other) noexcept;
+        Handle & operator=(Handle && other) noexcept;
+        Handle(Handle const &) = delete;
+        Handle & operator=(Handle const &) = delete;
+
+        explicit operator bool() const { return _data != nullptr; }
+        uint8_t const * data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        friend class SharedFrameCache;
+        Handle(void * slot, uint8_t const * data, size_t size);
+        void _release();
+
+        void * _slot{nullptr};
+        uint8_t const * _data{nullptr};
+        size_t _size{0};
+    };
+
+    SharedFrameCache();
+    explicit SharedFrameCache(SharedFrameCacheOptions options);
+    ~SharedFrameCache() override;
+
+    SharedFrameCache(SharedFrameCache const &) = delete;
+    SharedFrameCache & operator=(SharedFrameCache const &) = delete;
+
+    bool isOpen() const { return _base != nullptr; }
+
+    // Zero-copy lookup. The returned handle is empty if the frame is not cached.
+    Handle acquire(FrameCacheKey const & key);
+
+    bool lookup(FrameCacheKey const & key, std::vector<uint8_t> & output) override;
+    void store(FrameCacheKey const & key, uint8_t const * data, size_t size) override;
+
+    size_t slotCount() const;
+    size_t slotBytes() const;
+
+    // Remove the shared memory object. Processes that have it mapped keep working on their mapping.
+    static void remove(std::string const & name);
+
+private:
+    SharedFrameCacheOptions _options;
+    void * _base{nullptr};
+    size_t _mapped_bytes{0};
+
+    bool _open();
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// SHAREDFRAMECACHE_H
@@ -0,0 +1,173 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Bounded single-producer single-consumer queue.
+
+One thread may push and one (other) thread may pop without taking a lock. The head and tail counters
+live on separate cache lines, and each side keeps a cached copy of the other side's counter, so in the
+common case a push or pop touches no cache line owned by the other thread.
+
+Capacity is rounded up to a power of two. T must be default constructible and move assignable;
+popped slots are left in their moved-from state.
+
+*/
+template<typename T>
+class SPSCQueue {
+public:
+    explicit SPSCQueue(size_t capacity)
+        : _capacity(_roundUpPow2(capacity)),
+          _mask(_capacity - 1),
+          _slots(_capacity) {}
+
+    SPSCQueue(SPSCQueue const &) = delete;
+    SPSCQueue & operator=(SPSCQueue const &) = delete;
+
+    /**
+     *
+     * Producer side. The value is only moved from if the push succeeds.
+     *
+     * @return false if the queue is full
+     */
+    bool tryPush(T && value) {
+        size_t const tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head_cache == _capacity) {
+            _head_cache = _head.load(std::memory_order_acquire);
+            if (tail - _head_cache == _capacity) {
+                return false;
+            }
+        }
+        _slots[tail & _mask] = std::move(value);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     *
+     * Consumer side
+     *
+     * @return false if the queue is empty
+     */
+    bool tryPop(T & value) {
+        size_t const head = _head.load(std::memory_order_relaxed);
+        if (head == _tail_cache) {
+            _tail_cache = _tail.load(std::memory_order_acquire);
+            if (head == _tail_cache) {
+                return false;
+            }
+        }
+        value = std::move(_slots[head & _mask]);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only exact when neither side is running
+    size_t sizeApprox() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return _capacity; }
+
+private:
+    static constexpr size_t kCacheLine = 64;
+
+    static size_t _roundUpPow2(size_t n) {
+        size_t v = 1;
+        while (v < n) v <<= 1;
+        return v;
+    }
+
+    size_t const _capacity;
+    size_t const _mask;
+    std::vector<T> _slots;
+
+    alignas(kCacheLine) std::atomic<size_t> _tail{0};// Written by the producer
+    size_t _head_cache{0};                           // Producer's view of _head
+
+    alignas(kCacheLine) std::atomic<size_t> _head{0};// Written by the consumer
+    size_t _tail_cache{0};                           // Consumer's view of _tail
+};
+
+/*
+Wait strategy for threads blocked on a full or empty queue: spin briefly, then yield, then sleep with
+growing intervals. A stage that stays blocked (for example because nobody is reading the output) ends
+up sleeping a couple of milliseconds at a time rather than burning a core.
+*/
+class Backoff {
+public:
+    void wait() {
+        constexpr int kSpins = 64;
+        constexpr int kYields = 256;
+        constexpr int kMaxSleepUs = 2000;
+
+        if (_count < kSpins) {
+            _count++;
+        } else if (_count < kYields) {
+            _count++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(_sleep_us));
+            _sleep_us = std::min(_sleep_us * 2, kMaxSleepUs);
+        }
+    }
+
+    void reset() {
+        _count = 0;
+        _sleep_us = 50;
+    }
+
+private:
+    int _count{0};
+    int _sleep_us{50};
+};
+
+/**
+ *
+ * Push with backpressure: wait until there is space or stop is set
+ *
+ * @return false if stop was set before the value could be pushed
+ */
+template<typename T>
+bool pushWait(SPSCQueue<T> & queue, T && value, std::atomic<bool> const & stop) {
+    Backoff backoff;
+    while (!queue.tryPush(std::move(value))) {
+        if (stop.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        backoff.wait();
+    }
+    return true;
+}
+
+/**
+ *
+ * Pop, waiting until a value is available or stop is set
+ *
+ * @return false if stop was set before a value arrived
+ */
+template<typename T>
+bool popWait(SPSCQueue<T> & queue, T & value, std::atomic<bool> const & stop) {
+    Backoff backoff;
+    while (!queue.tryPop(value)) {
+        if (stop.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        backoff.wait();
+    }
+    return true;
+}
+
+}// namespace ffmpeg_wrapper
+
+#endif// SPSCQUEUE_H
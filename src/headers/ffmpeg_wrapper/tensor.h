@@ -0,0 +1,68 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include <array>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+enum class TensorType {
+    Float32,
+    Float16,// IEEE 754 half precision, stored as uint16_t
+};
+
+enum class TensorLayout {
+    NCHW,
+    NHWC,
+};
+
+/**
+ *
+ * Layout and normalization of frames written as tensors.
+ *
+ * Samples are first scaled to [0, 1] (limited range video is expanded), then normalized per channel
+ * as (value - mean) / std, as torchvision's Normalize does.
+ */
+struct TensorOptions {
+    TensorType type{TensorType::Float32};
+    TensorLayout layout{TensorLayout::NCHW};
+    int channels{3};// 1 for luma, 3 for RGB
+    int width{0};   // Output size, 0 to keep the video size
+    int height{0};
+    std::array<float, 3> mean{{0.0f, 0.0f, 0.0f}};
+    std::array<float, 3> std{{1.0f, 1.0f, 1.0f}};
+};
+
+DLLOPT size_t tensorElementBytes(TensorType type);
+
+DLLOPT uint16_t floatToHalf(float value);
+DLLOPT float halfToFloat(uint16_t value);
+
+/**
+ *
+ * Write one channel of one frame into a tensor: dst_channel(x, y) = clamp(src(x, y) * scale + bias, low, high).
+ *
+ * @param src First sample of the channel. Samples of consecutive pixels are src_step samples apart.
+ * @param src_stride Bytes between rows of src
+ * @param channel Channel of the tensor to write
+ * @param dst Start of the frame in the tensor, laid out as options describes
+ * @param low, high Range of the written values, such as the values of black and white for limited range samples
+ */
+DLLOPT void packTensorChannel(uint8_t const * src, ptrdiff_t src_stride, int src_step, int width, int height,
+                              float scale, float bias, int channel, TensorOptions const & options, void * dst,
+                              float low = -HUGE_VALF, float high = HUGE_VALF);
+DLLOPT void packTensorChannel(uint16_t const * src, ptrdiff_t src_stride, int src_step, int width, int height,
+                              float scale, float bias, int channel, TensorOptions const & options, void * dst,
+                              float low = -HUGE_VALF, float high = HUGE_VALF);
+
+}// namespace ffmpeg_wrapper
+
+#endif// TENSOR_H
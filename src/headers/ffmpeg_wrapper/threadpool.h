@@ -0,0 +1,66 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+/*
+
+Fixed-size pool of worker threads running submitted jobs in FIFO order.
+
+Jobs should not block waiting on other jobs submitted to the same pool, since with every worker
+blocked the jobs they wait for would never run. The destructor finishes the queued jobs before joining.
+
+*/
+class DLLOPT ThreadPool {
+public:
+    /**
+     *
+     * @param threads Number of worker threads, or 0 for one per hardware thread
+     */
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator=(ThreadPool const &) = delete;
+
+    template<class F>
+    auto submit(F && f) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        _enqueue([task]() { (*task)(); });
+        return future;
+    }
+
+    size_t size() const { return _workers.size(); }
+
+private:
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::function<void()>> _jobs;
+    bool _stop{false};
+
+    void _enqueue(std::function<void()> job);
+    void _workerLoop();
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// THREADPOOL_H
@@ -0,0 +1,112 @@
+#ifndef THUMBNAILDECODER_H
+#define THUMBNAILDECODER_H
+
+#include "videodecoder.h"
+
+#include "libavinc/libavinc.hpp"
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct ThumbnailOptions {
+    int scale{4};              // Output is 1/scale of the video size in each dimension: 1, 2, 4 or 8
+    bool keyframes_only{false};// Decode keyframes only; a request returns the keyframe at or before the frame
+    VideoDecoder::OutputFormat format{VideoDecoder::OutputFormat::Gray8};
+};
+
+struct Thumbnail {
+    int frame{-1};// Frame shown by image, -1 if decoding failed
+    std::vector<uint8_t> image;
+};
+
+/*
+
+Decodes frames at a reduced size, for scrubbing previews and contact sheets.
+
+Codecs with a low resolution mode (MJPEG, MPEG-4 part 2, ...) are opened with it and decode straight to
+1/2, 1/4 or 1/8 size. Whatever reduction the codec cannot do is made up with a box filter on the decoded
+frame, or an area-averaging swscale pass for formats without a directly readable luma plane.
+
+In keyframe-only mode non-keyframe packets are never sent to the decoder, so a request costs one seek
+and one intra decode regardless of the GOP length.
+
+*/
+class DLLOPT ThumbnailDecoder {
+public:
+    explicit ThumbnailDecoder(std::string const & filename, ThumbnailOptions options = ThumbnailOptions());
+    // Opens the same file again, copying the packet index instead of reading the file for it
+    ThumbnailDecoder(ThumbnailDecoder const & other);
+    ThumbnailDecoder & operator=(ThumbnailDecoder const &) = delete;
+
+    bool isOpen() const { return _stream_index >= 0; }
+    int getFrameCount() const { return static_cast<int>(_pts.size()); }
+    int getWidth() const { return _out_width; }
+    int getHeight() const { return _out_height; }
+    std::vector<int> getKeyFrames() const { return _key_frames; }
+
+    /**
+     *
+     * @return Reduction done by the codec's low resolution mode, 1 if it has none
+     */
+    int getCodecScale() const { return 1 << _lowres; }
+
+    /**
+     *
+     * @param frame Frame index, clamped to the valid range
+     * @return getWidth() x getHeight() image in the output format
+     */
+    Thumbnail getFrame(int frame);
+
+private:
+    struct SwsContextDeleter {
+        void operator()(::SwsContext * context) const;
+    };
+
+    libav::AVFormatContext _media;
+    std::string _filename;
+    ThumbnailOptions _options;
+    int _stream_index{-1};
+    int _lowres{0};
+    int _out_width{0};
+    int _out_height{0};
+
+    std::vector<int64_t> _pts;// Packet timestamps in flicks, in packet order
+    std::unordered_map<int64_t, int> _pts_index;
+    std::vector<int> _key_frames;
+    int _last_frame{-1};// Frame last returned, if the decoder can continue from it without seeking
+
+    std::unique_ptr<::SwsContext, SwsContextDeleter> _sws;
+
+    bool _open();
+    int _keyFrameAtOrBefore(int frame) const;
+    libav::AVFrame _decode(int frame);
+    void _convert(::AVFrame * frame, std::vector<uint8_t> & output);
+};
+
+/**
+ *
+ * Thumbnails of frames spread evenly over a file, decoded in parallel. Thumbnails are keyframes, the ones
+ * nearest before evenly spaced frames. Each worker opens the file itself and decodes a contiguous run of them.
+ *
+ * @param count Number of thumbnails, or 0 for one per keyframe. Short GOP-poor files may give fewer.
+ * @param options Scale and output format; keyframes_only is implied
+ * @param threads Worker threads, or 0 for one per hardware thread
+ * @return Thumbnails in frame order
+ */
+DLLOPT std::vector<Thumbnail> makeThumbnails(std::string const & filename, int count,
+                                             ThumbnailOptions options = ThumbnailOptions(), size_t threads = 0);
+
+}// namespace ffmpeg_wrapper
+
+#endif// THUMBNAILDECODER_H
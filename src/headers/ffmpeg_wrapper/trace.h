@@ -0,0 +1,115 @@
+#ifndef FFMPEG_WRAPPER_TRACE_H
+#define FFMPEG_WRAPPER_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+/*
+
+Scoped trace events for the decode and encode pipelines.
+
+Each thread writes complete events into its own fixed-size ring buffer, so recording never takes a lock
+(a mutex is only taken once per thread, when its buffer is registered). A thread's buffer is allocated
+when it records its first event, so threads that only run while tracing is disabled use no memory. When
+a thread exits, its buffer is kept for export; only the 16 most recent of those are kept, older ones
+are released. The buffers can be exported as Chrome trace JSON, which loads in chrome://tracing or
+https://ui.perfetto.dev.
+
+Tracing is off by default. While disabled, a TraceScope costs a single relaxed load and branch.
+
+Exporting or clearing while other threads are still recording is allowed, but an event being
+overwritten at that moment may come out torn. Export after the workload of interest for exact results.
+
+*/
+
+namespace ffmpeg_wrapper {
+namespace trace {
+
+namespace detail {
+extern DLLOPT std::atomic<bool> g_enabled;
+
+DLLOPT int64_t now_ns();
+DLLOPT void record(char const * name, char const * category, int64_t start_ns, int64_t end_ns,
+                   char const * arg_name, int64_t arg_value);
+}// namespace detail
+
+/**
+ *
+ * Start recording trace events
+ *
+ * @param events_per_thread ring buffer capacity for threads that record their first event after this call.
+ * When a ring buffer is full, the oldest events are overwritten.
+ */
+DLLOPT void enable(size_t events_per_thread = 1 << 16);
+DLLOPT void disable();
+inline bool isEnabled() { return detail::g_enabled.load(std::memory_order_relaxed); }
+
+/**
+ *
+ * Name the calling thread in exported traces. Allocates nothing; the name is attached to the thread's
+ * buffer once it records an event.
+ *
+ * @param name Stored by pointer, so it must outlive the trace (string literals are ideal)
+ */
+DLLOPT void setThreadName(char const * name);
+
+// Drop all recorded events, and release the buffers of threads that have exited
+DLLOPT void clear();
+
+// Memory held by the ring buffers of running threads and the kept buffers of exited ones
+DLLOPT size_t memoryBytes();
+
+DLLOPT void writeChromeTrace(std::ostream & os);
+DLLOPT bool saveChromeTrace(std::string const & path);
+
+/**
+ *
+ * Records a complete event covering the lifetime of the object
+ *
+ * name and category are stored by pointer, so they should be string literals.
+ */
+class TraceScope {
+public:
+    explicit TraceScope(char const * name, char const * category = "ffmpeg_wrapper")
+        : TraceScope(name, category, nullptr, 0) {}
+
+    TraceScope(char const * name, char const * category, char const * arg_name, int64_t arg_value)
+        : _name(name),
+          _category(category),
+          _arg_name(arg_name),
+          _arg_value(arg_value) {
+        if (isEnabled()) {
+            _start_ns = detail::now_ns();
+        }
+    }
+
+    ~TraceScope() {
+        if (_start_ns >= 0) {
+            detail::record(_name, _category, _start_ns, detail::now_ns(), _arg_name, _arg_value);
+        }
+    }
+
+    TraceScope(TraceScope const &) = delete;
+    TraceScope & operator=(TraceScope const &) = delete;
+
+private:
+    char const * _name;
+    char const * _category;
+    char const * _arg_name;
+    int64_t _arg_value;
+    int64_t _start_ns{-1};
+};
+
+}// namespace trace
+}// namespace ffmpeg_wrapper
+
+#endif// FFMPEG_WRAPPER_TRACE_H
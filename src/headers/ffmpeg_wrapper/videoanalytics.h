@@ -0,0 +1,74 @@
+#ifndef VIDEOANALYTICS_H
+#define VIDEOANALYTICS_H
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct AnalyticsOptions {
+    bool mean{true};        // Per-frame mean intensity
+    bool min_max{false};    // Per-frame minimum and maximum
+    bool histogram{false};  // Per-frame 256 bin histogram
+    bool projections{false};// Whole-video mean, maximum and standard deviation images
+    int first_frame{0};
+    int last_frame{-1};// Inclusive, -1 for the last frame of the video
+    size_t threads{0}; // Worker threads, 0 for one per hardware thread
+};
+
+/*
+Per-frame results, indexed by frame - VideoAnalytics::first_frame. Only the vectors selected in
+AnalyticsOptions are filled.
+*/
+struct FrameStatistics {
+    std::vector<float> mean;
+    std::vector<uint8_t> min;
+    std::vector<uint8_t> max;
+    std::vector<std::array<uint32_t, 256>> histogram;
+};
+
+/*
+Pixel-wise projections over every analyzed frame, width x height, row major.
+*/
+struct VideoProjections {
+    int width{0};
+    int height{0};
+    std::vector<float> mean;
+    std::vector<uint8_t> max;
+    std::vector<float> std;
+};
+
+struct VideoAnalytics {
+    int first_frame{0};
+    int frame_count{0};     // Frames in the requested range
+    int frames_analyzed{0}; // Frames that were decoded; others keep zero statistics
+    FrameStatistics frames;
+    VideoProjections projections;
+};
+
+/**
+ *
+ * Compute statistics of every frame in a range without returning the frames.
+ *
+ * Intensities are those of VideoDecoder's Gray8 output (luma, limited range expanded to 0..255). They are
+ * read straight off the decoded luma plane, one row at a time, so no frame-sized image is ever produced
+ * for gray and YUV sources. The range is split at keyframes into one contiguous run of GOPs per worker;
+ * each worker opens the file itself and keeps its own projection sums, which are merged at the end.
+ * Projection sums take 17 bytes per pixel per worker.
+ *
+ * @return false if the file could not be opened or the range is empty
+ */
+DLLOPT bool analyzeVideo(std::string const & filename, AnalyticsOptions const & options, VideoAnalytics & result);
+
+}// namespace ffmpeg_wrapper
+
+#endif// VIDEOANALYTICS_H
@@ -1,6 +1,13 @@
 #ifndef VIDEODECODER_H
 #define VIDEODECODER_H
 
+#include "compressedframestore.h"
+#include "decodepipeline.h"
+#include "decoderstatistics.h"
+#include "framecache.h"
+#include "motionvectors.h"
+#include "outputcache.h"
+#include "tensor.h"
 #include "libavinc/libavinc.hpp"
 
 #include "libavformat/avformat.h"
@@ -8,6 +15,7 @@
 
 #include <boost/circular_buffer.hpp>
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 #include <string>
@@ -32,8 +40,20 @@ public:
     FrameBuffer() = default;
     void buildFrameBuffer(int buf_size);
     void addFrametoBuffer(libav::AVFrame frame, int pos);
+    // True for frames in the buffer and, when enabled, in the compressed tier
     bool isFrameInBuffer(int frame);
     libav::AVFrame getFrameFromBuffer(int frame);
+    // Bytes of frame data referenced by the buffered frames, plus the compressed tier
+    size_t memoryBytes() const;
+
+    /**
+     *
+     * Keep frames pushed out of the buffer in a CompressedFrameStore, and restore them from it on request
+     *
+     * @param capacity_bytes Budget for the compressed frames, 0 (default) to disable
+     */
+    void setCompressedCapacity(size_t capacity_bytes) { _compressed.setCapacity(capacity_bytes); }
+    CompressedFrameStore const & compressedStore() const { return _compressed; }
 
     void setVerbose(bool verbose) {
         _verbose = verbose;
@@ -42,8 +62,11 @@ public:
 
 private:
     boost::circular_buffer<FrameBufferElement> _frame_buf;
+    CompressedFrameStore _compressed;
     bool _enable{true};
     bool _verbose{false};
+
+    bool _isInRing(int frame) const;
 };
 
 class DLLOPT VideoDecoder {
@@ -64,11 +87,191 @@ public:
     */
     std::vector<uint8_t> getFrame(int const desired_frame, bool isFrameByFrameMode = false);
 
+    /**
+     *
+     * Like getFrame, but returns the output cache's own copy of the image when the cache is enabled,
+     * so repeated requests for the same frame copy nothing
+     *
+     * @return The image, or nullptr if no media is loaded
+     */
+    std::shared_ptr<std::vector<uint8_t> const> getFrameShared(int desired_frame);
+
+    /**
+     *
+     * Keep converted images, keyed by frame, output format and region, so that requests for a frame that
+     * was already shown skip the conversion (and the FrameBuffer) entirely. Disabled by default.
+     *
+     * @param capacity_bytes Budget for the cached images, 0 to disable
+     */
+    void setOutputCacheBytes(size_t capacity_bytes);
+    size_t getOutputCacheBytes() const { return _output_cache.capacity(); }
+
+    /**
+     *
+     * Compress frames as they leave the frame buffer instead of dropping them, so that going back a few
+     * GOPs restores frames instead of decoding them again. See CompressedFrameStore for the format and
+     * where it pays off. Disabled by default.
+     *
+     * @param capacity_bytes Budget for the compressed frames, 0 to disable
+     */
+    void setCompressedCacheBytes(size_t capacity_bytes) { _frame_buf->setCompressedCapacity(capacity_bytes); }
+    size_t getCompressedCacheBytes() const { return _frame_buf->compressedStore().capacity(); }
+
+    /**
+     *
+     * Decode a frame but convert and copy only a rectangle of it. The frame buffer keeps whole frames,
+     * so later requests for other regions of the same frame are served without decoding.
+     *
+     * @param x Left edge of the region in pixels
+     * @param y Top edge of the region in pixels
+     * @param width Width of the region, clipped to the frame
+     * @param height Height of the region, clipped to the frame
+     * @return Image of the clipped region in the output format, or an empty vector if the region does not overlap the frame
+     */
+    std::vector<uint8_t> getFrameROI(int const desired_frame, int x, int y, int width, int height);
+
+    using FrameCallback = std::function<void(int frame, std::vector<uint8_t> const & image)>;
+
+    /**
+     *
+     * Decode every stride-th frame from first_frame to last_frame without fully decoding the frames in between.
+     *
+     * Packets of unwanted frames are sent with skip_frame = AVDISCARD_NONREF, so the decoder drops them unless
+     * later frames reference them; disposable ones are not sent at all. When the next wanted frame lies past a
+     * keyframe, decoding restarts at that keyframe, reading through the packets in between or seeking when the
+     * gap is longer than kIframeSeekThreshold. With a stride longer than the GOP this becomes a walk from keyframe
+     * to keyframe that decodes only the start of each GOP up to the wanted frame.
+     *
+     * Frames are converted like getFrame, including the region of interest, but not added to the frame buffer.
+     *
+     * @param on_frame Called with each frame index and image, in presentation order
+     * @return Number of frames delivered
+     */
+    int decodeSubsampled(int first_frame, int last_frame, int stride, FrameCallback const & on_frame);
+
+    /**
+     *
+     * Make getFrame return a region of interest instead of the whole frame, until clearROI is called.
+     * The region is clipped to the frame; getOutputWidth and getOutputHeight give the resulting image size.
+     *
+     * @return false if the region does not overlap the frame, in which case the previous setting is kept
+     */
+    bool setROI(int x, int y, int width, int height);
+    void clearROI() { _roi = Region(); }
+    bool hasROI() const { return _roi.width > 0; }
+    int getOutputWidth() const { return hasROI() ? _roi.width : _width; }
+    int getOutputHeight() const { return hasROI() ? _roi.height : _height; }
+
+    /**
+     *
+     * @return Bytes of one frame written by getFrameTensor with these options
+     */
+    size_t tensorFrameBytes(TensorOptions const & options) const;
+
+    /**
+     *
+     * Decode a frame and write it as a normalized float tensor, without going through the output format.
+     * Luma tensors at the video size are read straight from the decoded planes; RGB and resized tensors
+     * go through one cached swscale pass.
+     *
+     * @param dst At least tensorFrameBytes(options) bytes
+     * @return false if the frame could not be decoded or the options are invalid
+     */
+    bool getFrameTensor(int frame, TensorOptions const & options, void * dst);
+
+    /**
+     *
+     * Decode consecutive frames into a batch tensor, (N, C, H, W) or (N, H, W, C) as options.layout says
+     *
+     * @param dst At least count * tensorFrameBytes(options) bytes
+     * @return Number of frames written, fewer than count when the video ends first
+     */
+    int getTensorBatch(int first_frame, int count, TensorOptions const & options, void * dst);
+
+    /**
+     *
+     * Have the decoder export the motion vectors of every frame it decodes (AV_CODEC_FLAG2_EXPORT_MVS).
+     * Only codecs with block motion compensation support it, H.264 and MPEG-4 Part 2 among them.
+     * If media is already loaded, it is reopened so the decoder picks up the flag.
+     */
+    void setExportMotionVectors(bool enable);
+    bool isExportingMotionVectors() const { return _export_motion_vectors; }
+
+    /**
+     *
+     * Decode a frame, or take it from the frame buffer, and copy out its motion vectors
+     *
+     * @param field Filled with the vectors; empty for intra frames
+     * @return false if export is disabled or the frame could not be decoded
+     */
+    bool getMotionVectors(int frame, MotionVectorField & field);
+
     int getFrameCount() const { return _frame_count; }
     int getWidth() const { return _width; }
     int getHeight() const { return _height; }
     std::vector<int64_t> getKeyFrames() const { return _i_frames; }
 
+    /**
+     *
+     * Compressed size of every frame's packet, indexed by frame, recorded by the createMedia scan
+     */
+    std::vector<uint32_t> const & getPacketSizes() const { return _pkt_sizes; }
+
+    /**
+     *
+     * AV_PKT_FLAG_KEY, AV_PKT_FLAG_DISPOSABLE and the other AV_PKT_FLAG_* bits of every frame's packet, indexed by frame
+     */
+    std::vector<uint8_t> const & getPacketFlags() const { return _pkt_flags; }
+
+    /**
+     *
+     * Presentation time of a frame, measured from the first frame of the stream
+     *
+     * @param frame Frame index, clamped to the valid range
+     * @return Time in flicks, or zero if no media is loaded
+     */
+    libav::flicks getFrameTime(int frame) const;
+
+    /**
+     *
+     * Find the frame shown at a given time, measured from the first frame of the stream
+     *
+     * @param time Time in flicks
+     * @return The last frame whose presentation time is not after time, 0 for times before the first frame,
+     * or -1 if no media is loaded
+     */
+    int getFrameAtTime(libav::flicks time) const;
+
+    /**
+     *
+     * Select the video stream to decode. Every other stream in the file is discarded by the demuxer
+     * and has no decoder opened. If media is already loaded, it is reopened with the new stream.
+     *
+     * @param stream_index Container stream index, or -1 (default) for the best video stream
+     */
+    void setVideoStreamIndex(int stream_index);
+
+    /**
+     *
+     * @return The container index of the stream being decoded, or -1 if no video stream is open
+     */
+    int getVideoStreamIndex() const { return _video_stream_index; }
+
+    /**
+     *
+     * @return Container indices of all video streams in the loaded file
+     */
+    std::vector<int> getVideoStreams() const;
+
+    /**
+     *
+     * Approximate memory held by this decoder: buffered and cached frames, idle pooled frames plus the packet index.
+     * Codec and demuxer internals are not included.
+     *
+     * @return Size in bytes
+     */
+    size_t estimateMemoryBytes() const;
+
     /**
      *
      * Find the nearest keyframe to frame_id
@@ -84,19 +287,80 @@ public:
     }
 
 
+    /*
+    Gray16 and RGB48 keep the precision of 10, 12 and 16 bit sources. Samples are native-endian uint16
+    stored in the byte vector, scaled to the full 0..65535 range (limited range sources are expanded).
+    */
     enum OutputFormat {
         Gray8,
         ARGB,
+        Gray16,
+        RGB48,// R, G, B, 16 bits each
     };
 
     void setFormat(OutputFormat format) {
+        // Stop the pipeline first: its convert thread may still be writing images sized for the previous format
+        _pipeline.reset();
         _format = format;
     }
 
+    /**
+     *
+     * Convert a decoded frame from any source to the output format, exactly as getFrame converts the
+     * frames it decodes. Needs no media to be loaded.
+     *
+     * @param output Resized to the frame's width x height in the output format
+     */
+    void convertFrame(::AVFrame * frame, std::vector<uint8_t> & output) const;
+
+    /**
+     *
+     * Decode on background threads when frames are requested in order.
+     *
+     * In pipelined mode a demux, a decode and a conversion thread run ahead of the caller, so sequential
+     * reads cost roughly the slowest of the three stages instead of their sum. Requests that go backwards
+     * or jump past a keyframe restart the pipeline at the nearest keyframe. Cache hits are still served
+     * from the frame buffer on the calling thread.
+     *
+     * @param pipelined Enable or disable pipelined mode. Disabling stops the worker threads.
+     */
+    void setPipelined(bool pipelined);
+    bool isPipelined() const { return _pipelined; }
+
+    /**
+     *
+     * Counters and latency histograms accumulated since creation or the last reset
+     *
+     * @return A copy of the current statistics
+     */
+    DecoderStatistics getStatistics() const;
+    void resetStatistics();
+
+    /**
+     *
+     * Share converted frames with other decoders, possibly in other processes. Frames missing from the
+     * FrameBuffer are looked up in the backend before decoding, and every decoded frame is stored in it.
+     *
+     * @param cache Backend to use, or nullptr (default) to disable
+     */
+    void setFrameCache(std::shared_ptr<FrameCacheBackend> cache) { _frame_cache = std::move(cache); }
+
 private:
+    struct Region {
+        int x{0};
+        int y{0};
+        int width{0};
+        int height{0};
+    };
+
     libav::AVFormatContext _media;//This is a unique_ptr
     libav::AVPacket _pkt;         //This is a unique ptr
 
+    std::string _filename;
+    uint64_t _file_id{0};// computeFileId of _filename, for FrameCacheKey
+    int _requested_stream_index{-1};
+    int _video_stream_index{-1};
+
     int _frame_count{0};
     long long _last_decoded_frame{0};
     long long _last_key_frame{0};
@@ -106,8 +370,10 @@ private:
     int _fps_denom{0};
 
     OutputFormat _format{OutputFormat::Gray8};
+    Region _roi;// Empty unless setROI was called
 
     bool _verbose{false};
+    bool _export_motion_vectors{false};
 
     bool _last_packet_decoded{false};
 
@@ -116,22 +382,68 @@ private:
     std::unordered_map<uint64_t, int64_t> _pts_index;
     std::vector<int64_t> _i_frames;
     std::vector<uint64_t> _pkt_durations;
+    std::vector<uint32_t> _pkt_sizes;
+    std::vector<uint8_t> _pkt_flags;
 
     std::vector<uint64_t> _i_frame_pts;
 
     std::unique_ptr<FrameBuffer> _frame_buf;
-
-    void _convertFrameToOutputFormat(::AVFrame * frame, std::vector<uint8_t> & output) const;
+    OutputCache _output_cache;
+    std::shared_ptr<FrameCacheBackend> _frame_cache;
+
+    DecoderStatistics _stats;
+    // Pool allocation counts at the last statistics reset
+    size_t _frame_allocations_base{0};
+    size_t _packet_allocations_base{0};
+
+    Region _fullFrame() const { return Region{0, 0, _width, _height}; }
+    bool _isFullFrame(Region const & region) const;
+    bool _clipRegion(int x, int y, int width, int height, Region & region) const;
+    bool _outputRegion(Region & region) const;
+    std::vector<uint8_t> _getFrame(int desired_frame, Region const & region);
+
+    void _convertFrameToOutputFormat(::AVFrame * frame, Region const & region, std::vector<uint8_t> & output) const;
+    void _convertFrameToOutputFormat(::AVFrame * frame, Region const & region, OutputFormat format,
+                                     std::vector<uint8_t> & output) const;
+    void _convertFrameToOutputFormatTimed(::AVFrame * frame, Region const & region, std::vector<uint8_t> & output);
     int _getFormatBytes() const;
-    void _togray8(::AVFrame * frame, std::vector<uint8_t> & output) const;
-    void _torgb32(::AVFrame * frame, std::vector<uint8_t> & output) const;
+    // Conversions write width x height pixels, which must be the size of frame
+    void _togray8(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const;
+    void _torgb32(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const;
+    void _togray16(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const;
+    void _torgb48(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const;
 
     int64_t _findFrameByPts(uint64_t pts);
 
+    ::AVStream * _videoStream() const { return _media->streams[_video_stream_index]; }
+
     uint64_t _getDuration() const { return _media->duration; }   // This is in AV_TIME_BASE (1000000) fractional seconds
     uint64_t _getStartTime() const { return _media->start_time; }// This is in AV_TIME_BASE (1000000) fractional seconds
 
     void _seekToFrame(int const frame, bool keyframe = false);
+    void _nextPacket();
+    bool _getFramePipelined(int desired_frame, Region const & region, std::vector<uint8_t> & output);
+    libav::AVFrame _getDecodedFrame(int desired_frame);
+    libav::AVFrame _decodeFrame(int clamped_desired);
+
+    struct SwsContextDeleter {
+        void operator()(::SwsContext * context) const;
+    };
+    std::unique_ptr<::SwsContext, SwsContextDeleter> _tensor_sws;// Reused while the tensor geometry is unchanged
+    std::vector<uint8_t> _tensor_scratch;
+    bool _convertFrameToTensor(::AVFrame * frame, TensorOptions const & options, void * dst);
+    // Scale into _tensor_scratch. Returns nullptr if swscale has no conversion for the formats.
+    uint8_t const * _scaleForTensor(uint8_t const * const src_data[], int const src_linesize[], int src_width,
+                                    int src_height, ::AVPixelFormat src_format, ::AVPixelFormat dst_format,
+                                    int dst_width, int dst_height, int bytes_per_pixel);
+    FrameCacheKey _frameCacheKey(int frame) const;
+    OutputCacheKey _outputCacheKey(int frame, Region const & region) const;
+    void _storeOutput(OutputCacheKey const & key, std::vector<uint8_t> const & output);
+
+    bool _pipelined{false};
+    int64_t _pipeline_next_frame{-1};// Frame index the pipeline is expected to produce next
+    // Declared last so the worker threads, which call back into this object, stop first
+    std::unique_ptr<DecodePipeline> _pipeline;
 };
 
 template<typename T>
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <utility>
 #include <vector>
 
 #if defined _WIN32 || defined __CYGWIN__
@@ -30,6 +31,19 @@ public:
     void openFile();
     void closeFile();
     int writeFrameGray8(std::vector<uint8_t> & input_data);
+
+    /**
+     *
+     * Write a frame with an explicit timestamp
+     *
+     * The timestamp is only used for software encoding. Hardware encoding derives timestamps
+     * from the frame count.
+     *
+     * @param input_data width * height grayscale pixels
+     * @param pts Presentation timestamp in units of the encoder time base (1 / fps unless set with setTimeBase)
+     * @return 0 on success or a negative AVERROR code
+     */
+    int writeFrameGray8(std::vector<uint8_t> & input_data, int64_t pts);
     void writeFrameRGB0(std::vector<uint32_t> & input_data);
 
     int getWidth() const { return _width; }
@@ -37,11 +51,21 @@ public:
 
     void setSavePath(std::string full_path);
 
-    void enterDrainMode() {
-        _flush_state = true;
-        libav::encode_enter_drain_mode(_media, _codecCtx);
+    /*
+    Software encoding settings. These must be set before createContext.
+    Hardware encoding (the default) uses h264_nvenc and ignores them.
+    */
+    void setHardwareEncode(bool hardware_encode) { _hardware_encode = hardware_encode; }
+    void setEncoderName(std::string encoder_name) { _encoder_name = std::move(encoder_name); }
+    void setGopSize(int gop_size) { _gop_size = gop_size; }
+    void setMaxBFrames(int max_b_frames) { _max_b_frames = max_b_frames; }
+    void setTimeBase(int num, int den) { _time_base = {num, den}; }
+    void setEncoderOption(std::string const & key, std::string const & value) {
+        _encoder_options.emplace(key, value);
     }
 
+    void enterDrainMode();
+
     // The verbose state will give us lots of info as different steps are run.
     void setVerbose(bool verbose) {
         _verbose = verbose;
@@ -54,6 +78,7 @@ private:
     //libav::AVStream;
     libav::AVFrame _frame;     //This frame has the same format as the camera
     libav::AVFrame _frame_nv12;// This frame must be compatible with hardware encoding (nv12). frame will be scaled to frame_2.
+    libav::AVFrame _frame_encode;// Software encoding input in the pixel format of the codec
 
     int _frame_count{0};
     int _width{640};
@@ -63,6 +88,10 @@ private:
     bool _flush_state{false};
 
     std::string _encoder_name{"h264_nvenc"};
+    int _gop_size{12};
+    int _max_b_frames{0};
+    ::AVRational _time_base{0, 0};
+    libav::AVDictionary _encoder_options;
     std::string _file_path{"./"};
     std::string _file_name{"test.mp4"};
 
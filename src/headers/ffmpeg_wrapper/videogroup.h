@@ -0,0 +1,116 @@
+#ifndef VIDEOGROUP_H
+#define VIDEOGROUP_H
+
+#include "threadpool.h"
+#include "videodecoder.h"
+
+#include "libavinc/libavinc.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined _WIN32 || defined __CYGWIN__
+#define DLLOPT __declspec(dllexport)
+#else
+#define DLLOPT __attribute__((visibility("default")))
+#endif
+
+namespace ffmpeg_wrapper {
+
+struct VideoGroupFrames {
+    libav::flicks time{0};                  // Group time that was requested
+    std::vector<int> frames;                // Frame index chosen in each video
+    std::vector<std::vector<uint8_t>> images;// Image from each video, in the order they were added
+};
+
+/*
+
+Synchronized access to several videos of the same scene, such as a multi-camera rig recorded to separate files.
+
+Each video is placed on a shared timeline with an offset: group time t shows the frame that video
+presents at t - offset, measured from its first frame. A request decodes the matching frame of every
+video in parallel on a thread pool and returns them together.
+
+Every video keeps a small cache of converted images. After a request, the next prefetch frames of each
+video are decoded in the background, so playing the group forward is served from the caches. A new
+request stops prefetching that has not started yet.
+
+All methods except addVideo and setFormat may be called from several threads at once.
+
+*/
+class DLLOPT VideoGroup {
+public:
+    /**
+     *
+     * @param threads Number of decoding threads, or 0 for one per hardware thread
+     */
+    explicit VideoGroup(size_t threads = 0);
+    ~VideoGroup();
+
+    VideoGroup(VideoGroup const &) = delete;
+    VideoGroup & operator=(VideoGroup const &) = delete;
+
+    /**
+     *
+     * Open a video and add it to the group
+     *
+     * @param filename Video file
+     * @param offset Group time at which the first frame of this video is shown
+     * @return Index of the video in the group, or -1 if it could not be opened
+     */
+    int addVideo(std::string const & filename, libav::flicks offset = libav::flicks(0));
+
+    size_t size() const { return _videos.size(); }
+
+    void setOffset(int video, libav::flicks offset);
+    libav::flicks getOffset(int video) const;
+
+    void setFormat(VideoDecoder::OutputFormat format);
+
+    /**
+     *
+     * @param frames Number of frames decoded ahead of each request in every video. 0 disables prefetching.
+     */
+    void setPrefetch(int frames);
+
+    // Frame each video shows at group time t. Times outside a video are clamped to its first or last frame.
+    std::vector<int> getFrameIndices(libav::flicks time) const;
+
+    VideoGroupFrames getFramesAtTime(libav::flicks time);
+
+    // Group time at which the last video ends
+    libav::flicks getDuration() const;
+
+    uint64_t cacheHits() const { return _cache_hits.load(); }
+    uint64_t cacheMisses() const { return _cache_misses.load(); }
+
+private:
+    struct Video {
+        std::mutex mutex;// Serializes use of decoder and cache
+        VideoDecoder decoder;
+        std::atomic<int64_t> offset{0};// flicks
+        std::map<int, std::vector<uint8_t>> cache;
+    };
+
+    std::vector<std::unique_ptr<Video>> _videos;
+    VideoDecoder::OutputFormat _format{VideoDecoder::OutputFormat::Gray8};
+    std::atomic<int> _prefetch_frames{0};
+    std::atomic<uint64_t> _generation{0};// Incremented by every request to stop stale prefetching
+    std::atomic<uint64_t> _cache_hits{0};
+    std::atomic<uint64_t> _cache_misses{0};
+
+    ThreadPool _pool;// Last, so queued jobs finish before the videos are destroyed
+
+    int _frameAtTime(Video const & video, libav::flicks time) const;
+    std::vector<uint8_t> _getFrame(Video & video, int frame, int prefetch);
+    void _prefetchVideo(Video & video, int frame, int prefetch, uint64_t generation);
+};
+
+}// namespace ffmpeg_wrapper
+
+#endif// VIDEOGROUP_H
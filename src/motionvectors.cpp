@@ -0,0 +1,85 @@
+#include "motionvectors.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+float magnitude(MotionVector const & mv) {
+    return std::sqrt(mv.dx * mv.dx + mv.dy * mv.dy);
+}
+
+}// namespace
+
+/*
+Each cell accumulates magnitude x overlap and the overlap itself. Dividing by the larger of the overlap
+and the cell area makes uncovered pixels count as zero, and averages where vectors cover a pixel twice.
+*/
+MotionMagnitudeMap rasterizeMotionMagnitude(MotionVectorField const & field, int cell_size) {
+    MotionMagnitudeMap map;
+    if (field.width <= 0 || field.height <= 0 || cell_size <= 0) {
+        return map;
+    }
+    map.cell_size = cell_size;
+    map.columns = (field.width + cell_size - 1) / cell_size;
+    map.rows = (field.height + cell_size - 1) / cell_size;
+    size_t const cells = static_cast<size_t>(map.columns) * static_cast<size_t>(map.rows);
+    map.magnitude.assign(cells, 0.0f);
+    std::vector<float> coverage(cells, 0.0f);
+
+    for (auto const & mv: field.vectors) {
+        int const left = std::max(mv.x - mv.width / 2, 0);
+        int const top = std::max(mv.y - mv.height / 2, 0);
+        int const right = std::min(mv.x - mv.width / 2 + mv.width, field.width);
+        int const bottom = std::min(mv.y - mv.height / 2 + mv.height, field.height);
+        if (left >= right || top >= bottom) continue;
+
+        float const m = magnitude(mv);
+        for (int row = top / cell_size; row <= (bottom - 1) / cell_size; ++row) {
+            int const y0 = std::max(top, row * cell_size);
+            int const y1 = std::min(bottom, (row + 1) * cell_size);
+            for (int column = left / cell_size; column <= (right - 1) / cell_size; ++column) {
+                int const x0 = std::max(left, column * cell_size);
+                int const x1 = std::min(right, (column + 1) * cell_size);
+                auto const overlap = static_cast<float>((x1 - x0) * (y1 - y0));
+                size_t const cell = static_cast<size_t>(row) * static_cast<size_t>(map.columns) + static_cast<size_t>(column);
+                map.magnitude[cell] += m * overlap;
+                coverage[cell] += overlap;
+            }
+        }
+    }
+
+    for (int row = 0; row < map.rows; ++row) {
+        int const cell_height = std::min(field.height - row * cell_size, cell_size);
+        for (int column = 0; column < map.columns; ++column) {
+            int const cell_width = std::min(field.width - column * cell_size, cell_size);
+            size_t const cell = static_cast<size_t>(row) * static_cast<size_t>(map.columns) + static_cast<size_t>(column);
+            float const area = std::max(coverage[cell], static_cast<float>(cell_width * cell_height));
+            map.magnitude[cell] /= area;
+        }
+    }
+    return map;
+}
+
+float motionEnergy(MotionVectorField const & field) {
+    // 4x4 is the smallest H.264 partition, so cells never straddle two blocks of an aligned field
+    constexpr int kCellSize = 4;
+    auto const map = rasterizeMotionMagnitude(field, kCellSize);
+    if (map.magnitude.empty()) {
+        return 0.0f;
+    }
+    double weighted = 0.0;
+    for (int row = 0; row < map.rows; ++row) {
+        int const cell_height = std::min(field.height - row * kCellSize, kCellSize);
+        for (int column = 0; column < map.columns; ++column) {
+            int const cell_width = std::min(field.width - column * kCellSize, kCellSize);
+            size_t const cell = static_cast<size_t>(row) * static_cast<size_t>(map.columns) + static_cast<size_t>(column);
+            weighted += static_cast<double>(map.magnitude[cell]) * cell_width * cell_height;
+        }
+    }
+    return static_cast<float>(weighted / (static_cast<double>(field.width) * static_cast<double>(field.height)));
+}
+
+}// namespace ffmpeg_wrapper
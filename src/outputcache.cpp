@@ -0,0 +1,60 @@
+#include "outputcache.h"
+
+#include <initializer_list>
+
+namespace ffmpeg_wrapper {
+
+size_t OutputCache::KeyHash::operator()(OutputCacheKey const & key) const {
+    // The frame varies most; the other fields rarely change while an image is being viewed
+    uint64_t hash = static_cast<uint32_t>(key.frame);
+    for (int32_t const field: {key.format, key.x, key.y, key.width, key.height}) {
+        hash = hash * 1099511628211ull + static_cast<uint32_t>(field);
+    }
+    return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+void OutputCache::setCapacity(size_t capacity_bytes) {
+    _capacity = capacity_bytes;
+    _evict();
+}
+
+OutputCache::Image OutputCache::lookup(OutputCacheKey const & key) {
+    auto it = _index.find(key);
+    if (it == _index.end()) {
+        return nullptr;
+    }
+    _lru.splice(_lru.begin(), _lru, it->second);
+    return it->second->image;
+}
+
+void OutputCache::store(OutputCacheKey const & key, Image image) {
+    if (!image || image->size() > _capacity) {
+        return;
+    }
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        _bytes -= it->second->image->size();
+        _lru.erase(it->second);
+        _index.erase(it);
+    }
+    _bytes += image->size();
+    _lru.push_front(Entry{key, std::move(image)});
+    _index.emplace(key, _lru.begin());
+    _evict();
+}
+
+void OutputCache::clear() {
+    _lru.clear();
+    _index.clear();
+    _bytes = 0;
+}
+
+void OutputCache::_evict() {
+    while (!_lru.empty() && _bytes > _capacity) {
+        _bytes -= _lru.back().image->size();
+        _index.erase(_lru.back().key);
+        _lru.pop_back();
+    }
+}
+
+}// namespace ffmpeg_wrapper
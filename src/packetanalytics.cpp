@@ -0,0 +1,177 @@
+#include "packetanalytics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+double seconds(libav::flicks time) {
+    return std::chrono::duration<double>(time).count();
+}
+
+// Average frames per second, from the span of the presentation times
+double frameRate(VideoDecoder const & decoder) {
+    constexpr double kDefaultFps = 30.0;
+    int const frames = decoder.getFrameCount();
+    double const span = frames > 1 ? seconds(decoder.getFrameTime(frames - 1)) : 0.0;
+    return span > 0.0 ? (frames - 1) / span : kDefaultFps;
+}
+
+bool isKey(std::vector<uint8_t> const & flags, size_t frame) {
+    return (flags[frame] & AV_PKT_FLAG_KEY) != 0;
+}
+
+float median(std::vector<uint32_t> values) {
+    if (values.empty()) {
+        return 0.0f;
+    }
+    auto const middle = values.begin() + static_cast<std::ptrdiff_t>(values.size() / 2);
+    std::nth_element(values.begin(), middle, values.end());
+    return static_cast<float>(*middle);
+}
+
+}// namespace
+
+std::vector<BitratePoint> bitrateCurve(VideoDecoder const & decoder, double window_seconds) {
+    auto const & sizes = decoder.getPacketSizes();
+    if (sizes.empty() || window_seconds <= 0.0) {
+        return {};
+    }
+
+    double const end = seconds(decoder.getFrameTime(static_cast<int>(sizes.size()) - 1));
+    size_t const windows = static_cast<size_t>(std::max(end, 0.0) / window_seconds) + 1;
+    std::vector<uint64_t> bits(windows, 0);
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        double const t = std::max(seconds(decoder.getFrameTime(static_cast<int>(i))), 0.0);
+        size_t const window = std::min(static_cast<size_t>(t / window_seconds), windows - 1);
+        bits[window] += static_cast<uint64_t>(sizes[i]) * 8;
+    }
+
+    std::vector<BitratePoint> curve(windows);
+    for (size_t w = 0; w < windows; ++w) {
+        curve[w].time = static_cast<double>(w) * window_seconds;
+        curve[w].bitrate = static_cast<double>(bits[w]) / window_seconds;
+    }
+    return curve;
+}
+
+std::vector<float> frameActivity(VideoDecoder const & decoder) {
+    auto const & sizes = decoder.getPacketSizes();
+    auto const & flags = decoder.getPacketFlags();
+
+    std::vector<uint32_t> inter_sizes;
+    inter_sizes.reserve(sizes.size());
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (!isKey(flags, i)) inter_sizes.push_back(sizes[i]);
+    }
+    float const baseline = median(std::move(inter_sizes));
+
+    std::vector<float> activity(sizes.size(), 0.0f);
+    if (baseline <= 0.0f) {
+        return activity;// Intra-only or empty
+    }
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (!isKey(flags, i)) activity[i] = static_cast<float>(sizes[i]) / baseline;
+    }
+
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (!isKey(flags, i)) continue;
+        float sum = 0.0f;
+        int count = 0;
+        if (i > 0 && !isKey(flags, i - 1)) {
+            sum += activity[i - 1];
+            count++;
+        }
+        if (i + 1 < sizes.size() && !isKey(flags, i + 1)) {
+            sum += activity[i + 1];
+            count++;
+        }
+        activity[i] = count > 0 ? sum / static_cast<float>(count) : 1.0f;
+    }
+    return activity;
+}
+
+std::vector<int> sceneChangeCandidates(VideoDecoder const & decoder, float threshold) {
+    auto const & sizes = decoder.getPacketSizes();
+    auto const & flags = decoder.getPacketFlags();
+    std::vector<int> candidates;
+
+    // Keyframes inserted before the regular interval. The regular interval is the most common one.
+    auto const keys = decoder.getKeyFrames();
+    std::map<int64_t, int> interval_counts;
+    for (size_t k = 1; k < keys.size(); ++k) {
+        interval_counts[keys[k] - keys[k - 1]]++;
+    }
+    int64_t regular_interval = 0;
+    int most = 0;
+    for (auto const & [interval, count]: interval_counts) {
+        if (count > most) {
+            most = count;
+            regular_interval = interval;
+        }
+    }
+    for (size_t k = 1; k < keys.size(); ++k) {
+        if (keys[k] - keys[k - 1] < regular_interval) {
+            candidates.push_back(static_cast<int>(keys[k]));
+        }
+    }
+
+    // Inter frame spikes, against the median of the preceding inter frames
+    int const history = std::max(static_cast<int>(frameRate(decoder) / 2.0), 4);
+    std::vector<uint32_t> recent;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (isKey(flags, i)) continue;
+        if (static_cast<int>(recent.size()) == history) {
+            float const local = median(recent);
+            if (local > 0.0f && static_cast<float>(sizes[i]) > threshold * local) {
+                candidates.push_back(static_cast<int>(i));
+            }
+            recent.erase(recent.begin());
+        }
+        recent.push_back(sizes[i]);
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    return candidates;
+}
+
+std::vector<ActivitySegment> activeSegments(VideoDecoder const & decoder, float threshold, double min_seconds) {
+    auto const activity = frameActivity(decoder);
+    double const fps = frameRate(decoder);
+    int const n = static_cast<int>(activity.size());
+
+    // Moving average over half a second, so single busy frames do not open a segment
+    int const half = std::max(static_cast<int>(fps / 4.0), 1);
+    std::vector<double> prefix(activity.size() + 1, 0.0);
+    for (int i = 0; i < n; ++i) {
+        prefix[static_cast<size_t>(i) + 1] = prefix[static_cast<size_t>(i)] + activity[static_cast<size_t>(i)];
+    }
+
+    int const min_frames = std::max(static_cast<int>(min_seconds * fps), 1);
+    std::vector<ActivitySegment> segments;
+    int start = -1;
+    for (int i = 0; i <= n; ++i) {
+        bool active = false;
+        if (i < n) {
+            int const lo = std::max(i - half, 0);
+            int const hi = std::min(i + half, n - 1);
+            double const mean = (prefix[static_cast<size_t>(hi) + 1] - prefix[static_cast<size_t>(lo)]) / (hi - lo + 1);
+            active = mean > threshold;
+        }
+        if (active && start < 0) {
+            start = i;
+        } else if (!active && start >= 0) {
+            if (i - start >= min_frames) {
+                segments.push_back(ActivitySegment{start, i - 1});
+            }
+            start = -1;
+        }
+    }
+    return segments;
+}
+
+}// namespace ffmpeg_wrapper
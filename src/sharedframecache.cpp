@@ -0,0 +1,354 @@
+#include "sharedframecache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FFMPEG_WRAPPER_HAS_SHM 1
+#endif
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+constexpr uint64_t kMagic = 0x314d524657524646ull;// "FFWRFRM1"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kDataAlignment = 4096;
+
+enum SlotState : uint32_t {
+    kEmpty = 0,
+    kWriting = 1,
+    kReady = 2,
+};
+
+// Everything in shared memory is either written once before the magic is published or atomic
+struct SharedHeader {
+    std::atomic<uint64_t> magic;
+    uint32_t version;
+    uint32_t ways;
+    uint64_t sets;
+    uint64_t slot_bytes;
+    std::atomic<uint64_t> clock;// Incremented by every hit, for least-recently-used replacement
+};
+
+struct SharedSlot {
+    std::atomic<uint32_t> state;
+    std::atomic<uint32_t> refs;// Handles pinning this slot, in any process
+    std::atomic<uint64_t> file_id;
+    std::atomic<uint64_t> frame_key;
+    std::atomic<uint64_t> size;
+    std::atomic<uint64_t> last_used;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory atomics must be lock free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared memory atomics must be lock free");
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+size_t slotsOffset() {
+    return alignUp(sizeof(SharedHeader), alignof(SharedSlot));
+}
+
+size_t dataOffset(size_t slot_count) {
+    return alignUp(slotsOffset() + slot_count * sizeof(SharedSlot), kDataAlignment);
+}
+
+uint64_t packFrame(FrameCacheKey const & key) {
+    return (static_cast<uint64_t>(static_cast<uint16_t>(key.stream)) << 48) |
+           (static_cast<uint64_t>(static_cast<uint16_t>(key.format)) << 32) |
+           static_cast<uint64_t>(static_cast<uint32_t>(key.frame));
+}
+
+// Finalizer of MurmurHash3, to spread consecutive frame numbers over the sets
+uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+SharedHeader * header(void * base) {
+    return static_cast<SharedHeader *>(base);
+}
+
+SharedSlot * slots(void * base) {
+    return reinterpret_cast<SharedSlot *>(static_cast<uint8_t *>(base) + slotsOffset());
+}
+
+}// namespace
+
+SharedFrameCache::Handle::Handle(void * slot, uint8_t const * data, size_t size)
+    : _slot(slot),
+      _data(data),
+      _size(size) {
+}
+
+SharedFrameCache::Handle::~Handle() {
+    _release();
+}
+
+SharedFrameCache::Handle::Handle(Handle && other) noexcept
+    : _slot(std::exchange(other._slot, nullptr)),
+      _data(std::exchange(other._data, nullptr)),
+      _size(std::exchange(other._size, 0)) {
+}
+
+SharedFrameCache::Handle & SharedFrameCache::Handle::operator=(Handle && other) noexcept {
+    if (this != &other) {
+        _release();
+        _slot = std::exchange(other._slot, nullptr);
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+    }
+    return *this;
+}
+
+void SharedFrameCache::Handle::_release() {
+    if (_slot) {
+        static_cast<SharedSlot *>(_slot)->refs.fetch_sub(1, std::memory_order_release);
+        _slot = nullptr;
+        _data = nullptr;
+        _size = 0;
+    }
+}
+
+SharedFrameCache::SharedFrameCache()
+    : SharedFrameCache(SharedFrameCacheOptions{}) {
+}
+
+SharedFrameCache::SharedFrameCache(SharedFrameCacheOptions options)
+    : _options(std::move(options)) {
+    if (!_open()) {
+        std::cout << "Could not open shared frame cache " << _options.name << std::endl;
+    }
+}
+
+SharedFrameCache::~SharedFrameCache() {
+#ifdef FFMPEG_WRAPPER_HAS_SHM
+    if (_base) {
+        ::munmap(_base, _mapped_bytes);
+    }
+#endif
+}
+
+size_t SharedFrameCache::slotCount() const {
+    if (!_base) return 0;
+    auto const * h = header(_base);
+    return static_cast<size_t>(h->sets) * h->ways;
+}
+
+size_t SharedFrameCache::slotBytes() const {
+    return _base ? static_cast<size_t>(header(_base)->slot_bytes) : 0;
+}
+
+SharedFrameCache::Handle SharedFrameCache::acquire(FrameCacheKey const & key) {
+    if (!_base) {
+        return {};
+    }
+    auto * h = header(_base);
+    auto * table = slots(_base);
+    auto * data = static_cast<uint8_t *>(_base) + dataOffset(slotCount());
+
+    uint64_t const frame_key = packFrame(key);
+    size_t const set = static_cast<size_t>(mix(key.file_id ^ mix(frame_key)) % h->sets);
+
+    for (size_t way = 0; way < h->ways; ++way) {
+        size_t const index = set * h->ways + way;
+        auto & slot = table[index];
+        if (slot.state.load(std::memory_order_acquire) != kReady ||
+            slot.file_id.load(std::memory_order_relaxed) != key.file_id ||
+            slot.frame_key.load(std::memory_order_relaxed) != frame_key) {
+            continue;
+        }
+
+        // Pin, then check that the slot was not claimed by a writer before the pin was visible
+        slot.refs.fetch_add(1, std::memory_order_seq_cst);
+        if (slot.state.load(std::memory_order_seq_cst) == kReady &&
+            slot.file_id.load(std::memory_order_relaxed) == key.file_id &&
+            slot.frame_key.load(std::memory_order_relaxed) == frame_key) {
+            slot.last_used.store(h->clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return Handle(&slot, data + index * h->slot_bytes, static_cast<size_t>(slot.size.load(std::memory_order_relaxed)));
+        }
+        slot.refs.fetch_sub(1, std::memory_order_release);
+    }
+    return {};
+}
+
+bool SharedFrameCache::lookup(FrameCacheKey const & key, std::vector<uint8_t> & output) {
+    auto handle = acquire(key);
+    if (!handle) {
+        return false;
+    }
+    output.assign(handle.data(), handle.data() + handle.size());
+    return true;
+}
+
+void SharedFrameCache::store(FrameCacheKey const & key, uint8_t const * data, size_t size) {
+    if (!_base || size > slotBytes()) {
+        return;
+    }
+    auto * h = header(_base);
+    auto * table = slots(_base);
+    auto * storage = static_cast<uint8_t *>(_base) + dataOffset(slotCount());
+
+    uint64_t const frame_key = packFrame(key);
+    size_t const set = static_cast<size_t>(mix(key.file_id ^ mix(frame_key)) % h->sets);
+    auto * first = table + set * h->ways;
+
+    for (size_t way = 0; way < h->ways; ++way) {
+        auto const & slot = first[way];
+        if (slot.state.load(std::memory_order_acquire) == kReady &&
+            slot.file_id.load(std::memory_order_relaxed) == key.file_id &&
+            slot.frame_key.load(std::memory_order_relaxed) == frame_key) {
+            return;// Another process got here first
+        }
+    }
+
+    // Try slots from most to least attractive: empty, then least recently used. Pinned or busy slots are skipped.
+    std::vector<bool> tried(h->ways, false);
+    for (size_t attempt = 0; attempt < h->ways; ++attempt) {
+        size_t victim = h->ways;
+        uint64_t oldest = UINT64_MAX;
+        for (size_t way = 0; way < h->ways; ++way) {
+            if (tried[way]) continue;
+            auto const & slot = first[way];
+            uint32_t const state = slot.state.load(std::memory_order_relaxed);
+            if (state == kEmpty) {
+                victim = way;
+                break;
+            }
+            if (state == kReady && slot.refs.load(std::memory_order_relaxed) == 0) {
+                uint64_t const used = slot.last_used.load(std::memory_order_relaxed);
+                if (used < oldest) {
+                    oldest = used;
+                    victim = way;
+                }
+            }
+        }
+        if (victim == h->ways) {
+            return;// Every slot of the set is pinned or being written
+        }
+        tried[victim] = true;
+
+        auto & slot = first[victim];
+        uint32_t expected = slot.state.load(std::memory_order_relaxed);
+        if (expected == kWriting ||
+            !slot.state.compare_exchange_strong(expected, kWriting, std::memory_order_seq_cst)) {
+            continue;
+        }
+        // A reader that pinned the slot before the claim was visible still owns it
+        if (slot.refs.load(std::memory_order_seq_cst) != 0) {
+            slot.state.store(expected, std::memory_order_release);
+            continue;
+        }
+
+        size_t const index = static_cast<size_t>(&slot - table);
+        std::memcpy(storage + index * h->slot_bytes, data, size);
+        slot.size.store(size, std::memory_order_relaxed);
+        slot.file_id.store(key.file_id, std::memory_order_relaxed);
+        slot.frame_key.store(frame_key, std::memory_order_relaxed);
+        slot.last_used.store(h->clock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        slot.state.store(kReady, std::memory_order_release);
+        return;
+    }
+}
+
+void SharedFrameCache::remove(std::string const & name) {
+#ifdef FFMPEG_WRAPPER_HAS_SHM
+    ::shm_unlink(name.c_str());
+#else
+    (void) name;
+#endif
+}
+
+bool SharedFrameCache::_open() {
+#ifdef FFMPEG_WRAPPER_HAS_SHM
+    uint32_t const ways = std::max<uint32_t>(_options.ways, 1);
+    size_t const slot_bytes = alignUp(std::max<size_t>(_options.slot_bytes, 1), kDataAlignment);
+    size_t const sets = std::max<size_t>(_options.capacity_bytes / slot_bytes / ways, 1);
+
+    int fd = ::shm_open(_options.name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool const creator = fd >= 0;
+    if (!creator) {
+        if (errno != EEXIST) {
+            return false;
+        }
+        fd = ::shm_open(_options.name.c_str(), O_RDWR, 0600);
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    size_t total = dataOffset(sets * ways) + sets * ways * slot_bytes;
+    if (creator) {
+        // ftruncate zero-fills, which leaves every slot empty
+        if (::ftruncate(fd, static_cast<off_t>(total)) != 0) {
+            ::close(fd);
+            ::shm_unlink(_options.name.c_str());
+            return false;
+        }
+    } else {
+        // The creator may still be sizing the object. Its geometry, not ours, decides the layout.
+        struct stat st {};
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (::fstat(fd, &st) == 0 && st.st_size == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (static_cast<size_t>(st.st_size) < sizeof(SharedHeader)) {
+            ::close(fd);
+            return false;
+        }
+        total = static_cast<size_t>(st.st_size);
+    }
+
+    void * base = ::mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    auto * h = header(base);
+    if (creator) {
+        h->version = kVersion;
+        h->ways = ways;
+        h->sets = sets;
+        h->slot_bytes = slot_bytes;
+        h->clock.store(0, std::memory_order_relaxed);
+        h->magic.store(kMagic, std::memory_order_release);
+    } else {
+        auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        while (h->magic.load(std::memory_order_acquire) != kMagic && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        size_t const slot_count = static_cast<size_t>(h->sets) * h->ways;
+        if (h->magic.load(std::memory_order_acquire) != kMagic || h->version != kVersion || slot_count == 0 ||
+            dataOffset(slot_count) + slot_count * h->slot_bytes > total) {
+            std::cout << "Shared frame cache " << _options.name << " has an incompatible layout" << std::endl;
+            ::munmap(base, total);
+            return false;
+        }
+    }
+
+    _base = base;
+    _mapped_bytes = total;
+    return true;
+#else
+    return false;
+#endif
+}
+
+}// namespace ffmpeg_wrapper
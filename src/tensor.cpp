@@ -0,0 +1,157 @@
+#include "tensor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+uint32_t floatBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Round to nearest even, after F. Giesen's float_to_half_fast3_rtne
+inline uint16_t toHalf(float value) {
+    constexpr uint32_t kFloatInfinity = 255u << 23;
+    constexpr uint32_t kHalfOverflow = (127u + 16u) << 23;
+    constexpr uint32_t kDenormMagic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+    uint32_t f = floatBits(value);
+    uint32_t const sign = f & 0x80000000u;
+    f ^= sign;
+
+    uint16_t half;
+    if (f >= kHalfOverflow) {
+        half = (f > kFloatInfinity) ? 0x7e00 : 0x7c00;// NaN stays NaN, everything else saturates to infinity
+    } else if (f < (113u << 23)) {
+        // Too small for a normal half: let the FPU round the subnormal
+        half = static_cast<uint16_t>(floatBits(bitsFloat(f) + bitsFloat(kDenormMagic)) - kDenormMagic);
+    } else {
+        uint32_t const mantissa_odd = (f >> 13) & 1u;
+        f -= 112u << 23;// Rebias the exponent from 127 to 15
+        f += 0xfffu + mantissa_odd;
+        half = static_cast<uint16_t>(f >> 13);
+    }
+    return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+template<typename Out>
+inline void store(Out * dst, float value);
+
+template<>
+inline void store<float>(float * dst, float value) {
+    *dst = value;
+}
+
+template<>
+inline void store<uint16_t>(uint16_t * dst, float value) {
+    *dst = toHalf(value);
+}
+
+/*
+SrcStep and DstStep are compile-time for the common cases (planes and RGB triplets), which lets the
+compiler vectorize the Float32 loops; 0 means use the runtime step.
+*/
+template<int SrcStep, int DstStep, typename Sample, typename Out>
+void packRows(Sample const * src, ptrdiff_t src_stride, int src_step, int width, int height, float scale, float bias,
+              float low, float high, Out * dst, size_t dst_row_stride, size_t dst_step) {
+    size_t const ss = SrcStep ? static_cast<size_t>(SrcStep) : static_cast<size_t>(src_step);
+    size_t const ds = DstStep ? static_cast<size_t>(DstStep) : dst_step;
+    for (int y = 0; y < height; ++y) {
+        auto const * __restrict srow =
+                reinterpret_cast<Sample const *>(reinterpret_cast<uint8_t const *>(src) + static_cast<ptrdiff_t>(y) * src_stride);
+        Out * __restrict drow = dst + static_cast<size_t>(y) * dst_row_stride;
+        for (int x = 0; x < width; ++x) {
+            float const value = static_cast<float>(srow[static_cast<size_t>(x) * ss]) * scale + bias;
+            store(drow + static_cast<size_t>(x) * ds, std::min(std::max(value, low), high));
+        }
+    }
+}
+
+template<typename Sample, typename Out>
+void packChannel(Sample const * src, ptrdiff_t src_stride, int src_step, int width, int height, float scale, float bias,
+                 float low, float high, int channel, TensorOptions const & options, Out * dst) {
+    size_t const w = static_cast<size_t>(width);
+    size_t const h = static_cast<size_t>(height);
+    size_t const channels = static_cast<size_t>(options.channels);
+
+    if (options.layout == TensorLayout::NCHW) {
+        Out * plane = dst + static_cast<size_t>(channel) * w * h;
+        if (src_step == 1) {
+            packRows<1, 1>(src, src_stride, src_step, width, height, scale, bias, low, high, plane, w, 1);
+        } else if (src_step == 3) {
+            packRows<3, 1>(src, src_stride, src_step, width, height, scale, bias, low, high, plane, w, 1);
+        } else {
+            packRows<0, 1>(src, src_stride, src_step, width, height, scale, bias, low, high, plane, w, 1);
+        }
+        return;
+    }
+
+    Out * first = dst + channel;
+    if (src_step == 3 && channels == 3) {
+        packRows<3, 3>(src, src_stride, src_step, width, height, scale, bias, low, high, first, w * 3, 3);
+    } else if (src_step == 1 && channels == 1) {
+        packRows<1, 1>(src, src_stride, src_step, width, height, scale, bias, low, high, first, w, 1);
+    } else {
+        packRows<0, 0>(src, src_stride, src_step, width, height, scale, bias, low, high, first, w * channels, channels);
+    }
+}
+
+template<typename Sample>
+void packTensorChannelImpl(Sample const * src, ptrdiff_t src_stride, int src_step, int width, int height, float scale,
+                           float bias, int channel, TensorOptions const & options, void * dst, float low, float high) {
+    if (options.type == TensorType::Float16) {
+        packChannel(src, src_stride, src_step, width, height, scale, bias, low, high, channel, options,
+                    static_cast<uint16_t *>(dst));
+    } else {
+        packChannel(src, src_stride, src_step, width, height, scale, bias, low, high, channel, options,
+                    static_cast<float *>(dst));
+    }
+}
+
+}// namespace
+
+size_t tensorElementBytes(TensorType type) {
+    return type == TensorType::Float16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+uint16_t floatToHalf(float value) {
+    return toHalf(value);
+}
+
+float halfToFloat(uint16_t value) {
+    uint32_t const sign = static_cast<uint32_t>(value & 0x8000u) << 16;
+    uint32_t const exponent = (value >> 10) & 0x1fu;
+    uint32_t const mantissa = value & 0x3ffu;
+
+    if (exponent == 0) {
+        float const magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -magnitude : magnitude;
+    }
+    if (exponent == 31) {
+        return bitsFloat(sign | 0x7f800000u | (mantissa << 13));
+    }
+    return bitsFloat(sign | ((exponent + 112u) << 23) | (mantissa << 13));
+}
+
+void packTensorChannel(uint8_t const * src, ptrdiff_t src_stride, int src_step, int width, int height, float scale,
+                       float bias, int channel, TensorOptions const & options, void * dst, float low, float high) {
+    packTensorChannelImpl(src, src_stride, src_step, width, height, scale, bias, channel, options, dst, low, high);
+}
+
+void packTensorChannel(uint16_t const * src, ptrdiff_t src_stride, int src_step, int width, int height, float scale,
+                       float bias, int channel, TensorOptions const & options, void * dst, float low, float high) {
+    packTensorChannelImpl(src, src_stride, src_step, width, height, scale, bias, channel, options, dst, low, high);
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,57 @@
+#include "threadpool.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace ffmpeg_wrapper {
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    _workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        _workers.emplace_back(&ThreadPool::_workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (auto & worker: _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::_enqueue(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(job));
+    }
+    _cv.notify_one();
+}
+
+void ThreadPool::_workerLoop() {
+    trace::setThreadName("thread pool");
+
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+            if (_jobs.empty()) {
+                return;// Stopping and nothing left to run
+            }
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+        job();
+    }
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,352 @@
+#include "thumbnaildecoder.h"
+
+#include "decodeutils.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include "libavutil/pixdesc.h"
+
+#include <algorithm>
+#include <array>
+#include <future>
+#include <iostream>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+int formatBytes(VideoDecoder::OutputFormat format) {
+    switch (format) {
+        case VideoDecoder::OutputFormat::ARGB:
+            return 4;
+        case VideoDecoder::OutputFormat::Gray16:
+            return 2;
+        case VideoDecoder::OutputFormat::RGB48:
+            return 6;
+        default:
+            return 1;
+    }
+}
+
+::AVPixelFormat swsFormat(VideoDecoder::OutputFormat format) {
+    switch (format) {
+        case VideoDecoder::OutputFormat::ARGB:
+            return AV_PIX_FMT_RGBA;
+        case VideoDecoder::OutputFormat::Gray16:
+            return AV_PIX_FMT_GRAY16;
+        case VideoDecoder::OutputFormat::RGB48:
+            return AV_PIX_FMT_RGB48;
+        default:
+            return AV_PIX_FMT_GRAY8;
+    }
+}
+
+/*
+Average R x R blocks of an 8 bit plane. R is a compile-time constant so the inner loops unroll and
+vectorize; R * R is a power of two so the division is a shift.
+*/
+template<int R>
+void boxDownscale(uint8_t const * src, int src_stride, uint8_t * dst, int width, int height,
+                  std::array<uint8_t, 256> const * range) {
+    constexpr int kShift = R == 8 ? 6 : R == 4 ? 4 : R == 2 ? 2 : 0;
+    constexpr int kRound = (1 << kShift) >> 1;
+
+    std::vector<uint16_t> sums(static_cast<size_t>(width));// At most 64 * 255
+    for (int y = 0; y < height; ++y) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int r = 0; r < R; ++r) {
+            uint8_t const * srow = src + (static_cast<ptrdiff_t>(y) * R + r) * src_stride;
+            for (int x = 0; x < width; ++x) {
+                uint16_t sum = 0;
+                for (int k = 0; k < R; ++k) {
+                    sum = static_cast<uint16_t>(sum + srow[x * R + k]);
+                }
+                sums[static_cast<size_t>(x)] = static_cast<uint16_t>(sums[static_cast<size_t>(x)] + sum);
+            }
+        }
+        uint8_t * drow = dst + static_cast<ptrdiff_t>(y) * width;
+        for (int x = 0; x < width; ++x) {
+            drow[x] = static_cast<uint8_t>((sums[static_cast<size_t>(x)] + kRound) >> kShift);
+        }
+        if (range) {
+            for (int x = 0; x < width; ++x) {
+                drow[x] = (*range)[drow[x]];
+            }
+        }
+    }
+}
+
+}// namespace
+
+void ThumbnailDecoder::SwsContextDeleter::operator()(::SwsContext * context) const {
+    ::sws_freeContext(context);
+}
+
+ThumbnailDecoder::ThumbnailDecoder(std::string const & filename, ThumbnailOptions options)
+    : _filename(filename),
+      _options(options) {
+    trace::TraceScope const trace_scope("ThumbnailDecoder::open", "thumbnail");
+
+    int log2_scale = 0;
+    while (log2_scale < 3 && (2 << log2_scale) <= _options.scale) {
+        log2_scale++;
+    }
+    if (_options.scale != (1 << log2_scale)) {
+        std::cout << "Thumbnail scale must be 1, 2, 4 or 8; using " << (1 << log2_scale) << std::endl;
+        _options.scale = 1 << log2_scale;
+    }
+    if (!_open()) {
+        return;
+    }
+
+    // Packet index; every other stream is already discarded by the demuxer
+    scan_index_packets(_media, _stream_index, [this](::AVPacket const & pkt) {
+        _pts_index[pkt.pts] = static_cast<int>(_pts.size());
+        if (pkt.flags & AV_PKT_FLAG_KEY) {
+            _key_frames.push_back(static_cast<int>(_pts.size()));
+        }
+        _pts.push_back(pkt.pts);
+    });
+    if (_key_frames.empty() && !_pts.empty()) {
+        _key_frames.push_back(0);
+    }
+}
+
+ThumbnailDecoder::ThumbnailDecoder(ThumbnailDecoder const & other)
+    : _filename(other._filename),
+      _options(other._options) {
+    trace::TraceScope const trace_scope("ThumbnailDecoder::open", "thumbnail");
+    if (_open()) {
+        _pts = other._pts;
+        _pts_index = other._pts_index;
+        _key_frames = other._key_frames;
+    }
+}
+
+bool ThumbnailDecoder::_open() {
+    _media = libav::avformat_open_input(_filename);
+    if (!_media) {
+        std::cout << "Could not open " << _filename << std::endl;
+        return false;
+    }
+    int const best_stream = ::av_find_best_stream(_media.get(), AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (best_stream < 0) {
+        std::cout << "No video stream in " << _filename << std::endl;
+        _media.reset();
+        return false;
+    }
+
+    // Ask the codec for as much of the reduction as it can do itself
+    int log2_scale = 0;
+    while ((2 << log2_scale) <= _options.scale) {
+        log2_scale++;
+    }
+    auto const * codecpar = _media->streams[best_stream]->codecpar;
+    auto const * codec = ::avcodec_find_decoder(codecpar->codec_id);
+    int const lowres = codec ? std::min<int>(log2_scale, codec->max_lowres) : 0;
+    libav::AVDictionary decoder_options;
+    if (lowres > 0) {
+        decoder_options.emplace("lowres", std::to_string(lowres));
+    }
+    if (libav::av_open_video_stream(_media, best_stream, decoder_options) < 0) {
+        std::cout << "Could not open video stream of " << _filename << std::endl;
+        _media.reset();
+        return false;
+    }
+    _stream_index = best_stream;
+
+    auto & codec_ctx = _media.open_streams[_stream_index];
+    _lowres = codec_ctx->lowres;
+    if (_options.keyframes_only) {
+        codec_ctx->skip_frame = AVDISCARD_NONKEY;
+    }
+    _out_width = std::max(codecpar->width / _options.scale, 1);
+    _out_height = std::max(codecpar->height / _options.scale, 1);
+    return true;
+}
+
+Thumbnail ThumbnailDecoder::getFrame(int frame) {
+    trace::TraceScope const trace_scope("ThumbnailDecoder::getFrame", "thumbnail", "frame", frame);
+
+    Thumbnail thumbnail;
+    if (_pts.empty()) {
+        return thumbnail;
+    }
+    int target = std::clamp(frame, 0, getFrameCount() - 1);
+    if (_options.keyframes_only) {
+        target = _keyFrameAtOrBefore(target);
+    }
+
+    auto decoded = _decode(target);
+    if (!decoded) {
+        return thumbnail;
+    }
+    int64_t const ts = (decoded->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
+                               ? decoded->best_effort_timestamp
+                               : decoded->pts;
+    auto const index = _pts_index.find(ts);
+    thumbnail.frame = index != _pts_index.end() ? index->second : target;
+
+    thumbnail.image.resize(static_cast<size_t>(_out_width) * static_cast<size_t>(_out_height) *
+                           static_cast<size_t>(formatBytes(_options.format)));
+    _convert(decoded.get(), thumbnail.image);
+    return thumbnail;
+}
+
+int ThumbnailDecoder::_keyFrameAtOrBefore(int frame) const {
+    auto const next = std::upper_bound(_key_frames.begin(), _key_frames.end(), frame);
+    return next == _key_frames.begin() ? _key_frames.front() : *std::prev(next);
+}
+
+/*
+Decode until the frame with the timestamp of target comes out. A request later in the same GOP as the
+previous one continues from where the decoder is; anything else seeks to the keyframe before target.
+*/
+libav::AVFrame ThumbnailDecoder::_decode(int target) {
+    int64_t const target_pts = _pts[static_cast<size_t>(target)];
+    int const key = _keyFrameAtOrBefore(target);
+
+    bool const seek = _options.keyframes_only || _last_frame < 0 || target <= _last_frame || key > _last_frame;
+    if (seek) {
+        _media.open_streams[_stream_index].flush_buffers();
+        libav::av_seek_frame(_media, libav::flicks(_pts[static_cast<size_t>(key)]), _stream_index, AVSEEK_FLAG_BACKWARD);
+    }
+    _last_frame = -1;
+
+    libav::AVFrame result;
+    bool dropped = false;// Frames decoded after result are lost, so the next request has to seek
+    auto on_frame = [&](libav::AVFrame const & frame) {
+        if (result) {
+            dropped = true;
+            return;
+        }
+        int64_t const ts = (frame->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
+                                   ? frame->best_effort_timestamp
+                                   : frame->pts;
+        if (ts != static_cast<int64_t>(AV_NOPTS_VALUE) && ts >= target_pts) {
+            result = frame;
+        }
+    };
+
+    bool need_key = seek;
+    auto pkt = _media.packet_pool.acquire();
+    while (!result) {
+        if (libav::av_read_frame(_media.get(), pkt.get()) < 0) {
+            libav::flush_decoder(_media, on_frame, _stream_index);
+            return result;// The decoder is drained; the next request seeks
+        }
+        bool const key_packet = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+        if (pkt->stream_index == _stream_index && (key_packet || !(need_key || _options.keyframes_only))) {
+            need_key = false;
+            libav::avcodec_send_packet(_media, pkt.get(), on_frame);
+        }
+        ::av_packet_unref(pkt.get());
+    }
+
+    if (!dropped) {
+        _last_frame = target;
+    }
+    return result;
+}
+
+void ThumbnailDecoder::_convert(::AVFrame * frame, std::vector<uint8_t> & output) {
+    int const remaining = std::max(_options.scale >> _lowres, 1);
+
+    // Gray8 from 8 bit luma: box filter the plane directly
+    auto const * desc = av_pix_fmt_desc_get(static_cast<::AVPixelFormat>(frame->format));
+    bool const direct_luma =
+            _options.format == VideoDecoder::OutputFormat::Gray8 && desc &&
+            !(desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL)) &&
+            desc->comp[0].plane == 0 && desc->comp[0].depth == 8 && desc->comp[0].step == 1 &&
+            desc->comp[0].offset == 0 && desc->comp[0].shift == 0 && frame->width >= _out_width * remaining &&
+            frame->height >= _out_height * remaining;
+    if (direct_luma) {
+        auto const * range = is_full_range(frame, desc) ? nullptr : &kLimitedToFullRange;
+        switch (remaining) {
+            case 1:
+                boxDownscale<1>(frame->data[0], frame->linesize[0], output.data(), _out_width, _out_height, range);
+                break;
+            case 2:
+                boxDownscale<2>(frame->data[0], frame->linesize[0], output.data(), _out_width, _out_height, range);
+                break;
+            case 4:
+                boxDownscale<4>(frame->data[0], frame->linesize[0], output.data(), _out_width, _out_height, range);
+                break;
+            default:
+                boxDownscale<8>(frame->data[0], frame->linesize[0], output.data(), _out_width, _out_height, range);
+                break;
+        }
+        return;
+    }
+
+    // Everything else: one area-averaging swscale pass does the color conversion and the reduction
+    _sws.reset(::sws_getCachedContext(_sws.release(), frame->width, frame->height,
+                                      static_cast<::AVPixelFormat>(frame->format), _out_width, _out_height,
+                                      swsFormat(_options.format), SWS_AREA, nullptr, nullptr, nullptr));
+    if (!_sws) {
+        std::cout << "Could not create thumbnail scaler" << std::endl;
+        return;
+    }
+    uint8_t * const dst_data[4] = {output.data(), nullptr, nullptr, nullptr};
+    int const dst_linesize[4] = {_out_width * formatBytes(_options.format), 0, 0, 0};
+    ::sws_scale(_sws.get(), frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
+}
+
+std::vector<Thumbnail> makeThumbnails(std::string const & filename, int count, ThumbnailOptions options, size_t threads) {
+    trace::TraceScope const trace_scope("makeThumbnails", "thumbnail");
+
+    options.keyframes_only = true;
+    ThumbnailDecoder first(filename, options);
+    if (!first.isOpen() || first.getFrameCount() == 0) {
+        return {};
+    }
+
+    // The keyframe at or before each of count evenly spaced frames, without repeats
+    auto const key_frames = first.getKeyFrames();
+    std::vector<int> frames;
+    if (count <= 0 || static_cast<size_t>(count) >= key_frames.size()) {
+        frames = key_frames;
+    } else {
+        for (int i = 0; i < count; ++i) {
+            int const target = static_cast<int>(static_cast<int64_t>(i) * first.getFrameCount() / count);
+            auto const next = std::upper_bound(key_frames.begin(), key_frames.end(), target);
+            int const key = next == key_frames.begin() ? key_frames.front() : *std::prev(next);
+            if (frames.empty() || frames.back() != key) {
+                frames.push_back(key);
+            }
+        }
+    }
+
+    ThreadPool pool(threads);
+    size_t const workers = std::min(pool.size(), frames.size());
+    std::vector<std::future<std::vector<Thumbnail>>> runs;
+    for (size_t w = 0; w < workers; ++w) {
+        size_t const begin = w * frames.size() / workers;
+        size_t const end = (w + 1) * frames.size() / workers;
+        runs.push_back(pool.submit([&frames, &first, begin, end, w]() {
+            // The first run reuses the decoder that read the index; the others open the file again
+            std::unique_ptr<ThumbnailDecoder> own;
+            ThumbnailDecoder * decoder = &first;
+            if (w > 0) {
+                own = std::make_unique<ThumbnailDecoder>(first);
+                decoder = own.get();
+            }
+            std::vector<Thumbnail> run;
+            for (size_t i = begin; i < end; ++i) {
+                run.push_back(decoder->getFrame(frames[i]));
+            }
+            return run;
+        }));
+    }
+
+    std::vector<Thumbnail> thumbnails;
+    thumbnails.reserve(frames.size());
+    for (auto & run: runs) {
+        for (auto & thumbnail: run.get()) {
+            thumbnails.push_back(std::move(thumbnail));
+        }
+    }
+    return thumbnails;
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,274 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ffmpeg_wrapper {
+namespace trace {
+
+namespace {
+
+struct TraceEvent {
+    char const * name;
+    char const * category;
+    char const * arg_name;
+    int64_t arg_value;
+    int64_t start_ns;
+    int64_t duration_ns;
+};
+
+/*
+Single producer ring buffer. Only the owning thread writes events and the write counter; the exporter
+reads the counter with acquire semantics and copies the newest min(written, capacity) events. clear()
+only moves the cleared mark, so the owner's counter is never written by another thread.
+*/
+struct ThreadBuffer {
+    ThreadBuffer(size_t capacity, uint32_t id, char const * name)
+        : events(std::max<size_t>(capacity, 1)),
+          thread_name(name),
+          thread_id(id) {}
+
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> written{0};
+    std::atomic<uint64_t> cleared{0};// Events before this count were dropped by clear()
+    std::atomic<char const *> thread_name;
+    uint32_t const thread_id;
+};
+
+// Buffers of threads that have exited are kept for export, up to this many, oldest dropped first
+constexpr size_t kMaxRetiredBuffers = 16;
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> live;
+    std::deque<std::shared_ptr<ThreadBuffer>> retired;// Oldest first
+    std::atomic<size_t> events_per_thread{1 << 16};
+    uint32_t next_thread_id{1};
+};
+
+Registry & registry() {
+    static Registry r;
+    return r;
+}
+
+std::chrono::steady_clock::time_point const g_epoch = std::chrono::steady_clock::now();
+
+/*
+A thread gets a buffer when it records its first event, so threads that never record while tracing is
+enabled cost nothing. The buffer is handed to the registry's retired list when the thread exits.
+*/
+struct ThreadState {
+    char const * name{nullptr};
+    std::shared_ptr<ThreadBuffer> buffer;
+
+    ~ThreadState() {
+        if (!buffer) {
+            return;
+        }
+        auto & r = registry();
+        std::lock_guard<std::mutex> const lock(r.mutex);
+        r.live.erase(std::find(r.live.begin(), r.live.end(), buffer));
+        if (buffer->written.load() == buffer->cleared.load()) {
+            return;// Nothing left to export
+        }
+        r.retired.push_back(std::move(buffer));
+        while (r.retired.size() > kMaxRetiredBuffers) {
+            r.retired.pop_front();
+        }
+    }
+};
+
+ThreadState & thread_state() {
+    thread_local ThreadState state;
+    return state;
+}
+
+ThreadBuffer & thread_buffer() {
+    auto & state = thread_state();
+    if (!state.buffer) {
+        auto & r = registry();
+        std::lock_guard<std::mutex> const lock(r.mutex);
+        state.buffer = std::make_shared<ThreadBuffer>(r.events_per_thread.load(), r.next_thread_id++, state.name);
+        r.live.push_back(state.buffer);
+    }
+    return *state.buffer;
+}
+
+size_t buffer_bytes(ThreadBuffer const & buffer) {
+    return sizeof(ThreadBuffer) + buffer.events.capacity() * sizeof(TraceEvent);
+}
+
+void write_json_string(std::ostream & os, char const * s) {
+    os << '"';
+    for (; s && *s; ++s) {
+        switch (*s) {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            case '\r':
+                os << "\\r";
+                break;
+            case '\t':
+                os << "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(*s) < 0x20) {
+                    char escaped[7];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(*s));
+                    os << escaped;
+                } else {
+                    os << *s;
+                }
+        }
+    }
+    os << '"';
+}
+
+}// namespace
+
+namespace detail {
+
+std::atomic<bool> g_enabled{false};
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count();
+}
+
+void record(char const * name, char const * category, int64_t start_ns, int64_t end_ns,
+            char const * arg_name, int64_t arg_value) {
+    auto & buffer = thread_buffer();
+    uint64_t const index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index % buffer.events.size()] = TraceEvent{name, category, arg_name, arg_value, start_ns, end_ns - start_ns};
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+}// namespace detail
+
+void enable(size_t events_per_thread) {
+    registry().events_per_thread.store(events_per_thread);
+    detail::g_enabled.store(true);
+}
+
+void disable() {
+    detail::g_enabled.store(false);
+}
+
+void setThreadName(char const * name) {
+    auto & state = thread_state();
+    state.name = name;
+    if (state.buffer) {
+        state.buffer->thread_name.store(name);
+    }
+}
+
+void clear() {
+    auto & r = registry();
+    std::lock_guard<std::mutex> const lock(r.mutex);
+    for (auto & buffer: r.live) {
+        buffer->cleared.store(buffer->written.load(std::memory_order_acquire));
+    }
+    r.retired.clear();
+}
+
+size_t memoryBytes() {
+    auto & r = registry();
+    std::lock_guard<std::mutex> const lock(r.mutex);
+    size_t bytes = 0;
+    for (auto const & buffer: r.live) {
+        bytes += buffer_bytes(*buffer);
+    }
+    for (auto const & buffer: r.retired) {
+        bytes += buffer_bytes(*buffer);
+    }
+    return bytes;
+}
+
+void writeChromeTrace(std::ostream & os) {
+    auto & r = registry();
+    std::lock_guard<std::mutex> const lock(r.mutex);
+
+    constexpr double kNsPerUs = 1000.0;
+    constexpr int kPid = 1;
+
+    auto const flags = os.flags();
+    auto const precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) os << ",";
+        first = false;
+        os << "\n";
+    };
+
+    auto write_buffer = [&](ThreadBuffer const & buffer) {
+        if (auto const * thread_name = buffer.thread_name.load()) {
+            separator();
+            os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << kPid << ",\"tid\":" << buffer.thread_id
+               << ",\"args\":{\"name\":";
+            write_json_string(os, thread_name);
+            os << "}}";
+        }
+
+        uint64_t const written = buffer.written.load(std::memory_order_acquire);
+        uint64_t const capacity = buffer.events.size();
+        uint64_t const cleared = std::min(buffer.cleared.load(), written);
+        uint64_t const begin = std::max(written > capacity ? written - capacity : 0, cleared);
+        for (uint64_t i = begin; i < written; ++i) {
+            TraceEvent const event = buffer.events[i % capacity];
+            separator();
+            os << "{\"name\":";
+            write_json_string(os, event.name);
+            os << ",\"cat\":";
+            write_json_string(os, event.category);
+            os << ",\"ph\":\"X\",\"ts\":" << static_cast<double>(event.start_ns) / kNsPerUs
+               << ",\"dur\":" << static_cast<double>(event.duration_ns) / kNsPerUs
+               << ",\"pid\":" << kPid << ",\"tid\":" << buffer.thread_id;
+            if (event.arg_name) {
+                os << ",\"args\":{";
+                write_json_string(os, event.arg_name);
+                os << ":" << event.arg_value << "}";
+            }
+            os << "}";
+        }
+    };
+
+    // Threads that have exited first, by the order they exited
+    for (auto const & buffer: r.retired) {
+        write_buffer(*buffer);
+    }
+    for (auto const & buffer: r.live) {
+        write_buffer(*buffer);
+    }
+    os << "\n]}\n";
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+bool saveChromeTrace(std::string const & path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cout << "Failed to open " << path << " for writing trace" << std::endl;
+        return false;
+    }
+    writeChromeTrace(file);
+    return static_cast<bool>(file);
+}
+
+}// namespace trace
+}// namespace ffmpeg_wrapper
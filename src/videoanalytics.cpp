@@ -0,0 +1,413 @@
+#include "videoanalytics.h"
+
+#include "decodeutils.h"
+#include "threadpool.h"
+#include "trace.h"
+
+#include "libavinc/libavinc.hpp"
+#include "libavutil/pixdesc.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+
+namespace ffmpeg_wrapper {
+
+namespace {
+
+struct PacketIndex {
+    std::vector<int64_t> pts;// Flicks, in packet order
+    std::unordered_map<int64_t, int> frame_of_pts;
+    std::vector<int> key_frames;
+};
+
+struct ProjectionSums {
+    std::vector<uint64_t> sum;// 64 bits, as 32 would wrap after 16.8M bright frames
+    std::vector<uint64_t> sum_squares;
+    std::vector<uint8_t> max;
+    int frames{0};
+};
+
+/*
+Gray8 rows of a decoded frame. 8 bit full range luma is read in place; limited range and deeper luma
+are converted one row at a time into a scratch row, which stays in cache. Formats without a luma plane
+(RGB, packed YUV) go through one swscale pass into a scratch image.
+*/
+class LumaRows {
+public:
+    LumaRows(int width, int height)
+        : _width(width),
+          _height(height),
+          _row(static_cast<size_t>(width)) {
+    }
+
+    bool reset(::AVFrame const * frame) {
+        _frame = frame;
+        auto const * desc = av_pix_fmt_desc_get(static_cast<::AVPixelFormat>(frame->format));
+        if (desc && _isDirectLuma(desc) && frame->width >= _width && frame->height >= _height) {
+            auto const & luma = desc->comp[0];
+            _depth = luma.depth;
+            _shift = luma.shift;
+            _full_range = is_full_range(frame, desc);
+            _mode = Mode::Plane;
+            return true;
+        }
+
+        _sws.reset(::sws_getCachedContext(_sws.release(), frame->width, frame->height,
+                                          static_cast<::AVPixelFormat>(frame->format), _width, _height,
+                                          AV_PIX_FMT_GRAY8, SWS_BILINEAR, nullptr, nullptr, nullptr));
+        if (!_sws) {
+            return false;
+        }
+        _image.resize(static_cast<size_t>(_width) * static_cast<size_t>(_height));
+        uint8_t * const dst_data[4] = {_image.data(), nullptr, nullptr, nullptr};
+        int const dst_linesize[4] = {_width, 0, 0, 0};
+        ::sws_scale(_sws.get(), frame->data, frame->linesize, 0, frame->height, dst_data, dst_linesize);
+        _mode = Mode::Image;
+        return true;
+    }
+
+    uint8_t const * row(int y) {
+        if (_mode == Mode::Image) {
+            return _image.data() + static_cast<ptrdiff_t>(y) * _width;
+        }
+        uint8_t const * src = _frame->data[0] + static_cast<ptrdiff_t>(y) * _frame->linesize[0];
+        if (_depth == 8) {
+            if (_full_range) {
+                return src;
+            }
+            for (int x = 0; x < _width; ++x) {
+                _row[static_cast<size_t>(x)] = kLimitedToFullRange[src[x]];
+            }
+            return _row.data();
+        }
+
+        // High bit depth, the same arithmetic as VideoDecoder::_togray8
+        auto const * samples = reinterpret_cast<uint16_t const *>(src);
+        if (_full_range) {
+            int const drop = _shift + _depth - 8;
+            for (int x = 0; x < _width; ++x) {
+                _row[static_cast<size_t>(x)] = static_cast<uint8_t>(samples[x] >> drop);
+            }
+        } else {
+            int const black = 16 << (_depth - 8);
+            int const span = 219 << (_depth - 8);
+            for (int x = 0; x < _width; ++x) {
+                int const v = std::max((samples[x] >> _shift) - black, 0);
+                _row[static_cast<size_t>(x)] = static_cast<uint8_t>(std::min((v * 255 + span / 2) / span, 255));
+            }
+        }
+        return _row.data();
+    }
+
+private:
+    struct SwsContextDeleter {
+        void operator()(::SwsContext * context) const { ::sws_freeContext(context); }
+    };
+    enum class Mode {
+        Plane,
+        Image,
+    };
+
+    static bool _isDirectLuma(AVPixFmtDescriptor const * desc) {
+        if (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM |
+                           AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT)) {
+            return false;
+        }
+        auto const & luma = desc->comp[0];
+        int const container = luma.depth > 8 ? 2 : 1;
+        uint16_t const probe = 1;
+        uint8_t first_byte;
+        std::memcpy(&first_byte, &probe, 1);
+        bool const host_big_endian = first_byte == 0;
+        bool const big_endian = (desc->flags & AV_PIX_FMT_FLAG_BE) != 0;
+        return luma.plane == 0 && luma.depth >= 8 && luma.depth <= 16 && luma.step == container &&
+               luma.offset == 0 && luma.shift + luma.depth <= 8 * container &&
+               (container == 1 || big_endian == host_big_endian);
+    }
+
+    int _width;
+    int _height;
+    ::AVFrame const * _frame{nullptr};
+    Mode _mode{Mode::Plane};
+    int _depth{8};
+    int _shift{0};
+    bool _full_range{true};
+    std::vector<uint8_t> _row;
+    std::vector<uint8_t> _image;
+    std::unique_ptr<::SwsContext, SwsContextDeleter> _sws;
+};
+
+/*
+Row kernels. The loops are branch free with fixed-width accumulators so the compiler vectorizes them.
+The histogram spreads consecutive pixels over four tables so runs of equal values do not serialize on
+one counter.
+*/
+void reduceRow(uint8_t const * __restrict row, int width, uint64_t & sum, uint8_t & lo, uint8_t & hi) {
+    uint32_t row_sum = 0;
+    uint8_t row_lo = 255;
+    uint8_t row_hi = 0;
+    for (int x = 0; x < width; ++x) {
+        uint8_t const v = row[x];
+        row_sum += v;
+        row_lo = std::min(row_lo, v);
+        row_hi = std::max(row_hi, v);
+    }
+    sum += row_sum;
+    lo = std::min(lo, row_lo);
+    hi = std::max(hi, row_hi);
+}
+
+void histogramRow(uint8_t const * row, int width, std::array<std::array<uint32_t, 256>, 4> & counts) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        counts[0][row[x]]++;
+        counts[1][row[x + 1]]++;
+        counts[2][row[x + 2]]++;
+        counts[3][row[x + 3]]++;
+    }
+    for (; x < width; ++x) {
+        counts[0][row[x]]++;
+    }
+}
+
+void accumulateRow(uint8_t const * __restrict row, int width, uint64_t * __restrict sum,
+                   uint64_t * __restrict sum_squares, uint8_t * __restrict max) {
+    for (int x = 0; x < width; ++x) {
+        uint32_t const v = row[x];
+        sum[x] += v;
+        sum_squares[x] += v * v;
+        max[x] = std::max(max[x], row[x]);
+    }
+}
+
+void analyzeFrame(LumaRows & rows, int width, int height, AnalyticsOptions const & options, size_t slot,
+                  FrameStatistics & stats, ProjectionSums * projection) {
+    bool const reduce = options.mean || options.min_max;
+    uint64_t sum = 0;
+    uint8_t lo = 255;
+    uint8_t hi = 0;
+    std::array<std::array<uint32_t, 256>, 4> counts;
+    if (options.histogram) {
+        for (auto & table: counts) table.fill(0);
+    }
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t const * row = rows.row(y);
+        if (options.histogram) {
+            histogramRow(row, width, counts);
+        } else if (reduce) {
+            reduceRow(row, width, sum, lo, hi);
+        }
+        if (projection) {
+            size_t const offset = static_cast<size_t>(y) * static_cast<size_t>(width);
+            accumulateRow(row, width, projection->sum.data() + offset, projection->sum_squares.data() + offset,
+                          projection->max.data() + offset);
+        }
+    }
+
+    if (options.histogram) {
+        // The histogram already holds everything the other reductions need
+        auto & histogram = stats.histogram[slot];
+        for (size_t v = 0; v < 256; ++v) {
+            histogram[v] = counts[0][v] + counts[1][v] + counts[2][v] + counts[3][v];
+            if (histogram[v] == 0) continue;
+            sum += static_cast<uint64_t>(v) * histogram[v];
+            lo = std::min(lo, static_cast<uint8_t>(v));
+            hi = std::max(hi, static_cast<uint8_t>(v));
+        }
+    }
+    if (options.mean) {
+        stats.mean[slot] = static_cast<float>(static_cast<double>(sum) / (static_cast<double>(width) * height));
+    }
+    if (options.min_max) {
+        stats.min[slot] = lo;
+        stats.max[slot] = hi;
+    }
+    if (projection) {
+        projection->frames++;
+    }
+}
+
+bool readIndex(std::string const & filename, int & stream_index, int & width, int & height, PacketIndex & index) {
+    auto media = libav::avformat_open_input(filename);
+    if (!media) {
+        std::cout << "Could not open " << filename << std::endl;
+        return false;
+    }
+    stream_index = libav::av_open_video_stream(media);
+    if (stream_index < 0) {
+        std::cout << "Could not open video stream of " << filename << std::endl;
+        return false;
+    }
+    width = media->streams[stream_index]->codecpar->width;
+    height = media->streams[stream_index]->codecpar->height;
+
+    scan_index_packets(media, stream_index, [&index](::AVPacket const & pkt) {
+        index.frame_of_pts[pkt.pts] = static_cast<int>(index.pts.size());
+        if (pkt.flags & AV_PKT_FLAG_KEY) {
+            index.key_frames.push_back(static_cast<int>(index.pts.size()));
+        }
+        index.pts.push_back(pkt.pts);
+    });
+    if (index.key_frames.empty() && !index.pts.empty()) {
+        index.key_frames.push_back(0);
+    }
+    return true;
+}
+
+/*
+Decode packets [begin_packet, end_packet), which start at a keyframe, and analyze the frames in
+[first, last] among them.
+*/
+int analyzeRun(std::string const & filename, int stream_index, PacketIndex const & index, int begin_packet,
+               int end_packet, int width, int height, AnalyticsOptions const & options, int first, int last,
+               FrameStatistics & stats, ProjectionSums * projection) {
+    trace::TraceScope const trace_scope("analyzeRun", "analytics", "first", begin_packet);
+
+    auto media = libav::avformat_open_input(filename);
+    if (!media || libav::av_open_video_stream(media, stream_index) < 0) {
+        std::cout << "Could not open " << filename << std::endl;
+        return 0;
+    }
+    libav::av_seek_frame(media, libav::flicks(index.pts[static_cast<size_t>(begin_packet)]), stream_index,
+                         AVSEEK_FLAG_BACKWARD);
+
+    LumaRows rows(width, height);
+    int analyzed = 0;
+    auto on_frame = [&](libav::AVFrame const & frame) {
+        int64_t const ts = (frame->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
+                                   ? frame->best_effort_timestamp
+                                   : frame->pts;
+        auto const found = index.frame_of_pts.find(ts);
+        if (found == index.frame_of_pts.end()) return;
+        int const idx = found->second;
+        if (idx < std::max(first, begin_packet) || idx > last || idx >= end_packet) return;
+        if (!rows.reset(frame.get())) return;
+        analyzeFrame(rows, width, height, options, static_cast<size_t>(idx - first), stats, projection);
+        analyzed++;
+    };
+
+    bool started = false;
+    auto pkt = media.packet_pool.acquire();
+    while (libav::av_read_frame(media.get(), pkt.get()) >= 0) {
+        if (pkt->stream_index == stream_index && pkt->pts != static_cast<int64_t>(AV_NOPTS_VALUE)) {
+            auto const found = index.frame_of_pts.find(pkt->pts);
+            int const idx = found != index.frame_of_pts.end() ? found->second : -1;
+            if (idx >= end_packet) {
+                ::av_packet_unref(pkt.get());
+                break;
+            }
+            started = started || idx >= begin_packet;
+            if (started) {
+                libav::avcodec_send_packet(media, pkt.get(), on_frame);
+            }
+        }
+        ::av_packet_unref(pkt.get());
+    }
+    libav::flush_decoder(media, on_frame, stream_index);
+    return analyzed;
+}
+
+}// namespace
+
+bool analyzeVideo(std::string const & filename, AnalyticsOptions const & options, VideoAnalytics & result) {
+    trace::TraceScope const trace_scope("analyzeVideo", "analytics");
+
+    result = VideoAnalytics();
+    int stream_index = -1;
+    int width = 0;
+    int height = 0;
+    PacketIndex index;
+    if (!readIndex(filename, stream_index, width, height, index) || index.pts.empty() || width <= 0 || height <= 0) {
+        return false;
+    }
+
+    int const frame_count = static_cast<int>(index.pts.size());
+    int const first = std::clamp(options.first_frame, 0, frame_count - 1);
+    int const last = options.last_frame < 0 ? frame_count - 1 : std::clamp(options.last_frame, 0, frame_count - 1);
+    if (last < first) {
+        return false;
+    }
+    result.first_frame = first;
+    result.frame_count = last - first + 1;
+
+    size_t const slots = static_cast<size_t>(result.frame_count);
+    if (options.mean) result.frames.mean.assign(slots, 0.0f);
+    if (options.min_max) {
+        result.frames.min.assign(slots, 0);
+        result.frames.max.assign(slots, 0);
+    }
+    if (options.histogram) result.frames.histogram.assign(slots, std::array<uint32_t, 256>{});
+
+    // GOPs covering the range: from the keyframe at or before first, split at every later keyframe
+    std::vector<int> gop_starts;
+    auto const first_key = std::upper_bound(index.key_frames.begin(), index.key_frames.end(), first);
+    gop_starts.push_back(first_key == index.key_frames.begin() ? 0 : *std::prev(first_key));
+    for (auto key = first_key; key != index.key_frames.end() && *key <= last; ++key) {
+        gop_starts.push_back(*key);
+    }
+
+    ThreadPool pool(options.threads);
+    size_t const workers = std::min(pool.size(), gop_starts.size());
+    std::vector<ProjectionSums> projections(options.projections ? workers : 0);
+    size_t const pixels = static_cast<size_t>(width) * static_cast<size_t>(height);
+
+    // Workers write disjoint slots of result.frames, so they need no locking
+    std::vector<std::future<int>> runs;
+    for (size_t w = 0; w < workers; ++w) {
+        size_t const begin_gop = w * gop_starts.size() / workers;
+        size_t const end_gop = (w + 1) * gop_starts.size() / workers;
+        int const begin_packet = gop_starts[begin_gop];
+        int const end_packet = end_gop < gop_starts.size() ? gop_starts[end_gop] : last + 1;
+        ProjectionSums * projection = nullptr;
+        if (options.projections) {
+            projection = &projections[w];
+            projection->sum.assign(pixels, 0);
+            projection->sum_squares.assign(pixels, 0);
+            projection->max.assign(pixels, 0);
+        }
+        runs.push_back(pool.submit([&, begin_packet, end_packet, projection]() {
+            return analyzeRun(filename, stream_index, index, begin_packet, end_packet, width, height, options, first,
+                              last, result.frames, projection);
+        }));
+    }
+    for (auto & run: runs) {
+        result.frames_analyzed += run.get();
+    }
+
+    if (options.projections) {
+        auto & merged = projections.front();
+        for (size_t w = 1; w < projections.size(); ++w) {
+            for (size_t i = 0; i < pixels; ++i) {
+                merged.sum[i] += projections[w].sum[i];
+                merged.sum_squares[i] += projections[w].sum_squares[i];
+                merged.max[i] = std::max(merged.max[i], projections[w].max[i]);
+            }
+            merged.frames += projections[w].frames;
+        }
+
+        auto & out = result.projections;
+        out.width = width;
+        out.height = height;
+        out.mean.assign(pixels, 0.0f);
+        out.std.assign(pixels, 0.0f);
+        out.max = std::move(merged.max);
+        if (merged.frames > 0) {
+            double const n = merged.frames;
+            for (size_t i = 0; i < pixels; ++i) {
+                double const mean = static_cast<double>(merged.sum[i]) / n;
+                double const variance = static_cast<double>(merged.sum_squares[i]) / n - mean * mean;
+                out.mean[i] = static_cast<float>(mean);
+                out.std[i] = static_cast<float>(std::sqrt(std::max(variance, 0.0)));
+            }
+        }
+    }
+    return true;
+}
+
+}// namespace ffmpeg_wrapper
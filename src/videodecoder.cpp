@@ -1,9 +1,13 @@
 #include "videodecoder.h"
 
+#include "decodeutils.h"
 #include "libavinc/libavinc.hpp"
+#include "trace.h"
 
 #include "libavcodec/packet.h"
 #include "libavutil/avutil.h"
+#include "libavutil/motion_vector.h"
+#include "libavutil/pixdesc.h"
 #include "libavutil/pixfmt.h"
 
 #include <algorithm>
@@ -17,45 +21,67 @@
 
 namespace ffmpeg_wrapper {
 
+// Seek instead of decoding forward when the keyframe before the desired frame is further ahead than this
+constexpr int kIframeSeekThreshold = 10;
+
 void FrameBuffer::buildFrameBuffer(int buf_size) {
 
     _frame_buf.clear();
     _frame_buf = boost::circular_buffer<FrameBufferElement>(buf_size);
+    _compressed.clear();
 }
 
 void FrameBuffer::addFrametoBuffer(libav::AVFrame frame, int pos) {
 
     if (_enable) {
         //Check if the position is already in the buffer
-        if (isFrameInBuffer(pos)) {
+        if (_isInRing(pos)) {
             if (_verbose) {
                 std::cout << "Frame " << pos << " is already in the buffer" << std::endl;
             }
         } else {
+            if (_frame_buf.full() && _compressed.isEnabled()) {
+                // push_back overwrites the oldest frame
+                _compressed.store(_frame_buf.front().frame_id, _frame_buf.front().frame.get());
+            }
             _frame_buf.push_back(FrameBufferElement{pos, std::move(frame)});
         }
     }
 }
 
-bool FrameBuffer::isFrameInBuffer(int frame) {
+bool FrameBuffer::_isInRing(int frame) const {
     auto element = std::find_if(
             _frame_buf.begin(), _frame_buf.end(),
             [&frame](FrameBufferElement const & x) { return x.frame_id == frame; });
-    if (element == _frame_buf.end()) {
-        return false;
-    } else {
-        return true;
-    }
+    return element != _frame_buf.end();
+}
+
+bool FrameBuffer::isFrameInBuffer(int frame) {
+    return _isInRing(frame) || _compressed.contains(frame);
 }
 
 libav::AVFrame FrameBuffer::getFrameFromBuffer(int frame) {
     auto element = std::find_if(
             _frame_buf.begin(), _frame_buf.end(),
             [&frame](FrameBufferElement const & x) { return x.frame_id == frame; });
+    if (element == _frame_buf.end()) {
+        return _compressed.retrieve(frame);
+    }
 
     return (*element).frame;
 }
 
+size_t FrameBuffer::memoryBytes() const {
+    size_t bytes = 0;
+    for (auto const & element: _frame_buf) {
+        if (!element.frame) continue;
+        for (auto const * buf: element.frame->buf) {
+            if (buf) bytes += buf->size;
+        }
+    }
+    return bytes + _compressed.memoryBytes();
+}
+
 VideoDecoder::VideoDecoder() {
     constexpr size_t kReservePts = 500000ull;
     _pts.reserve(kReservePts);
@@ -63,18 +89,139 @@ VideoDecoder::VideoDecoder() {
     _frame_buf = std::make_unique<FrameBuffer>();
 }
 
-VideoDecoder::VideoDecoder(std::string const & filename) {
+VideoDecoder::VideoDecoder(std::string const & filename)
+    : VideoDecoder() {
     createMedia(filename);
 }
 
+void VideoDecoder::setVideoStreamIndex(int stream_index) {
+    _requested_stream_index = stream_index;
+    if (!_filename.empty() && stream_index != _video_stream_index) {
+        createMedia(_filename);
+    }
+}
+
+void VideoDecoder::setExportMotionVectors(bool enable) {
+    if (enable == _export_motion_vectors) return;
+    _export_motion_vectors = enable;
+    if (!_filename.empty()) {
+        createMedia(_filename);
+    }
+}
+
+bool VideoDecoder::getMotionVectors(int frame, MotionVectorField & field) {
+    field = MotionVectorField();
+    if (!_export_motion_vectors) {
+        return false;
+    }
+    auto const decoded = _getDecodedFrame(frame);
+    if (!decoded) {
+        return false;
+    }
+
+    field.frame = std::clamp(frame, 0, _frame_count - 1);
+    field.width = decoded->width;
+    field.height = decoded->height;
+    field.picture_type = static_cast<char>(av_get_picture_type_char(decoded->pict_type));
+
+    auto const * side_data = av_frame_get_side_data(decoded.get(), AV_FRAME_DATA_MOTION_VECTORS);
+    if (!side_data) {
+        return true;// Intra frame
+    }
+    auto const * mvs = reinterpret_cast<::AVMotionVector const *>(side_data->data);
+    size_t const count = side_data->size / sizeof(::AVMotionVector);
+    field.vectors.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        auto const & mv = mvs[i];
+        float const scale = mv.motion_scale > 0 ? 1.0f / static_cast<float>(mv.motion_scale) : 1.0f;
+        field.vectors.push_back(MotionVector{
+                mv.dst_x,
+                mv.dst_y,
+                static_cast<float>(mv.motion_x) * scale,
+                static_cast<float>(mv.motion_y) * scale,
+                mv.w,
+                mv.h,
+                static_cast<int8_t>(mv.source < 0 ? -1 : 1)});
+    }
+    return true;
+}
+
+DecoderStatistics VideoDecoder::getStatistics() const {
+    DecoderStatistics stats = _stats;
+    if (_media) {
+        stats.frame_allocations = _media.frame_pool.allocations() - _frame_allocations_base;
+        stats.packet_allocations = _media.packet_pool.allocations() - _packet_allocations_base;
+    }
+    return stats;
+}
+
+void VideoDecoder::resetStatistics() {
+    _stats.reset();
+    _frame_allocations_base = _media ? _media.frame_pool.allocations() : 0;
+    _packet_allocations_base = _media ? _media.packet_pool.allocations() : 0;
+}
+
+void VideoDecoder::setPipelined(bool pipelined) {
+    _pipelined = pipelined;
+    if (!pipelined) {
+        _pipeline.reset();
+    }
+}
+
+size_t VideoDecoder::estimateMemoryBytes() const {
+    // Rough per-node cost of the unordered_map: key, value, next pointer and cached hash
+    constexpr size_t kIndexNodeBytes = sizeof(uint64_t) + sizeof(int64_t) + 2 * sizeof(void *);
+
+    size_t bytes = sizeof(VideoDecoder);
+    bytes += _pts.capacity() * sizeof(uint64_t);
+    bytes += _pkt_durations.capacity() * sizeof(uint64_t);
+    bytes += _pkt_sizes.capacity() * sizeof(uint32_t);
+    bytes += _pkt_flags.capacity() * sizeof(uint8_t);
+    bytes += _i_frames.capacity() * sizeof(int64_t);
+    bytes += _i_frame_pts.capacity() * sizeof(uint64_t);
+    bytes += _pts_index.size() * kIndexNodeBytes + _pts_index.bucket_count() * sizeof(void *);
+    if (_frame_buf) {
+        bytes += _frame_buf->memoryBytes();
+    }
+    bytes += _output_cache.memoryBytes();
+    if (_media) {
+        // Released pooled frames keep their decoded buffers until they are reused
+        bytes += _media.frame_pool.retainedBytes();
+    }
+    return bytes;
+}
+
+libav::flicks VideoDecoder::getFrameTime(int frame) const {
+    if (_pts.empty()) return libav::flicks(0);
+    auto const clamped = static_cast<size_t>(std::clamp(frame, 0, static_cast<int>(_pts.size()) - 1));
+    return libav::flicks(static_cast<int64_t>(_pts[clamped] - _pts.front()));
+}
+
+int VideoDecoder::getFrameAtTime(libav::flicks time) const {
+    if (_pts.empty()) return -1;
+    if (time.count() < 0) return 0;
+    // Like _findFrameByPts, this relies on the pts being in increasing order
+    auto const pts = _pts.front() + static_cast<uint64_t>(time.count());
+    auto const after = std::upper_bound(_pts.begin(), _pts.end(), pts);
+    return std::max(static_cast<int>(std::distance(_pts.begin(), after)) - 1, 0);
+}
+
+std::vector<int> VideoDecoder::getVideoStreams() const {
+    if (!_media) return {};
+    return libav::find_video_streams(_media);
+}
+
 /*
 
 There are multiple, sometimes redundant, pieces of information stored in the larger AVFormatContext structure (media variable)
-and the AVStream member structure (media->streams[0]). Some are in slightly different units.
+and the AVStream member structure (media->streams[i] for the decoded video stream i). Some are in slightly different units.
 
 For instance, media->start_time and media->duration are in units of AV_TIME_BASE fractional sections, and should be roughly equivalent to
-media->streams[0]->duration and media->streams[0]->start_time, which are in units of the stream timebase. Consequently:
-media->duration = media->streams[0]->duration * stream_timebase (12800 or 90000 usually) / 1000
+media->streams[i]->duration and media->streams[i]->start_time, which are in units of the stream timebase. Consequently:
+media->duration = media->streams[i]->duration * stream_timebase (12800 or 90000 usually) / 1000
+
+Only the selected video stream has a decoder. All other streams are set to AVDISCARD_ALL, so the demuxer
+skips their packets and the packet loops below only see video packets.
 
 This helpful answer outlines some of them:
 https://stackoverflow.com/questions/40275242/libav-ffmpeg-copying-decoded-video-timestamps-to-encoder
@@ -84,56 +231,68 @@ https://stackoverflow.com/questions/40275242/libav-ffmpeg-copying-decoded-video-
 */
 
 void VideoDecoder::createMedia(std::string const & filename) {
+    trace::TraceScope const trace_scope("VideoDecoder::createMedia", "decoder");
+
+    _filename = filename;
+    _file_id = computeFileId(filename);
 
+    // Release the previous packet before the context it reads from
+    _pkt.reset();
+    _pipeline.reset();
+    _output_cache.clear();
     auto mymedia = libav::avformat_open_input(filename);
     _media = std::move(mymedia);
-    libav::av_open_best_streams(_media);
 
     // Clear any previous state
     _pts.clear();
     _pts_index.clear();
     _pkt_durations.clear();
+    _pkt_sizes.clear();
+    _pkt_flags.clear();
     _i_frames.clear();
     _i_frame_pts.clear();
     _frame_count = 0;
+    _video_stream_index = -1;
+    _frame_allocations_base = 0;
+    _packet_allocations_base = 0;
 
-    // Determine the primary video stream index (assume 0 if single-stream usage)
-    int const video_stream_index = 0; // this wrapper assumes the first stream is the video stream
-
-    // Fast, safe scan: only consider valid video packets with usable PTS; collect keyframe locations
-    // Note: not every packet produces a frame; we record only packets that have a defined PTS.
-    for (auto & pkg: _media) {
-        // Only consider packets from the selected video stream
-        if (pkg.stream_index != video_stream_index) {
-            ::av_packet_unref(&pkg);
-            continue;
-        }
-
-        // Skip clearly unusable/corrupt packets
-        if ((pkg.flags & AV_PKT_FLAG_CORRUPT) || pkg.size <= 0) {
-            ::av_packet_unref(&pkg);
-            continue;
-        }
+    if (!_media) {
+        std::cout << "Could not open " << filename << std::endl;
+        return;
+    }
 
-        // We rely on PTS to map to frame indices; skip packets without a valid PTS
-        if (pkg.pts == static_cast<int64_t>(AV_NOPTS_VALUE)) {
-            ::av_packet_unref(&pkg);
-            continue;
-        }
+    libav::AVDictionary decoder_options;
+    if (_export_motion_vectors) {
+        decoder_options.emplace("flags2", "+export_mvs");
+    }
+    int const video_stream_index = libav::av_open_video_stream(_media, _requested_stream_index, decoder_options);
+    if (video_stream_index < 0) {
+        std::cout << "Could not open video stream " << _requested_stream_index << " of " << filename << std::endl;
+        _media.reset();
+        return;
+    }
+    _video_stream_index = video_stream_index;
 
-        // Keep a list of candidate frame PTS values (monotonically non-decreasing in most containers)
-    _pts.push_back(static_cast<uint64_t>(pkg.pts));
-    _pts_index[static_cast<uint64_t>(pkg.pts)] = static_cast<int64_t>(_pts.size() - 1);
+    // Record every usable video packet; not every packet produces a frame, but each indexed one has a PTS
+    scan_index_packets(_media, video_stream_index, [this](::AVPacket const & pkg) {
+        _pts.push_back(static_cast<uint64_t>(pkg.pts));
+        _pts_index[static_cast<uint64_t>(pkg.pts)] = static_cast<int64_t>(_pts.size() - 1);
         _pkt_durations.push_back(pkg.duration);
+        _pkt_sizes.push_back(static_cast<uint32_t>(pkg.size));
+        _pkt_flags.push_back(static_cast<uint8_t>(pkg.flags));
 
         if (pkg.flags & AV_PKT_FLAG_KEY) {
             // Store keyframe index as the index into our _pts vector
             _i_frames.push_back(static_cast<int>(_pts.size() - 1));
             _i_frame_pts.push_back(pkg.pts);
         }
+    });
 
-        ::av_packet_unref(&pkg);
-    }
+    // The constructor reserves room for very long files; give back what this one did not use
+    _pts.shrink_to_fit();
+    _pkt_durations.shrink_to_fit();
+    _pkt_sizes.shrink_to_fit();
+    _pkt_flags.shrink_to_fit();
 
     // Fallback: ensure we always have at least a starting keyframe at 0
     if (_i_frames.empty() && !_pts.empty()) {
@@ -141,8 +300,8 @@ void VideoDecoder::createMedia(std::string const & filename) {
         _i_frame_pts.push_back(static_cast<int64_t>(_pts[0]));
     }
 
-    _height = static_cast<int>(_media->streams[0]->codecpar->height);
-    _width = static_cast<int>(_media->streams[0]->codecpar->width);
+    _height = static_cast<int>(_videoStream()->codecpar->height);
+    _width = static_cast<int>(_videoStream()->codecpar->width);
 
     _frame_count = static_cast<int>(_pts.size());
     _last_decoded_frame = _frame_count > 0 ? _frame_count - 1 : 0;
@@ -151,12 +310,12 @@ void VideoDecoder::createMedia(std::string const & filename) {
         std::cout << "Frame number is " << _frame_count << std::endl;
 
         std::cout << "The start time is " << _getStartTime() << std::endl;
-        std::cout << "The stream start time is " << _media->streams[0]->start_time << std::endl;
+        std::cout << "The stream start time is " << _videoStream()->start_time << std::endl;
     if (!_pts.empty()) std::cout << "The first pts is " << _pts[0] << std::endl;
     if (_pts.size() > 1) std::cout << "The second pts is " << _pts[1] << std::endl;
     }
 
-    auto & track = _media->streams[0];
+    auto const * track = _videoStream();
 
     if (_verbose) {
         std::cout << "real_frame rate of stream " << track->r_frame_rate.num << " denom: " << track->r_frame_rate.den
@@ -164,8 +323,8 @@ void VideoDecoder::createMedia(std::string const & filename) {
     }
 
     //Future calculations with frame rate use 1 / fps, so we swap numerator and denominator here
-    _fps_num = _media->streams[0]->r_frame_rate.den;
-    _fps_denom = _media->streams[0]->r_frame_rate.num;
+    _fps_num = _videoStream()->r_frame_rate.den;
+    _fps_denom = _videoStream()->r_frame_rate.num;
     if (_fps_num == 0) _fps_num = 1;
     if (_fps_denom == 0) {
         constexpr int kDefaultFps = 30;
@@ -185,6 +344,9 @@ void VideoDecoder::createMedia(std::string const & filename) {
     _seekToFrame(0);
 
     _frame_buf->buildFrameBuffer(largest_diff);
+    // Every buffered frame holds a pooled AVFrame, plus the frame being decoded and the one being displayed
+    constexpr int kSparePooledFrames = 4;
+    _media.frame_pool.setCapacity(static_cast<size_t>(largest_diff + kSparePooledFrames));
 
     if (_verbose) {
         std::cout << "Buffer size set to " << largest_diff << std::endl;
@@ -209,23 +371,182 @@ int find_buffer_size(std::vector<T> & vec) {
 }
 
 std::vector<uint8_t> VideoDecoder::getFrame(int const desired_frame, bool isFrameByFrameMode) {
+    Region region;
+    if (!_outputRegion(region)) {
+        return {};// The media changed since setROI and the region is now outside it
+    }
+    return _getFrame(desired_frame, region);
+}
+
+std::vector<uint8_t> VideoDecoder::getFrameROI(int const desired_frame, int x, int y, int width, int height) {
+    Region region;
+    if (!_clipRegion(x, y, width, height, region)) {
+        std::cout << "Region " << width << "x" << height << "+" << x << "+" << y << " is outside the frame" << std::endl;
+        return {};
+    }
+    return _getFrame(desired_frame, region);
+}
+
+bool VideoDecoder::setROI(int x, int y, int width, int height) {
+    Region region;
+    if (!_clipRegion(x, y, width, height, region)) {
+        std::cout << "Region " << width << "x" << height << "+" << x << "+" << y << " is outside the frame" << std::endl;
+        return false;
+    }
+    _roi = region;
+    return true;
+}
+
+bool VideoDecoder::_isFullFrame(Region const & region) const {
+    return region.x == 0 && region.y == 0 && region.width == _width && region.height == _height;
+}
+
+bool VideoDecoder::_outputRegion(Region & region) const {
+    if (!hasROI()) {
+        region = _fullFrame();
+        return true;
+    }
+    return _clipRegion(_roi.x, _roi.y, _roi.width, _roi.height, region);
+}
+
+bool VideoDecoder::_clipRegion(int x, int y, int width, int height, Region & region) const {
+    int const left = std::max(x, 0);
+    int const top = std::max(y, 0);
+    int const right = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(x) + width, _width));
+    int const bottom = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(y) + height, _height));
+    if (right <= left || bottom <= top) {
+        return false;
+    }
+    region = Region{left, top, right - left, bottom - top};
+    return true;
+}
+
+std::vector<uint8_t> VideoDecoder::_getFrame(int desired_frame, Region const & region) {
+    trace::TraceScope const trace_scope("VideoDecoder::getFrame", "decoder", "frame", desired_frame);
+    ScopedLatency const request_timer(_stats.get_frame_latency);
+    _stats.frame_requests++;
+
     size_t const pixel_size = static_cast<size_t>(_getFormatBytes());
-    size_t const buf_size = static_cast<size_t>(_height) * static_cast<size_t>(_width) * pixel_size;
-    std::vector<uint8_t> output(buf_size);
+    size_t const buf_size = static_cast<size_t>(region.height) * static_cast<size_t>(region.width) * pixel_size;
 
     if (_pts.empty()) {
-        return output; // nothing to decode
+        return std::vector<uint8_t>(buf_size); // nothing to decode
     }
 
     int const clamped_desired = std::clamp(desired_frame, 0, static_cast<int>(_pts.size() - 1));
-    uint64_t const desired_frame_pts = _pts[static_cast<size_t>(clamped_desired)];
 
-    if (_frame_buf->isFrameInBuffer(clamped_desired)) {
-        auto frame = _frame_buf->getFrameFromBuffer(clamped_desired);
-        _convertFrameToOutputFormat(frame.get(), output);// Convert the frame to format to render
+    OutputCacheKey const output_key = _outputCacheKey(clamped_desired, region);
+    if (auto const cached = _output_cache.lookup(output_key)) {
+        _stats.output_cache_hits++;
+        return *cached;
+    }
+
+    std::vector<uint8_t> output(buf_size);
+    libav::AVFrame buffered_frame;
+    {
+        ScopedLatency const lookup_timer(_stats.cache_lookup_latency);
+        if (_frame_buf->isFrameInBuffer(clamped_desired)) {
+            buffered_frame = _frame_buf->getFrameFromBuffer(clamped_desired);
+        }
+    }
+    if (buffered_frame) {
+        _stats.cache_hits++;
+        _convertFrameToOutputFormatTimed(buffered_frame.get(), region, output);// Convert the frame to format to render
+        _storeOutput(output_key, output);
+        return output;
+    }
+    _stats.cache_misses++;
+
+    // The shared cache holds whole frames only
+    bool const use_frame_cache = _frame_cache && _isFullFrame(region);
+    if (use_frame_cache && _frame_cache->lookup(_frameCacheKey(clamped_desired), output)) {
+        if (output.size() == buf_size) {
+            _stats.frame_cache_hits++;
+            _storeOutput(output_key, output);
+            return output;
+        }
+        output.assign(buf_size, 0);// Stored by a decoder with another geometry; decode instead
+    }
+
+    if (_pipelined && _getFramePipelined(clamped_desired, region, output)) {
+        if (use_frame_cache) _frame_cache->store(_frameCacheKey(clamped_desired), output.data(), output.size());
+        _storeOutput(output_key, output);
         return output;
     }
 
+    auto const frame_to_display = _decodeFrame(clamped_desired);
+    if (frame_to_display) {
+        _convertFrameToOutputFormatTimed(frame_to_display.get(), region, output);
+        if (use_frame_cache) {
+            _frame_cache->store(_frameCacheKey(clamped_desired), output.data(), output.size());
+        }
+        _storeOutput(output_key, output);
+    }
+    return output;
+}
+
+std::shared_ptr<std::vector<uint8_t> const> VideoDecoder::getFrameShared(int desired_frame) {
+    Region region;
+    if (!_outputRegion(region) || _pts.empty()) {
+        return nullptr;
+    }
+    int const clamped_desired = std::clamp(desired_frame, 0, static_cast<int>(_pts.size() - 1));
+    OutputCacheKey const output_key = _outputCacheKey(clamped_desired, region);
+    if (auto cached = _output_cache.lookup(output_key)) {
+        _stats.frame_requests++;
+        _stats.output_cache_hits++;
+        return cached;
+    }
+
+    auto image = _getFrame(clamped_desired, region);
+    if (auto cached = _output_cache.lookup(output_key)) {
+        return cached;// The copy _getFrame stored
+    }
+    return std::make_shared<std::vector<uint8_t> const>(std::move(image));
+}
+
+void VideoDecoder::setOutputCacheBytes(size_t capacity_bytes) {
+    _output_cache.setCapacity(capacity_bytes);
+}
+
+OutputCacheKey VideoDecoder::_outputCacheKey(int frame, Region const & region) const {
+    return OutputCacheKey{frame, static_cast<int32_t>(_format), region.x, region.y, region.width, region.height};
+}
+
+void VideoDecoder::_storeOutput(OutputCacheKey const & key, std::vector<uint8_t> const & output) {
+    if (_output_cache.isEnabled()) {
+        _output_cache.store(key, std::make_shared<std::vector<uint8_t> const>(output));
+    }
+}
+
+libav::AVFrame VideoDecoder::_getDecodedFrame(int desired_frame) {
+    if (_pts.empty()) {
+        return libav::AVFrame();
+    }
+    int const clamped_desired = std::clamp(desired_frame, 0, static_cast<int>(_pts.size() - 1));
+
+    libav::AVFrame buffered_frame;
+    {
+        ScopedLatency const lookup_timer(_stats.cache_lookup_latency);
+        if (_frame_buf->isFrameInBuffer(clamped_desired)) {
+            buffered_frame = _frame_buf->getFrameFromBuffer(clamped_desired);
+        }
+    }
+    if (buffered_frame) {
+        _stats.cache_hits++;
+        return buffered_frame;
+    }
+    _stats.cache_misses++;
+    return _decodeFrame(clamped_desired);
+}
+
+/*
+Seek if needed and decode until clamped_desired comes out of the decoder. Every frame decoded on the way
+is added to the frame buffer.
+*/
+libav::AVFrame VideoDecoder::_decodeFrame(int clamped_desired) {
+    uint64_t const desired_frame_pts = _pts[static_cast<size_t>(clamped_desired)];
+
     bool seek_flag = false;
     int64_t const desired_nearest_iframe = nearest_iframe(clamped_desired);
 
@@ -235,7 +556,6 @@ std::vector<uint8_t> VideoDecoder::getFrame(int const desired_frame, bool isFram
     }
     if (cur_index < 0) cur_index = 0;
 
-    constexpr int kIframeSeekThreshold = 10;
     auto const distance_to_next_iframe = desired_nearest_iframe - cur_index;
     if (clamped_desired < cur_index || distance_to_next_iframe > kIframeSeekThreshold) {
         _seekToFrame(static_cast<int>(desired_nearest_iframe), clamped_desired == desired_nearest_iframe);
@@ -248,80 +568,76 @@ std::vector<uint8_t> VideoDecoder::getFrame(int const desired_frame, bool isFram
             pos = _findFrameByPts(static_cast<uint64_t>(_pkt.get()->pts));
         }
         if (pos != clamped_desired) {
-        ::av_packet_unref(_pkt.get());
-        ++(_pkt);
+            _nextPacket();
             // Skip non-video packets
-            while (_pkt.get() && _pkt.get()->stream_index != 0) {
-                ::av_packet_unref(_pkt.get());
-                ++(_pkt);
+            while (_pkt.get() && _pkt.get()->stream_index != _video_stream_index) {
+                _nextPacket();
             }
-    }
+        }
     }
 
 
     bool is_packet_decoded = false;
 
-    int frames_decoded = 0;
+    uint64_t frames_decoded = 0;
 
-    auto t1 = std::chrono::high_resolution_clock::now();
-
-    bool is_frame_to_display = false;
-    while (!is_frame_to_display) {
+    libav::AVFrame frame_to_display;
+    while (!frame_to_display) {
 
         is_packet_decoded = false;
 
         // Skip non-video or invalid-PTS packets before sending to decoder
-        while (_pkt.get() && (_pkt.get()->stream_index != 0 || _pkt.get()->pts == static_cast<int64_t>(AV_NOPTS_VALUE))) {
-            ::av_packet_unref(_pkt.get());
-            ++_pkt;
+        while (_pkt.get() && (_pkt.get()->stream_index != _video_stream_index || _pkt.get()->pts == static_cast<int64_t>(AV_NOPTS_VALUE))) {
+            _nextPacket();
         }
 
         if (!_pkt.get()) break;
 
-        libav::avcodec_send_packet(_media, _pkt.get(), [&](const libav::AVFrame &frame) {
-            // Tag buffered frames by the decoded frame PTS, not the packet PTS.
-            int idx = -1;
-            if (frame.get()) {
+        {
+            trace::TraceScope const decode_trace("avcodec_send_packet", "decoder");
+            ScopedLatency const decode_timer(_stats.decode_latency);
+            _stats.packets_sent++;
+            libav::avcodec_send_packet(_media, _pkt.get(), [&](const libav::AVFrame &frame) {
+                frames_decoded++;
+                // Tag buffered frames by the decoded frame PTS, not the packet PTS.
+                int idx = -1;
+                if (frame.get()) {
+                    int64_t ts = (frame.get()->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
+                                 ? frame.get()->best_effort_timestamp
+                                 : frame.get()->pts;
+                    if (ts != static_cast<int64_t>(AV_NOPTS_VALUE)) {
+                        idx = _findFrameByPts(static_cast<uint64_t>(ts));
+                    }
+                }
+                if (idx >= 0) {
+                    _frame_buf->addFrametoBuffer(frame, idx);
+                }
+                is_packet_decoded = true;
                 int64_t ts = (frame.get()->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
                              ? frame.get()->best_effort_timestamp
                              : frame.get()->pts;
-                if (ts != static_cast<int64_t>(AV_NOPTS_VALUE)) {
-                    idx = _findFrameByPts(static_cast<uint64_t>(ts));
+                if (ts == static_cast<int64_t>(desired_frame_pts)) {
+                    frame_to_display = frame;
                 }
-            }
-            if (idx >= 0) {
-                _frame_buf->addFrametoBuffer(frame, idx);
-            }
-            is_packet_decoded = true;
-            int64_t ts = (frame.get()->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
-                         ? frame.get()->best_effort_timestamp
-                         : frame.get()->pts;
-            if (ts == static_cast<int64_t>(desired_frame_pts)) {
-                is_frame_to_display = true;
-                _convertFrameToOutputFormat(frame.get(), output);
-            }
-        });
-        if ((!is_packet_decoded) || (!is_frame_to_display)) {
+            });
+        }
+        if ((!is_packet_decoded) || (!frame_to_display)) {
             if (_pkt.get()) {
-                ::av_packet_unref(_pkt.get());
+                _nextPacket();
             }
-            ++(_pkt);
             // Skip non-video packets
-            while (_pkt.get() && _pkt.get()->stream_index != 0) {
-                ::av_packet_unref(_pkt.get());
-                ++(_pkt);
+            while (_pkt.get() && _pkt.get()->stream_index != _video_stream_index) {
+                _nextPacket();
             }
             if (!_pkt.get()) {
                 // Reached end without finding frame; break to avoid infinite loop
                 break;
             }
         }
-        frames_decoded++;
     }
 
-    auto t2 = std::chrono::high_resolution_clock::now();
-
-    const std::chrono::duration<double> elapsed1 = t2 - t1;
+    _stats.frames_decoded += frames_decoded;
+    _stats.frames_decoded_per_request.record(frames_decoded);
 
     // 2/22/23 - Time results show decoding takes ~3ms a frame, which adds up if there are 100-200 frames to decode.
 
@@ -332,16 +648,284 @@ std::vector<uint8_t> VideoDecoder::getFrame(int const desired_frame, bool isFram
         }
         _last_decoded_frame = (idx >= 0) ? idx : clamped_desired;
     }
-    return output;
+
+    return frame_to_display;
 }
 
-void VideoDecoder::_convertFrameToOutputFormat(::AVFrame * frame, std::vector<uint8_t> & output) const {
-    switch (_format) {
+/*
+The schedule is decided packet by packet. pending counts wanted frames sent to the decoder but not yet
+out of it; packets are only skipped, or the decoder flushed by a seek, once it is zero, so frames held
+back for reordering are never lost. Afterwards the decoder is left at a keyframe, as after a seek, so
+the next getFrame starts from a clean state.
+*/
+int VideoDecoder::decodeSubsampled(int first_frame, int last_frame, int stride, FrameCallback const & on_frame) {
+    trace::TraceScope const trace_scope("VideoDecoder::decodeSubsampled", "decoder", "stride", stride);
+
+    if (_pts.empty() || stride < 1) {
+        return 0;
+    }
+    int const first = std::clamp(first_frame, 0, _frame_count - 1);
+    int const last = std::clamp(last_frame, 0, _frame_count - 1);
+    Region region;
+    if (last < first || !_outputRegion(region)) {
+        return 0;
+    }
+    auto const is_wanted = [first, last, stride](int64_t frame) {
+        return frame >= first && frame <= last && (frame - first) % stride == 0;
+    };
+    int const wanted_count = (last - first) / stride + 1;
+
+    std::vector<uint8_t> output(static_cast<size_t>(region.width) * static_cast<size_t>(region.height) *
+                                static_cast<size_t>(_getFormatBytes()));
+    int delivered = 0;
+    int pending = 0;
+    std::vector<bool> done(static_cast<size_t>(wanted_count));// A seek can land before frames already delivered
+    uint64_t frames_decoded = 0;
+    auto on_decoded = [&](libav::AVFrame const & frame) {
+        frames_decoded++;
+        int64_t const ts = (frame->best_effort_timestamp != static_cast<int64_t>(AV_NOPTS_VALUE))
+                                   ? frame->best_effort_timestamp
+                                   : frame->pts;
+        int64_t const idx = ts != static_cast<int64_t>(AV_NOPTS_VALUE) ? _findFrameByPts(static_cast<uint64_t>(ts)) : -1;
+        if (idx < 0 || !is_wanted(idx) || done[static_cast<size_t>((idx - first) / stride)]) {
+            return;
+        }
+        done[static_cast<size_t>((idx - first) / stride)] = true;
+        pending = std::max(pending - 1, 0);
+        _convertFrameToOutputFormatTimed(frame.get(), region, output);
+        on_frame(static_cast<int>(idx), output);
+        delivered++;
+    };
+
+    auto & codec_ctx = _media.open_streams[_video_stream_index];
+    int next_wanted = first;// First wanted frame whose packet has not been read yet
+    int64_t last_seek = nearest_iframe(first);
+    _seekToFrame(static_cast<int>(last_seek), true);
+
+    // Packets sent after the last wanted one, waiting for the decoder to release the frames it holds
+    constexpr int kReorderSlack = 64;
+    int sent_after_last = 0;
+
+    while (_pkt.get() && delivered < wanted_count) {
+        auto * pkt = _pkt.get();
+        if (pkt->stream_index != _video_stream_index || pkt->pts == static_cast<int64_t>(AV_NOPTS_VALUE)) {
+            _nextPacket();
+            continue;
+        }
+        int64_t const idx = _findFrameByPts(static_cast<uint64_t>(pkt->pts));
+        while (next_wanted <= last && next_wanted < idx) {
+            next_wanted += stride;
+        }
+
+        if (next_wanted > last) {
+            if (pending == 0 || ++sent_after_last > kReorderSlack) {
+                break;
+            }
+        } else if (pending == 0 && idx >= 0) {
+            // Nothing before the keyframe of the next wanted frame is needed
+            int64_t const key = nearest_iframe(next_wanted);
+            if (key > idx) {
+                if (key - idx > kIframeSeekThreshold && key != last_seek) {
+                    last_seek = key;
+                    _seekToFrame(static_cast<int>(key), true);
+                } else {
+                    _nextPacket();
+                }
+                continue;
+            }
+        }
+
+        bool const want = idx >= 0 && is_wanted(idx);
+        if (!want && (pkt->flags & AV_PKT_FLAG_DISPOSABLE)) {
+            _nextPacket();
+            continue;
+        }
+        codec_ctx->skip_frame = want ? AVDISCARD_DEFAULT : AVDISCARD_NONREF;
+        if (want) {
+            pending++;
+        }
+        {
+            trace::TraceScope const decode_trace("avcodec_send_packet", "decoder");
+            ScopedLatency const decode_timer(_stats.decode_latency);
+            _stats.packets_sent++;
+            libav::avcodec_send_packet(_media, pkt, on_decoded);
+        }
+        _nextPacket();
+    }
+    if (!_pkt.get() && pending > 0) {
+        libav::flush_decoder(_media, on_decoded, _video_stream_index);
+    }
+
+    codec_ctx->skip_frame = AVDISCARD_DEFAULT;
+    _stats.frames_decoded += frames_decoded;
+    _seekToFrame(static_cast<int>(nearest_iframe(last)), true);
+    return delivered;
+}
+
+FrameCacheKey VideoDecoder::_frameCacheKey(int frame) const {
+    FrameCacheKey key;
+    key.file_id = _file_id;
+    key.stream = _video_stream_index;
+    key.frame = frame;
+    key.format = static_cast<int32_t>(_format);
+    return key;
+}
+
+/*
+Pipelined counterpart of the decode loop in getFrame. The pipeline is restarted at the keyframe before
+the request when the request goes backwards or far enough forwards that seeking beats decoding through.
+Frames before the request are added to the frame buffer as they go past, exactly like the serial path.
+
+Returns false if the pipeline could not deliver the frame, in which case getFrame falls back to serial
+decoding.
+*/
+bool VideoDecoder::_getFramePipelined(int desired_frame, Region const & region, std::vector<uint8_t> & output) {
+    trace::TraceScope const trace_scope("VideoDecoder::_getFramePipelined", "decoder", "frame", desired_frame);
+
+    int64_t const keyframe = nearest_iframe(desired_frame);
+    bool const restart = !_pipeline || _pipeline->finished() || desired_frame < _pipeline_next_frame ||
+                         (keyframe > _pipeline_next_frame && keyframe - _pipeline_next_frame > kIframeSeekThreshold);
+
+    if (restart) {
+        ScopedLatency const seek_timer(_stats.seek_latency);
+        _stats.seeks++;
+        if (!_pipeline) {
+            size_t const image_size = static_cast<size_t>(_width) * static_cast<size_t>(_height) *
+                                      static_cast<size_t>(_getFormatBytes());
+            // The convert thread gets its own copy of the format and geometry the images were sized for
+            _pipeline = std::make_unique<DecodePipeline>(
+                    _filename, _video_stream_index,
+                    [this, format = _format, region = _fullFrame()](::AVFrame * frame, std::vector<uint8_t> & image) {
+                        _convertFrameToOutputFormat(frame, region, format, image);
+                    },
+                    image_size);
+        }
+        if (!_pipeline->start(static_cast<int64_t>(_pts[static_cast<size_t>(keyframe)]),
+                              static_cast<int64_t>(_pts[static_cast<size_t>(desired_frame)]))) {
+            _pipeline.reset();
+            return false;
+        }
+        _pipeline_next_frame = keyframe;
+    }
+
+    // With B-frames, presentation order and our packet order indices differ, so allow some slack
+    // before deciding the frame is not coming
+    constexpr int64_t kSearchSlack = 64;
+    int64_t const max_frames = std::max<int64_t>(desired_frame - _pipeline_next_frame, 0) + kSearchSlack;
+
+    uint64_t frames_decoded = 0;
+    bool found = false;
+    DecodePipeline::Output item;
+    while (frames_decoded < static_cast<uint64_t>(max_frames) && _pipeline->next(item)) {
+        frames_decoded++;
+        int64_t const idx = _findFrameByPts(static_cast<uint64_t>(item.pts));
+        if (idx < 0) continue;
+
+        _frame_buf->addFrametoBuffer(item.frame, static_cast<int>(idx));
+        _pipeline_next_frame = idx + 1;
+
+        if (idx == desired_frame) {
+            // The pipeline converts whole frames; a region is cut from the decoded frame instead
+            if (_isFullFrame(region) && item.image.size() == output.size()) {
+                output.swap(item.image);
+                _stats.frames_converted++;
+            } else {
+                _convertFrameToOutputFormatTimed(item.frame.get(), region, output);
+            }
+            found = true;
+            break;
+        }
+    }
+
+    _stats.frames_decoded += frames_decoded;
+    _stats.frames_decoded_per_request.record(frames_decoded);
+
+    if (!found) {
+        _pipeline.reset();
+        return false;
+    }
+    _last_decoded_frame = desired_frame;
+    return true;
+}
+
+void VideoDecoder::_nextPacket() {
+    if (!_pkt) return;
+    ScopedLatency const demux_timer(_stats.demux_latency);
+    ::av_packet_unref(_pkt.get());
+    ++_pkt;
+    if (_pkt.get()) {
+        _stats.packets_read++;
+    }
+}
+
+void VideoDecoder::_convertFrameToOutputFormatTimed(::AVFrame * frame, Region const & region, std::vector<uint8_t> & output) {
+    ScopedLatency const conversion_timer(_stats.conversion_latency);
+    _convertFrameToOutputFormat(frame, region, output);
+    _stats.frames_converted++;
+}
+
+/*
+A new reference to a rectangle of frame. The buffers are shared: av_frame_apply_cropping only moves the
+plane pointers and shrinks the size, so converting the result touches nothing outside the rectangle.
+Returns nullptr if the frame cannot be cropped that way (hardware frames).
+*/
+static libav::AVFrame crop_frame(::AVFrame const * frame, int x, int y, int width, int height) {
+    if (x + width > frame->width || y + height > frame->height) {
+        return nullptr;
+    }
+    auto view = libav::av_frame_clone(frame);
+    if (!view) {
+        return nullptr;
+    }
+    view->crop_left = static_cast<size_t>(x);
+    view->crop_top = static_cast<size_t>(y);
+    view->crop_right = static_cast<size_t>(frame->width - x - width);
+    view->crop_bottom = static_cast<size_t>(frame->height - y - height);
+    if (::av_frame_apply_cropping(view.get(), AV_FRAME_CROP_UNALIGNED) < 0 || view->width != width ||
+        view->height != height) {
+        return nullptr;
+    }
+    return view;
+}
+
+void VideoDecoder::convertFrame(::AVFrame * frame, std::vector<uint8_t> & output) const {
+    output.resize(static_cast<size_t>(frame->width) * static_cast<size_t>(frame->height) *
+                  static_cast<size_t>(_getFormatBytes()));
+    _convertFrameToOutputFormat(frame, Region{0, 0, frame->width, frame->height}, output);
+}
+
+void VideoDecoder::_convertFrameToOutputFormat(::AVFrame * frame, Region const & region, std::vector<uint8_t> & output) const {
+    _convertFrameToOutputFormat(frame, region, _format, output);
+}
+
+void VideoDecoder::_convertFrameToOutputFormat(::AVFrame * frame, Region const & region, OutputFormat format,
+                                               std::vector<uint8_t> & output) const {
+    trace::TraceScope const trace_scope("VideoDecoder::_convertFrameToOutputFormat", "decoder");
+
+    // A region covering the whole frame needs no crop, whatever the size of the loaded video
+    bool const whole_frame = region.x == 0 && region.y == 0 && region.width == frame->width && region.height == frame->height;
+    libav::AVFrame cropped;
+    if (!_isFullFrame(region) && !whole_frame) {
+        cropped = crop_frame(frame, region.x, region.y, region.width, region.height);
+        if (!cropped) {
+            std::cout << "Could not crop frame to region" << std::endl;
+            return;
+        }
+        frame = cropped.get();
+    }
+
+    switch (format) {
         case OutputFormat::Gray8:
-            _togray8(frame, output);
+            _togray8(frame, region.width, region.height, output);
             break;
         case OutputFormat::ARGB:
-            _torgb32(frame, output);
+            _torgb32(frame, region.width, region.height, output);
+            break;
+        case OutputFormat::Gray16:
+            _togray16(frame, region.width, region.height, output);
+            break;
+        case OutputFormat::RGB48:
+            _torgb48(frame, region.width, region.height, output);
             break;
         default:
             std::cout << "Output not supported" << std::endl;
@@ -354,6 +938,10 @@ int VideoDecoder::_getFormatBytes() const {
             return 1;
         case OutputFormat::ARGB:
             return 4;
+        case OutputFormat::Gray16:
+            return 2;
+        case OutputFormat::RGB48:
+            return 6;
         default:
             return 1;
     }
@@ -372,62 +960,335 @@ static inline void copy_plane(uint8_t * dst, int dst_stride,
     }
 }
 
-void VideoDecoder::_togray8(::AVFrame * frame, std::vector<uint8_t> & output) const {
+/*
+Direct conversion paths.
+
+A pixel format qualifies when the components we need sit one sample per pixel in their own plane, in
+native-endian 8 or 16 bit containers. That covers the gray formats, every planar YUV format, the luma of
+NV12/P010-style semi-planar formats, and planar RGB (GBRP*). Those samples are copied or rescaled
+without going through swscale. Everything else falls back to libav::convert_frame.
+*/
+static bool host_is_big_endian() {
+    uint16_t const probe = 1;
+    uint8_t first;
+    std::memcpy(&first, &probe, 1);
+    return first == 0;
+}
+
+static bool is_direct_component(AVPixFmtDescriptor const * desc, int c) {
+    auto const & comp = desc->comp[c];
+    int const container = comp.depth > 8 ? 2 : 1;
+    return comp.depth >= 8 && comp.depth <= 16 && comp.step == container && comp.offset == 0 &&
+           comp.shift + comp.depth <= 8 * container;
+}
+
+static AVPixFmtDescriptor const * direct_planar_descriptor(int format) {
+    auto const * desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(format));
+    if (!desc) return nullptr;
+    if (desc->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_FLOAT)) {
+        return nullptr;
+    }
+    bool const big_endian = (desc->flags & AV_PIX_FMT_FLAG_BE) != 0;
+    if (desc->comp[0].depth > 8 && big_endian != host_is_big_endian()) {
+        return nullptr;
+    }
+    return desc;
+}
+
+/*
+Scale one row of depth-bit samples (stored shifted left by shift) to 16 bits, writing every dst_step-th
+uint16. Full range uses bit replication, so 0 and the maximum code map exactly to 0 and 65535. Limited
+range maps black..white (16..235 scaled to depth) onto 0..65535. Both loops are branch free so the
+compiler can vectorize them.
+*/
+template<typename Sample>
+static void scale_row_to16(uint16_t * __restrict dst, size_t dst_step, Sample const * __restrict src, int width,
+                           int depth, int shift, bool full_range) {
+    if (full_range) {
+        int const up = 16 - depth;
+        int const down = std::max(2 * depth - 16, 0);
+        for (int x = 0; x < width; ++x) {
+            uint32_t const v = static_cast<uint32_t>(src[x]) >> shift;
+            dst[static_cast<size_t>(x) * dst_step] = static_cast<uint16_t>((v << up) | (v >> down));
+        }
+        return;
+    }
+    float const black = static_cast<float>(16 << (depth - 8));
+    float const scale = 65535.0f / static_cast<float>(219 << (depth - 8));
+    for (int x = 0; x < width; ++x) {
+        float const v = static_cast<float>(static_cast<uint32_t>(src[x]) >> shift);
+        float const scaled = std::min(std::max((v - black) * scale + 0.5f, 0.0f), 65535.0f);
+        dst[static_cast<size_t>(x) * dst_step] = static_cast<uint16_t>(scaled);
+    }
+}
+
+static void scale_plane_to16(uint16_t * dst, size_t dst_step, size_t dst_row_stride, ::AVFrame const * frame,
+                             AVPixFmtDescriptor const * desc, int c, int width, int height, bool full_range) {
+    auto const & comp = desc->comp[c];
+    uint8_t const * plane = frame->data[comp.plane];
+    int const stride = frame->linesize[comp.plane];
+    for (int y = 0; y < height; ++y) {
+        uint8_t const * row = plane + static_cast<ptrdiff_t>(y) * stride;
+        uint16_t * drow = dst + static_cast<size_t>(y) * dst_row_stride;
+        if (comp.depth > 8) {
+            scale_row_to16(drow, dst_step, reinterpret_cast<uint16_t const *>(row), width, comp.depth, comp.shift, full_range);
+        } else {
+            scale_row_to16(drow, dst_step, row, width, comp.depth, comp.shift, full_range);
+        }
+    }
+}
+
+void VideoDecoder::_togray8(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const {
     // Output is WxH, 1 byte per pixel
     uint8_t * dst = output.data();
-    int const dst_stride = _width; // tightly packed GRAY8
+    int const dst_stride = width; // tightly packed GRAY8
 
-    if (frame->format == AV_PIX_FMT_YUV420P) {
-        // Fast path: start from the luma plane; expand range if source is limited (MPEG) range
+    // Gray, planar and semi-planar YUV: the luma plane is the image
+    auto const * desc = direct_planar_descriptor(frame->format);
+    if (desc && !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->comp[0].plane == 0 && is_direct_component(desc, 0)) {
+        auto const & luma = desc->comp[0];
         uint8_t const * srcY = frame->data[0];
-        int const src_stride = std::abs(frame->linesize[0]);
-
-        // Detect color range; default to limited if unspecified
-        int const range = frame->color_range;
-        bool const is_full_range = (range == AVCOL_RANGE_JPEG);
+        int const src_stride = frame->linesize[0];
+        bool const full_range = is_full_range(frame, desc);
 
-        if (is_full_range) {
-            // Full range already in 0..255
-            copy_plane(dst, dst_stride, srcY, src_stride, _width /*bytes*/, _height);
+        if (luma.depth == 8) {
+            if (full_range) {
+                copy_plane(dst, dst_stride, srcY, src_stride, width /*bytes*/, height);
+                return;
+            }
+            for (int y = 0; y < height; ++y) {
+                uint8_t const * srow = srcY + static_cast<ptrdiff_t>(y) * src_stride;
+                uint8_t * drow = dst + y * dst_stride;
+                for (int x = 0; x < width; ++x) {
+                    drow[x] = kLimitedToFullRange[srow[x]];
+                }
+            }
             return;
         }
 
-        // Limited range (typically 16..235). Expand to full range: (Y-16) * 255 / 219
-        for (int y = 0; y < _height; ++y) {
-            uint8_t const * srow = srcY + y * src_stride;
+        // High bit depth: keep the top 8 bits, expanding limited range on the way
+        int const drop = luma.shift + luma.depth - 8;
+        int const black = 16 << (luma.depth - 8);
+        int const span = 219 << (luma.depth - 8);
+        for (int y = 0; y < height; ++y) {
+            auto const * srow = reinterpret_cast<uint16_t const *>(srcY + static_cast<ptrdiff_t>(y) * src_stride);
             uint8_t * drow = dst + y * dst_stride;
-            for (int x = 0; x < _width; ++x) {
-                int v = static_cast<int>(srow[x]) - 16;
-                if (v < 0) v = 0;
-                // scale by 255/219 with rounding
-                int scaled = (v * 255 + 109) / 219;
-                if (scaled < 0) scaled = 0;
-                if (scaled > 255) scaled = 255;
-                drow[x] = static_cast<uint8_t>(scaled);
+            if (full_range) {
+                for (int x = 0; x < width; ++x) {
+                    drow[x] = static_cast<uint8_t>(srow[x] >> drop);
+                }
+            } else {
+                for (int x = 0; x < width; ++x) {
+                    int const v = std::max((srow[x] >> luma.shift) - black, 0);
+                    drow[x] = static_cast<uint8_t>(std::min((v * 255 + span / 2) / span, 255));
+                }
             }
         }
         return;
     }
 
-    // Fallback: use libav conversion to GRAY8 (handles other formats and range correctly)
-    auto gray = libav::convert_frame(frame, _width, _height, AV_PIX_FMT_GRAY8);
+    // Fallback: use libav conversion to GRAY8 (packed YUV, RGB and other formats)
+    auto gray = libav::convert_frame(frame, width, height, AV_PIX_FMT_GRAY8);
     uint8_t const * src = gray->data[0];
     int const src_stride = std::abs(gray->linesize[0]);
-    copy_plane(dst, dst_stride, src, src_stride, _width /*bytes*/, _height);
+    copy_plane(dst, dst_stride, src, src_stride, width /*bytes*/, height);
 }
 
-void VideoDecoder::_torgb32(::AVFrame * frame, std::vector<uint8_t> & output) const {
+void VideoDecoder::_torgb32(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const {
     // Output is WxH, 4 bytes per pixel (RGBA)
-    auto rgba = libav::convert_frame(frame, _width, _height, AV_PIX_FMT_RGBA);
+    auto rgba = libav::convert_frame(frame, width, height, AV_PIX_FMT_RGBA);
 
     uint8_t * dst = output.data();
     int const bpp = 4;
-    int const dst_stride = _width * bpp;
+    int const dst_stride = width * bpp;
 
     uint8_t const * src = rgba->data[0];
     int const src_stride = std::abs(rgba->linesize[0]);
 
-    copy_plane(dst, dst_stride, src, src_stride, _width * bpp, _height);
+    copy_plane(dst, dst_stride, src, src_stride, width * bpp, height);
+}
+
+void VideoDecoder::_togray16(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const {
+    // Output is WxH, 2 bytes per pixel
+    auto * dst = reinterpret_cast<uint16_t *>(output.data());
+
+    auto const * desc = direct_planar_descriptor(frame->format);
+    if (desc && !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->comp[0].plane == 0 && is_direct_component(desc, 0)) {
+        scale_plane_to16(dst, 1, static_cast<size_t>(width), frame, desc, 0, width, height, is_full_range(frame, desc));
+        return;
+    }
+
+    auto gray = libav::convert_frame(frame, width, height, AV_PIX_FMT_GRAY16);
+    copy_plane(output.data(), width * 2, gray->data[0], std::abs(gray->linesize[0]), width * 2, height);
+}
+
+void VideoDecoder::_torgb48(::AVFrame * frame, int width, int height, std::vector<uint8_t> & output) const {
+    // Output is WxH, 6 bytes per pixel (R, G, B)
+    auto * dst = reinterpret_cast<uint16_t *>(output.data());
+    size_t const row_stride = static_cast<size_t>(width) * 3;
+
+    auto const * desc = direct_planar_descriptor(frame->format);
+    if (desc && (desc->flags & AV_PIX_FMT_FLAG_RGB) && (desc->flags & AV_PIX_FMT_FLAG_PLANAR) &&
+        is_direct_component(desc, 0) && is_direct_component(desc, 1) && is_direct_component(desc, 2)) {
+        // Planar RGB: interleave the three planes
+        bool const full_range = is_full_range(frame, desc);
+        for (int c = 0; c < 3; ++c) {
+            scale_plane_to16(dst + c, 3, row_stride, frame, desc, c, width, height, full_range);
+        }
+        return;
+    }
+    if (desc && !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->nb_components <= 2 && is_direct_component(desc, 0)) {
+        // Gray: the same value in every channel
+        bool const full_range = is_full_range(frame, desc);
+        for (int c = 0; c < 3; ++c) {
+            scale_plane_to16(dst + c, 3, row_stride, frame, desc, 0, width, height, full_range);
+        }
+        return;
+    }
+
+    // YUV needs a color matrix, which swscale applies at full 16 bit precision
+    auto rgb = libav::convert_frame(frame, width, height, AV_PIX_FMT_RGB48);
+    copy_plane(output.data(), width * 6, rgb->data[0], std::abs(rgb->linesize[0]), width * 6, height);
+}
+
+void VideoDecoder::SwsContextDeleter::operator()(::SwsContext * context) const {
+    ::sws_freeContext(context);
+}
+
+size_t VideoDecoder::tensorFrameBytes(TensorOptions const & options) const {
+    size_t const width = static_cast<size_t>(options.width > 0 ? options.width : _width);
+    size_t const height = static_cast<size_t>(options.height > 0 ? options.height : _height);
+    return width * height * static_cast<size_t>(options.channels) * tensorElementBytes(options.type);
+}
+
+bool VideoDecoder::getFrameTensor(int frame, TensorOptions const & options, void * dst) {
+    trace::TraceScope const trace_scope("VideoDecoder::getFrameTensor", "decoder", "frame", frame);
+    ScopedLatency const request_timer(_stats.get_frame_latency);
+    _stats.frame_requests++;
+
+    if (options.channels != 1 && options.channels != 3) {
+        std::cout << "Tensors must have 1 or 3 channels, not " << options.channels << std::endl;
+        return false;
+    }
+    auto decoded = _getDecodedFrame(frame);
+    if (!decoded) {
+        return false;
+    }
+    ScopedLatency const conversion_timer(_stats.conversion_latency);
+    _stats.frames_converted++;
+    return _convertFrameToTensor(decoded.get(), options, dst);
+}
+
+int VideoDecoder::getTensorBatch(int first_frame, int count, TensorOptions const & options, void * dst) {
+    size_t const frame_bytes = tensorFrameBytes(options);
+    int const last = std::min(first_frame + count, _frame_count);
+    int written = 0;
+    for (int frame = std::max(first_frame, 0); frame < last; ++frame) {
+        if (!getFrameTensor(frame, options, static_cast<uint8_t *>(dst) + static_cast<size_t>(written) * frame_bytes)) {
+            break;
+        }
+        written++;
+    }
+    return written;
+}
+
+bool VideoDecoder::_convertFrameToTensor(::AVFrame * frame, TensorOptions const & options, void * dst) {
+    int const out_width = options.width > 0 ? options.width : _width;
+    int const out_height = options.height > 0 ? options.height : _height;
+    bool const resize = out_width != frame->width || out_height != frame->height;
+    auto const * desc = direct_planar_descriptor(frame->format);
+
+    if (options.channels == 1) {
+        float const std_dev = options.std[0];
+        float const mean = options.mean[0];
+
+        if (!resize && desc && !(desc->flags & AV_PIX_FMT_FLAG_RGB) && desc->comp[0].plane == 0 &&
+            is_direct_component(desc, 0)) {
+            // Straight from the luma plane, with range expansion and the sample shift folded into scale and bias.
+            // Limited range values outside black and white are clamped, as Gray8 clamps them.
+            auto const & luma = desc->comp[0];
+            bool const full_range = is_full_range(frame, desc);
+            float const black = full_range ? 0.0f : static_cast<float>(16 << (luma.depth - 8));
+            float const span = full_range ? static_cast<float>((1 << luma.depth) - 1)
+                                          : static_cast<float>(219 << (luma.depth - 8));
+            float const scale = 1.0f / (span * static_cast<float>(1 << luma.shift) * std_dev);
+            float const bias = (-black / span - mean) / std_dev;
+            float const zero = -mean / std_dev;
+            float const one = (1.0f - mean) / std_dev;
+            float const low = std::min(zero, one);
+            float const high = std::max(zero, one);
+            if (luma.depth > 8) {
+                packTensorChannel(reinterpret_cast<uint16_t const *>(frame->data[0]), frame->linesize[0], 1,
+                                  out_width, out_height, scale, bias, 0, options, dst, low, high);
+            } else {
+                packTensorChannel(frame->data[0], frame->linesize[0], 1, out_width, out_height, scale, bias, 0, options,
+                                  dst, low, high);
+            }
+            return true;
+        }
+
+        // Otherwise start from the Gray8 image, which handles every other source format
+        std::vector<uint8_t> gray(static_cast<size_t>(_width) * static_cast<size_t>(_height));
+        _togray8(frame, _width, _height, gray);
+        uint8_t const * src = gray.data();
+        int stride = _width;
+        if (resize) {
+            uint8_t const * const gray_data[4] = {gray.data(), nullptr, nullptr, nullptr};
+            int const gray_linesize[4] = {_width, 0, 0, 0};
+            src = _scaleForTensor(gray_data, gray_linesize, _width, _height, AV_PIX_FMT_GRAY8, AV_PIX_FMT_GRAY8,
+                                  out_width, out_height, 1);
+            if (!src) {
+                return false;
+            }
+            stride = out_width;
+        }
+        packTensorChannel(src, stride, 1, out_width, out_height, 1.0f / (255.0f * std_dev), -mean / std_dev, 0, options, dst);
+        return true;
+    }
+
+    // RGB: one swscale pass does the color matrix and any resize. Deep sources keep 16 bits per channel.
+    bool const deep = desc && desc->comp[0].depth > 8;
+    int const bytes_per_pixel = deep ? 6 : 3;
+    uint8_t const * rgb = _scaleForTensor(frame->data, frame->linesize, frame->width, frame->height,
+                                          static_cast<::AVPixelFormat>(frame->format),
+                                          deep ? AV_PIX_FMT_RGB48 : AV_PIX_FMT_RGB24, out_width, out_height, bytes_per_pixel);
+    if (!rgb) {
+        return false;
+    }
+    int const stride = out_width * bytes_per_pixel;
+    float const max_value = deep ? 65535.0f : 255.0f;
+    for (int c = 0; c < 3; ++c) {
+        float const scale = 1.0f / (max_value * options.std[static_cast<size_t>(c)]);
+        float const bias = -options.mean[static_cast<size_t>(c)] / options.std[static_cast<size_t>(c)];
+        if (deep) {
+            packTensorChannel(reinterpret_cast<uint16_t const *>(rgb) + c, stride, 3, out_width, out_height, scale, bias, c,
+                              options, dst);
+        } else {
+            packTensorChannel(rgb + c, stride, 3, out_width, out_height, scale, bias, c, options, dst);
+        }
+    }
+    return true;
+}
+
+uint8_t const * VideoDecoder::_scaleForTensor(uint8_t const * const src_data[], int const src_linesize[], int src_width,
+                                              int src_height, ::AVPixelFormat src_format, ::AVPixelFormat dst_format,
+                                              int dst_width, int dst_height, int bytes_per_pixel) {
+    // sws_getCachedContext returns the same context while the parameters are unchanged
+    _tensor_sws.reset(::sws_getCachedContext(_tensor_sws.release(), src_width, src_height, src_format, dst_width,
+                                             dst_height, dst_format, SWS_BILINEAR, nullptr, nullptr, nullptr));
+    if (!_tensor_sws) {
+        std::cout << "Could not convert " << src_width << "x" << src_height << " " << av_get_pix_fmt_name(src_format)
+                  << " frames to " << dst_width << "x" << dst_height << " " << av_get_pix_fmt_name(dst_format)
+                  << " for a tensor" << std::endl;
+        return nullptr;
+    }
+
+    int const dst_stride = dst_width * bytes_per_pixel;
+    _tensor_scratch.resize(static_cast<size_t>(dst_stride) * static_cast<size_t>(dst_height));
+    uint8_t * const dst_data[4] = {_tensor_scratch.data(), nullptr, nullptr, nullptr};
+    int const dst_linesize[4] = {dst_stride, 0, 0, 0};
+    ::sws_scale(_tensor_sws.get(), src_data, src_linesize, 0, src_height, dst_data, dst_linesize);
+    return _tensor_scratch.data();
 }
 
 int64_t VideoDecoder::nearest_iframe(int64_t frame_id) {
@@ -453,6 +1314,9 @@ int64_t VideoDecoder::nearest_iframe(int64_t frame_id) {
 }
 
 void VideoDecoder::_seekToFrame(int const frame, bool keyframe) {
+    trace::TraceScope const trace_scope("VideoDecoder::_seekToFrame", "decoder", "frame", frame);
+    ScopedLatency const seek_timer(_stats.seek_latency);
+    _stats.seeks++;
 
     //https://ffmpeg.org/doxygen/trunk/group__lavf__decoding.html
     //stream_index	If stream_index is (-1), a default stream is selected, and timestamp is automatically converted from AV_TIME_BASE units to the stream specific time_base.
@@ -464,30 +1328,30 @@ void VideoDecoder::_seekToFrame(int const frame, bool keyframe) {
 
     //flush_decoder(_media, _pkt->stream_index);
     //_pkt.reset(); // Does this flush buffers?
-    // Always flush the video stream decoder (assumed stream index 0)
-    auto codecCtx = _media.open_streams.find(0);
+    // Always flush the video stream decoder
+    auto codecCtx = _media.open_streams.find(_video_stream_index);
     if (codecCtx != _media.open_streams.end()) {
         codecCtx->second.flush_buffers();
     }
 
     const libav::flicks time = libav::av_rescale(frame,
-                                           {_media->streams[0]->r_frame_rate.den,
-                                            _media->streams[0]->r_frame_rate.num});
+                                           {_videoStream()->r_frame_rate.den,
+                                            _videoStream()->r_frame_rate.num});
 
     if (keyframe) {
-    const libav::flicks adjust = libav::av_rescale(_media->streams[0]->start_time, {_media->streams[0]->time_base.num,
-                                                                                  _media->streams[0]->time_base.den});
+    const libav::flicks adjust = libav::av_rescale(_videoStream()->start_time, {_videoStream()->time_base.num,
+                                                                                  _videoStream()->time_base.den});
     const libav::flicks time2 = time + adjust;
         //libav::flicks time2 = time;
         //libav::av_seek_frame(media,time2,-1,AVSEEK_FLAG_ANY);
-        libav::av_seek_frame(_media, time2, -1, AVSEEK_FLAG_BACKWARD);
+        libav::av_seek_frame(_media, time2, _video_stream_index, AVSEEK_FLAG_BACKWARD);
 
     _pkt = std::move(
         _media.begin());// After we seek to a frame, this will read frame, followed by rescaling to appropriate time scale.
+    if (_pkt) _stats.packets_read++;
     // Advance to first key video packet for a clean decoder state
-    while (_pkt.get() && (_pkt.get()->stream_index != 0 || !(_pkt.get()->flags & AV_PKT_FLAG_KEY))) {
-        ::av_packet_unref(_pkt.get());
-        ++_pkt;
+    while (_pkt.get() && (_pkt.get()->stream_index != _video_stream_index || !(_pkt.get()->flags & AV_PKT_FLAG_KEY))) {
+        _nextPacket();
     }
 
         if (_verbose) {
@@ -499,13 +1363,13 @@ void VideoDecoder::_seekToFrame(int const frame, bool keyframe) {
         }
 
     } else {
-        libav::av_seek_frame(_media, time, -1, AVSEEK_FLAG_BACKWARD);
+        libav::av_seek_frame(_media, time, _video_stream_index, AVSEEK_FLAG_BACKWARD);
 
         _pkt = std::move(_media.begin());
+        if (_pkt) _stats.packets_read++;
         // Advance to first video packet
-        while (_pkt.get() && _pkt.get()->stream_index != 0) {
-            ::av_packet_unref(_pkt.get());
-            ++_pkt;
+        while (_pkt.get() && _pkt.get()->stream_index != _video_stream_index) {
+            _nextPacket();
         }
     }
 
@@ -1,6 +1,7 @@
 #include "videoencoder.h"
 
 #include "libavinc/libavinc.hpp"
+#include "trace.h"
 
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
@@ -51,8 +52,13 @@ void VideoEncoder::createContext(int width, int height, int fps) {
         auto mycodecCtx = libav::make_encode_context_nvenc(_media, _width, _height, _fps);
         _codecCtx = std::move(mycodecCtx);
     } else {
-        //If software - TODO
-        std::cout << "Software encoding not supported at this time" << std::endl;
+        ::AVRational const time_base = (_time_base.den > 0) ? _time_base : ::AVRational{1, _fps};
+        if (_encoder_name == "h264_nvenc") {
+            _encoder_name = "libx264";
+        }
+        auto mycodecCtx = libav::make_encode_context_software(_media, _encoder_name, _width, _height, _fps,
+                                                              time_base, _gop_size, _max_b_frames, _encoder_options);
+        _codecCtx = std::move(mycodecCtx);
     }
 
     _frame_count = 0;//Reset frame count to zero
@@ -66,6 +72,32 @@ void VideoEncoder::set_pixel_format(INPUT_PIXEL_FORMAT pixel_fmt) {
     _frame->width = _width;
     _frame->height = _height;
 
+    if (!_hardware_encode) {
+        switch (pixel_fmt) {
+            case (NV12):
+                _frame->format = libav::AV_PIX_FMT_NV12;
+                break;
+            case (GRAY8):
+                _frame->format = libav::AV_PIX_FMT_GRAY8;
+                break;
+            case (RGB0):
+                _frame->format = libav::AV_PIX_FMT_RGB0;
+                break;
+            default:
+                break;
+        }
+        ::av_frame_get_buffer(_frame.get(), 32);
+
+        if (_codecCtx) {
+            _frame_encode = libav::av_frame_alloc();
+            _frame_encode->format = _codecCtx->pix_fmt;
+            _frame_encode->width = _width;
+            _frame_encode->height = _height;
+            ::av_frame_get_buffer(_frame_encode.get(), 32);
+        }
+        return;
+    }
+
     switch (pixel_fmt) {
         case (NV12):
             libav::bind_hardware_frames_context_nvenc(_codecCtx, _width, _height, libav::AV_PIX_FMT_NV12);
@@ -103,42 +135,103 @@ void VideoEncoder::closeFile() {
     ::avio_closep(&_media->pb);
 }
 
+void VideoEncoder::enterDrainMode() {
+    if (_flush_state) {
+        return;
+    }
+    _flush_state = true;
+    if (_hardware_encode) {
+        libav::encode_enter_drain_mode(_media, _codecCtx);
+    } else if (_codecCtx) {
+        // Software encoders are drained in one go, so every remaining packet is written before closeFile
+        libav::software_encode(_media, _codecCtx, nullptr);
+    }
+}
+
 int VideoEncoder::writeFrameGray8(std::vector<uint8_t> & input_data) {
+    return writeFrameGray8(input_data, _frame_count);
+}
+
+int VideoEncoder::writeFrameGray8(std::vector<uint8_t> & input_data, int64_t pts) {
+    trace::TraceScope const trace_scope("VideoEncoder::writeFrameGray8", "encoder", "frame", _frame_count);
+
+    if (!_hardware_encode) {
+        if (_flush_state || !_codecCtx || !_frame_encode) {
+            return 0;
+        }
+        ::av_frame_make_writable(_frame.get());
+        for (int y = 0; y < _height; ++y) {
+            std::memcpy(_frame->data[0] + y * _frame->linesize[0], input_data.data() + y * _width, _width);
+        }
+
+        {
+            trace::TraceScope const convert_trace("convert_frame", "encoder");
+            // The encoder may still hold a reference to the previous frame (lookahead, B-frames)
+            ::av_frame_make_writable(_frame_encode.get());
+            libav::convert_frame(_frame, _frame_encode);
+        }
+        _frame_encode->pts = pts;
+
+        trace::TraceScope const encode_trace("software_encode", "encoder");
+        int const err = libav::software_encode(_media, _codecCtx, _frame_encode.get());
+        _frame_count++;
+        return err;
+    }
 
     int write_frame_err;
     if (!_flush_state) {
         ::av_frame_make_writable(_frame.get());
         std::memcpy(_frame->data[0], input_data.data(), _height * _width);
 
-        auto t1 = std::chrono::high_resolution_clock::now();
-        //libav::AVFrame nvframe = libav::convert_frame(frame,width,height,::AV_PIX_FMT_NV12);
-        libav::convert_frame(_frame, _frame_nv12);
-        auto t2 = std::chrono::high_resolution_clock::now();
+        {
+            trace::TraceScope const convert_trace("convert_frame", "encoder");
+            //libav::AVFrame nvframe = libav::convert_frame(frame,width,height,::AV_PIX_FMT_NV12);
+            libav::convert_frame(_frame, _frame_nv12);
+        }
 
+        trace::TraceScope const encode_trace("hardware_encode", "encoder");
         write_frame_err = libav::hardware_encode(_media, _codecCtx, _frame_nv12, _frame_count);
-
-        auto t3 = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> elapsed1 = t2 - t1;
-        std::chrono::duration<double> elapsed2 = t3 - t2;
     } else {
         //We will send null packets to the encoder
+        trace::TraceScope const flush_trace("hardware_encode_flush", "encoder");
         write_frame_err = libav::hardware_encode_flush(_media, _codecCtx, _frame_count);
     }
-    //std::cout << "Elapsed time for scaling: " << elapsed1.count() << std::endl;
-    //std::cout << "Elapsed time for encoding: " << elapsed2.count() << std::endl;
 
     _frame_count++;
     return write_frame_err;
 }
 
 void VideoEncoder::writeFrameRGB0(std::vector<uint32_t> & input_data) {
+    trace::TraceScope const trace_scope("VideoEncoder::writeFrameRGB0", "encoder", "frame", _frame_count);
 
     ::av_frame_make_writable(_frame.get());
     memcpy(_frame->data[0], input_data.data(), _height * _width * sizeof(uint32_t));
 
-    libav::convert_frame(_frame, _frame_nv12);
+    if (!_hardware_encode) {
+        if (!_flush_state && _codecCtx && _frame_encode) {
+            {
+                trace::TraceScope const convert_trace("convert_frame", "encoder");
+                ::av_frame_make_writable(_frame_encode.get());
+                libav::convert_frame(_frame, _frame_encode);
+            }
+            _frame_encode->pts = _frame_count;
+
+            trace::TraceScope const encode_trace("software_encode", "encoder");
+            libav::software_encode(_media, _codecCtx, _frame_encode.get());
+        }
+        _frame_count++;
+        return;
+    }
 
-    libav::hardware_encode(_media, _codecCtx, _frame_nv12, _frame_count);
+    {
+        trace::TraceScope const convert_trace("convert_frame", "encoder");
+        libav::convert_frame(_frame, _frame_nv12);
+    }
+
+    {
+        trace::TraceScope const encode_trace("hardware_encode", "encoder");
+        libav::hardware_encode(_media, _codecCtx, _frame_nv12, _frame_count);
+    }
 
     _frame_count++;
 }
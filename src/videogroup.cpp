@@ -0,0 +1,145 @@
+#include "videogroup.h"
+
+#include "trace.h"
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <utility>
+
+namespace ffmpeg_wrapper {
+
+VideoGroup::VideoGroup(size_t threads)
+    : _pool(threads) {
+}
+
+VideoGroup::~VideoGroup() {
+    // Stop queued prefetching before the pool drains it
+    _generation++;
+}
+
+int VideoGroup::addVideo(std::string const & filename, libav::flicks offset) {
+    auto video = std::make_unique<Video>();
+    video->decoder.setFormat(_format);
+    video->decoder.createMedia(filename);
+    if (video->decoder.getFrameCount() == 0) {
+        std::cout << "Could not add " << filename << " to the video group" << std::endl;
+        return -1;
+    }
+    video->offset.store(offset.count());
+    _videos.push_back(std::move(video));
+    return static_cast<int>(_videos.size()) - 1;
+}
+
+void VideoGroup::setOffset(int video, libav::flicks offset) {
+    _videos.at(static_cast<size_t>(video))->offset.store(offset.count());
+}
+
+libav::flicks VideoGroup::getOffset(int video) const {
+    return libav::flicks(_videos.at(static_cast<size_t>(video))->offset.load());
+}
+
+void VideoGroup::setFormat(VideoDecoder::OutputFormat format) {
+    _format = format;
+    _generation++;
+    for (auto & video: _videos) {
+        std::lock_guard<std::mutex> lock(video->mutex);
+        video->decoder.setFormat(format);
+        video->cache.clear();
+    }
+}
+
+void VideoGroup::setPrefetch(int frames) {
+    _prefetch_frames.store(std::max(frames, 0));
+}
+
+std::vector<int> VideoGroup::getFrameIndices(libav::flicks time) const {
+    std::vector<int> frames;
+    frames.reserve(_videos.size());
+    for (auto const & video: _videos) {
+        frames.push_back(_frameAtTime(*video, time));
+    }
+    return frames;
+}
+
+VideoGroupFrames VideoGroup::getFramesAtTime(libav::flicks time) {
+    trace::TraceScope const trace_scope("VideoGroup::getFramesAtTime", "group");
+
+    uint64_t const generation = ++_generation;
+    int const prefetch = _prefetch_frames.load();
+
+    VideoGroupFrames result;
+    result.time = time;
+    result.frames = getFrameIndices(time);
+
+    std::vector<std::future<std::vector<uint8_t>>> pending;
+    pending.reserve(_videos.size());
+    for (size_t i = 0; i < _videos.size(); ++i) {
+        auto * video = _videos[i].get();
+        int const frame = result.frames[i];
+        pending.push_back(_pool.submit([this, video, frame, prefetch]() { return _getFrame(*video, frame, prefetch); }));
+    }
+
+    result.images.reserve(_videos.size());
+    for (auto & p: pending) {
+        result.images.push_back(p.get());
+    }
+
+    if (prefetch > 0) {
+        for (size_t i = 0; i < _videos.size(); ++i) {
+            auto * video = _videos[i].get();
+            int const frame = result.frames[i];
+            _pool.submit([this, video, frame, prefetch, generation]() { _prefetchVideo(*video, frame, prefetch, generation); });
+        }
+    }
+
+    return result;
+}
+
+libav::flicks VideoGroup::getDuration() const {
+    libav::flicks duration(0);
+    for (auto const & video: _videos) {
+        auto const last = video->decoder.getFrameTime(video->decoder.getFrameCount() - 1);
+        duration = std::max(duration, libav::flicks(video->offset.load()) + last);
+    }
+    return duration;
+}
+
+int VideoGroup::_frameAtTime(Video const & video, libav::flicks time) const {
+    return video.decoder.getFrameAtTime(time - libav::flicks(video.offset.load()));
+}
+
+std::vector<uint8_t> VideoGroup::_getFrame(Video & video, int frame, int prefetch) {
+    std::lock_guard<std::mutex> lock(video.mutex);
+
+    auto cached = video.cache.find(frame);
+    if (cached == video.cache.end()) {
+        _cache_misses++;
+        cached = video.cache.emplace(frame, video.decoder.getFrame(frame)).first;
+    } else {
+        _cache_hits++;
+    }
+    std::vector<uint8_t> image = cached->second;
+
+    // Keep only the window this request will prefetch, plus the frame itself for repeated requests
+    video.cache.erase(video.cache.begin(), video.cache.lower_bound(frame));
+    video.cache.erase(video.cache.upper_bound(frame + prefetch), video.cache.end());
+    return image;
+}
+
+void VideoGroup::_prefetchVideo(Video & video, int frame, int prefetch, uint64_t generation) {
+    int const last = std::min(frame + prefetch, video.decoder.getFrameCount() - 1);
+    for (int next = frame + 1; next <= last; ++next) {
+        // The lock is released between frames so a new request waits for at most one prefetched frame
+        if (_generation.load() != generation) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(video.mutex);
+        if (video.cache.count(next) == 0) {
+            trace::TraceScope const trace_scope("VideoGroup::prefetch", "group", "frame", next);
+            video.cache.emplace(next, video.decoder.getFrame(next));
+        }
+    }
+}
+
+}// namespace ffmpeg_wrapper
@@ -0,0 +1,185 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "frame_server.h"
+#include "ffmpeg_wrapper/frameserverclient.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace protocol = ffmpeg_wrapper::frame_server;
+
+inline auto load_img = [](std::string filename){
+    std::ifstream stream(filename, std::ios::binary);
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+
+    return data;
+};
+
+size_t count_pixel_differences(std::vector<uint8_t> const & original, std::vector<uint8_t> const & decoded, int tolerance) {
+    if (original.size() != decoded.size()) {
+        return std::max(original.size(), decoded.size());
+    }
+    size_t diff_count = 0;
+    for (size_t i = 0; i < original.size(); ++i) {
+        if (std::abs(original[i] - decoded[i]) > tolerance) {
+            ++diff_count;
+        }
+    }
+    return diff_count;
+}
+
+static const int tolerance = 7; // Same as the decoder tests
+static std::string video_filename = "data/test_each_frame_number.mp4";
+
+// A server on its own socket in the temporary directory, stopped when the test ends
+struct TestServer {
+    TestServer()
+        : socket_path((std::filesystem::temp_directory_path() /
+                       ("ffmpeg_wrapper_test_" + std::to_string(::getpid()) + ".sock"))
+                              .string()),
+          server([this]() {
+              ffmpeg_wrapper_frame_server::ServerOptions options;
+              options.socket_path = socket_path;
+              options.workers = 2;
+              return options;
+          }()) {}
+
+    std::string socket_path;
+    ffmpeg_wrapper_frame_server::FrameServer server;
+};
+
+// Connect without the client, to send requests it would refuse to build
+int connect_raw(std::string const & socket_path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    int const fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool has_reply(int fd, int timeout_ms) {
+    pollfd p{fd, POLLIN, 0};
+    return ::poll(&p, 1, timeout_ms) > 0 && (p.revents & POLLIN);
+}
+
+TEST_CASE("Frame server returns a batch in the order requested", "[frame_server]") {
+    TestServer test;
+    REQUIRE(test.server.start());
+
+    ffmpeg_wrapper::FrameServerClient client;
+    REQUIRE(client.connect(test.socket_path));
+
+    std::map<int, std::vector<uint8_t>> references;
+    for (int frame: {0, 100, 200, 300, 400}) {
+        references[frame] = load_img("data/frame_" + std::to_string(frame) + ".bin");
+        REQUIRE_FALSE(references[frame].empty());
+    }
+
+    // Out of order, with repeated frames
+    std::vector<int> const frames = {300, 0, 100, 0, 400, 200, 100, 300};
+    auto batch = client.getFrames(video_filename, frames);
+
+    REQUIRE(batch.ok());
+    CHECK(batch.width() == 640);
+    CHECK(batch.height() == 480);
+    REQUIRE(batch.size() == frames.size());
+    for (size_t i = 0; i < frames.size(); ++i) {
+        CHECK(batch.frameIndex(i) == frames[i]);
+        CHECK(count_pixel_differences(references[frames[i]], batch.copy(i), tolerance) == 0);
+    }
+
+    // The connection stays usable for the next request
+    auto second = client.getFrames(video_filename, {200});
+    REQUIRE(second.ok());
+    REQUIRE(second.size() == 1);
+    CHECK(count_pixel_differences(references[200], second.copy(0), tolerance) == 0);
+}
+
+TEST_CASE("Frame server reports files it cannot open", "[frame_server]") {
+    TestServer test;
+    REQUIRE(test.server.start());
+
+    ffmpeg_wrapper::FrameServerClient client;
+    REQUIRE(client.connect(test.socket_path));
+
+    auto batch = client.getFrames("data/does_not_exist.mp4", {0, 1});
+    CHECK(batch.status() == protocol::OpenFailed);
+    CHECK(batch.size() == 0);
+
+    // The failure does not affect later requests on the connection
+    auto frame = client.getFrames(video_filename, {100});
+    CHECK(frame.ok());
+    CHECK(frame.size() == 1);
+}
+
+TEST_CASE("Frame server rejects malformed requests", "[frame_server]") {
+    TestServer test;
+    REQUIRE(test.server.start());
+
+    SECTION("Malformed GetFrames requests are answered with BadRequest") {
+        int const fd = connect_raw(test.socket_path);
+        REQUIRE(fd >= 0);
+
+        protocol::FrameRequestHeader header;
+        header.magic = 0;
+        REQUIRE(::send(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)));
+
+        protocol::FrameReplyHeader reply;
+        REQUIRE(has_reply(fd, 5000));
+        REQUIRE(::recv(fd, &reply, sizeof(reply), 0) == static_cast<ssize_t>(sizeof(reply)));
+        CHECK(reply.magic == protocol::kMagic);
+        CHECK(reply.status == protocol::BadRequest);
+        CHECK(reply.count == 0);
+        ::close(fd);
+    }
+
+    SECTION("Malformed prefetch requests get no reply") {
+        int const fd = connect_raw(test.socket_path);
+        REQUIRE(fd >= 0);
+
+        protocol::FrameRequestHeader prefetch;
+        prefetch.type = protocol::Prefetch;
+        prefetch.path_length = 0;
+        REQUIRE(::send(fd, &prefetch, sizeof(prefetch), 0) == static_cast<ssize_t>(sizeof(prefetch)));
+
+        // Requests on a connection are read in order, so once this one is answered the prefetch has been handled
+        protocol::FrameRequestHeader get;
+        get.path_length = 0;
+        REQUIRE(::send(fd, &get, sizeof(get), 0) == static_cast<ssize_t>(sizeof(get)));
+
+        protocol::FrameReplyHeader reply;
+        REQUIRE(has_reply(fd, 5000));
+        REQUIRE(::recv(fd, &reply, sizeof(reply), 0) == static_cast<ssize_t>(sizeof(reply)));
+        CHECK(reply.status == protocol::BadRequest);
+        CHECK_FALSE(has_reply(fd, 200));
+        ::close(fd);
+    }
+
+    SECTION("The client refuses to send an empty path") {
+        ffmpeg_wrapper::FrameServerClient client;
+        REQUIRE(client.connect(test.socket_path));
+
+        CHECK_FALSE(client.prefetch("", {0}));
+        CHECK_FALSE(client.getFrames("", {0}).ok());
+
+        auto batch = client.getFrames(video_filename, {0});
+        CHECK(batch.ok());
+        CHECK(batch.size() == 1);
+    }
+}
@@ -95,4 +95,80 @@ TEST_CASE("Decode whole video libavinc", "[libavinc]") {
 
     CHECK(frame_count == 1000);
 
-}
\ No newline at end of file
+}
+TEST_CASE("Frame pool reuses frames when decoding", "[libavinc]") {
+
+    auto mymedia = libav::avformat_open_input(video_filename);
+    libav::av_open_best_streams(mymedia);
+    int frame_count = 0;
+
+    for (auto & pkg : mymedia) {
+        libav::avcodec_send_packet(mymedia, &pkg, [&](libav::AVFrame frame) {
+            frame_count++;
+        });
+        ::av_packet_unref(&pkg);
+    }
+    libav::flush_decoder(mymedia, [&](libav::AVFrame frame) {
+        frame_count++;
+    });
+
+    CHECK(frame_count > 0);
+    // No frame outlives the callback, so a single pooled frame serves the whole file
+    CHECK(mymedia.frame_pool.allocations() == 1);
+    CHECK(mymedia.packet_pool.allocations() == 1);
+}
+
+TEST_CASE("Frame pool allocates while frames are held", "[libavinc]") {
+
+    libav::AVFramePool pool(2);
+
+    auto a = pool.acquire();
+    auto b = pool.acquire();
+    auto c = pool.acquire(); // Pool is at capacity, so this one is not pooled
+    CHECK(pool.allocations() == 3);
+    CHECK(pool.size() == 2);
+
+    auto const * a_ptr = a.get();
+    a.reset();
+    auto d = pool.acquire();
+    CHECK(d.get() == a_ptr);
+    CHECK(pool.allocations() == 3);
+}
+
+TEST_CASE("Frame pool reports the data kept by released frames", "[libavinc]") {
+
+    libav::AVFramePool pool(2);
+
+    auto frame = pool.acquire();
+    frame->format = AV_PIX_FMT_GRAY8;
+    frame->width = 64;
+    frame->height = 64;
+    REQUIRE(::av_frame_get_buffer(frame.get(), 0) == 0);
+    CHECK(pool.retainedBytes() == 0); // Still in use
+
+    frame.reset();
+    CHECK(pool.retainedBytes() >= 64 * 64);
+
+    pool.trim();
+    CHECK(pool.retainedBytes() == 0);
+}
+
+TEST_CASE("Send packet accepts move-only callables", "[libavinc]") {
+
+    auto mymedia = libav::avformat_open_input(video_filename);
+    libav::av_open_best_streams(mymedia);
+
+    // std::function requires a copyable target, so this only compiles with the templated overloads
+    struct CountFrames {
+        std::unique_ptr<int> count = std::make_unique<int>(0);
+        void operator()(libav::AVFrame const & frame) { (*count)++; }
+    } counter;
+
+    for (auto & pkg : mymedia) {
+        libav::avcodec_send_packet(mymedia, &pkg, counter);
+        ::av_packet_unref(&pkg);
+    }
+    libav::flush_decoder(mymedia, counter);
+
+    CHECK(*counter.count == 1000);
+}
@@ -2,11 +2,28 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/benchmark/catch_benchmark.hpp>
 
+#include "ffmpeg_wrapper/asyncvideodecoder.h"
+#include "ffmpeg_wrapper/decodermanager.h"
+#include "ffmpeg_wrapper/diskframecache.h"
+#include "ffmpeg_wrapper/motionvectors.h"
+#include "ffmpeg_wrapper/packetanalytics.h"
+#include "ffmpeg_wrapper/sharedframecache.h"
+#include "ffmpeg_wrapper/thumbnaildecoder.h"
+#include "ffmpeg_wrapper/trace.h"
+#include "ffmpeg_wrapper/videoanalytics.h"
 #include "ffmpeg_wrapper/videodecoder.h"
+#include "ffmpeg_wrapper/videogroup.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
 #include <string>
+#include <thread>
 
 inline auto load_img = [](std::string filename){
     std::ifstream stream(filename, std::ios::binary);
@@ -229,3 +246,1024 @@ TEST_CASE("VideoDecoder get frame count", "[ffmpeg_wrapper]") {
 
     CHECK(decoder.getFrameCount() == 1000);
 }
+
+TEST_CASE("VideoDecoder statistics", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(video_filename);
+    decoder.resetStatistics();
+
+    decoder.getFrame(0);
+    decoder.getFrame(0); // Second request should be served from the frame buffer
+    decoder.getFrame(300);
+
+    auto stats = decoder.getStatistics();
+
+    CHECK(stats.frame_requests == 3);
+    CHECK(stats.cache_hits >= 1);
+    CHECK(stats.cache_hits + stats.cache_misses == 3);
+    CHECK(stats.seeks >= 1);
+    CHECK(stats.frames_decoded >= 51);
+    CHECK(stats.frames_converted == 3);
+    CHECK(stats.get_frame_latency.count() == 3);
+    CHECK(stats.get_frame_latency.percentile(99) >= stats.get_frame_latency.percentile(50));
+
+    decoder.resetStatistics();
+    CHECK(decoder.getStatistics().frame_requests == 0);
+}
+
+TEST_CASE("VideoDecoder trace events", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(video_filename);
+
+    ffmpeg_wrapper::trace::clear();
+    ffmpeg_wrapper::trace::enable();
+    decoder.getFrame(100);
+    ffmpeg_wrapper::trace::disable();
+
+    std::ostringstream json;
+    ffmpeg_wrapper::trace::writeChromeTrace(json);
+
+    CHECK(json.str().find("\"traceEvents\"") != std::string::npos);
+    CHECK(json.str().find("VideoDecoder::getFrame") != std::string::npos);
+    CHECK(json.str().find("VideoDecoder::_convertFrameToOutputFormat") != std::string::npos);
+}
+
+TEST_CASE("Trace buffers of exited threads are bounded", "[ffmpeg_wrapper]") {
+    namespace trace = ffmpeg_wrapper::trace;
+    trace::disable();
+    trace::clear();
+    size_t const before = trace::memoryBytes();
+
+    // Naming threads while tracing is disabled allocates nothing
+    for (int i = 0; i < 30; ++i) {
+        std::thread([]() { trace::setThreadName("idle worker"); }).join();
+    }
+    CHECK(trace::memoryBytes() == before);
+
+    trace::enable(1024);
+    std::thread([]() { trace::TraceScope const scope("one thread"); }).join();
+    size_t const one_thread = trace::memoryBytes() - before;
+    CHECK(one_thread > 0);
+
+    for (int i = 0; i < 100; ++i) {
+        std::thread([]() {
+            trace::setThreadName("short lived");
+            trace::TraceScope const scope("short lived thread");
+        }).join();
+    }
+    trace::disable();
+    CHECK(trace::memoryBytes() - before <= 16 * one_thread);
+
+    std::ostringstream json;
+    trace::writeChromeTrace(json);
+    CHECK(json.str().find("short lived thread") != std::string::npos);
+
+    trace::clear();
+    CHECK(trace::memoryBytes() == before);
+}
+
+TEST_CASE("VideoDecoder video stream selection", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(video_filename);
+
+    CHECK(decoder.getVideoStreams() == std::vector<int>{0});
+    CHECK(decoder.getVideoStreamIndex() == 0);
+
+    // Selecting a stream that does not exist leaves nothing to decode
+    decoder.setVideoStreamIndex(5);
+    CHECK(decoder.getVideoStreamIndex() == -1);
+    CHECK(decoder.getFrameCount() == 0);
+
+    decoder.setVideoStreamIndex(0);
+    CHECK(decoder.getVideoStreamIndex() == 0);
+    CHECK(decoder.getFrameCount() == 1000);
+
+    auto frame_0_decoded = decoder.getFrame(0);
+    CHECK(calculate_pixel_difference(frame_0, frame_0_decoded, tolerance) == 0);
+}
+
+TEST_CASE("VideoDecoder pipelined mode", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::VideoDecoder serial;
+    serial.createMedia(video_filename);
+
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(video_filename);
+    decoder.setPipelined(true);
+
+    for (int i = 0; i < 250; i++) {
+        auto const expected = serial.getFrame(i);
+        auto const decoded = decoder.getFrame(i);
+        REQUIRE(calculate_pixel_difference(expected, decoded, 0) == 0);
+    }
+
+    // Jumping ahead and back restarts the pipeline at the nearest keyframe
+    CHECK(calculate_pixel_difference(frame_500, decoder.getFrame(500), tolerance) == 0);
+    CHECK(calculate_pixel_difference(frame_300, decoder.getFrame(300), tolerance) == 0);
+    CHECK(calculate_pixel_difference(frame_400, decoder.getFrame(400), tolerance) == 0);
+
+    decoder.setPipelined(false);
+    CHECK(calculate_pixel_difference(frame_100, decoder.getFrame(100), tolerance) == 0);
+}
+
+TEST_CASE("VideoDecoder pipeline restarts keep trace memory bounded", "[ffmpeg_wrapper]") {
+    namespace trace = ffmpeg_wrapper::trace;
+    trace::disable();
+    trace::clear();
+    size_t const before = trace::memoryBytes();
+
+    trace::enable(1024);
+    std::thread([]() { trace::TraceScope const scope("one thread"); }).join();
+    size_t const one_thread = trace::memoryBytes() - before;
+
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(video_filename);
+    decoder.setPipelined(true);
+
+    // Every backward jump restarts the pipeline, with three new threads each time
+    for (int i = 0; i < 20; i++) {
+        decoder.getFrame(400);
+        decoder.getFrame(100);
+    }
+    trace::disable();
+    CHECK(decoder.getStatistics().seeks >= 40);
+
+    // The kept buffers of exited threads, plus this thread and the running pipeline
+    CHECK(trace::memoryBytes() - before <= (16 + 4) * one_thread);
+
+    decoder.setPipelined(false);
+    trace::clear();
+}
+
+TEST_CASE("AsyncVideoDecoder coalesces and cancels requests", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::AsyncVideoDecoder decoder(video_filename);
+
+    auto first = decoder.getFrameAsync(500);
+    auto same = decoder.getFrameAsync(500);
+    auto result = first.get();
+    CHECK_FALSE(result.cancelled);
+    CHECK(calculate_pixel_difference(frame_500, result.data, tolerance) == 0);
+    CHECK(calculate_pixel_difference(frame_500, same.get().data, tolerance) == 0);
+    CHECK(decoder.requestsCoalesced() == 1);
+
+    // Holding the decoder keeps the worker busy, so only the latest queued request survives
+    std::vector<std::future<ffmpeg_wrapper::AsyncFrameResult>> scrub;
+    decoder.withDecoder([&](ffmpeg_wrapper::VideoDecoder &) {
+        for (int frame = 100; frame <= 400; frame += 100) {
+            scrub.push_back(decoder.getFrameAsync(frame));
+        }
+    });
+    auto last = scrub.back().get();
+    CHECK_FALSE(last.cancelled);
+    CHECK(calculate_pixel_difference(frame_400, last.data, tolerance) == 0);
+
+    // The last future has already been consumed
+    int cancelled = 0;
+    for (auto it = scrub.begin(); it != std::prev(scrub.end()); ++it) {
+        if (it->get().cancelled) cancelled++;
+    }
+    CHECK(cancelled >= 2);
+    CHECK(decoder.requestsCancelled() == static_cast<uint64_t>(cancelled));
+
+    std::promise<int> done;
+    decoder.getFrameAsync(0, [&done](ffmpeg_wrapper::AsyncFrameResult r) { done.set_value(r.frame); });
+    CHECK(done.get_future().get() == 0);
+
+    CHECK(decoder.withDecoder([](ffmpeg_wrapper::VideoDecoder & d) { return d.getFrameCount(); }) == 1000);
+}
+
+TEST_CASE("DecoderManager evicts least recently used decoders", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::DecoderManagerOptions options;
+    options.max_open_decoders = 1;
+    options.threads = 2;
+    ffmpeg_wrapper::DecoderManager manager(options);
+
+    // Two spellings of the same file are cached as two entries
+    std::string const other_filename = "./" + video_filename;
+
+    CHECK(manager.open({video_filename}) == 1);
+    CHECK(manager.isOpen(video_filename));
+    CHECK(manager.memoryBytes() > 0);
+
+    CHECK(calculate_pixel_difference(frame_100, manager.getFrame(video_filename, 100), tolerance) == 0);
+    CHECK(calculate_pixel_difference(frame_300, manager.getFrame(other_filename, 300), tolerance) == 0);
+    CHECK(manager.openCount() == 1);
+    CHECK(manager.isOpen(other_filename));
+    CHECK_FALSE(manager.isOpen(video_filename));
+
+    auto async = manager.getFrameAsync(video_filename, 500);
+    CHECK(calculate_pixel_difference(frame_500, async.get(), tolerance) == 0);
+
+    CHECK(manager.getFrame("data/does_not_exist.mp4", 0).empty());
+
+    auto const stats = manager.getStatistics();
+    CHECK(stats.opens == 3);
+    CHECK(stats.evictions == 2);
+    CHECK(stats.failures == 1);
+    CHECK(stats.hits == 1);
+
+    manager.clear();
+    CHECK(manager.openCount() == 0);
+    CHECK(manager.memoryBytes() == 0);
+}
+
+TEST_CASE("VideoGroup decodes every video at a shared time", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::VideoDecoder reference(video_filename);
+    auto const time_100 = reference.getFrameTime(100);
+    auto const time_300 = reference.getFrameTime(300);
+    CHECK(reference.getFrameAtTime(time_100) == 100);
+    CHECK(reference.getFrameAtTime(time_100 + (reference.getFrameTime(101) - time_100) / 2) == 100);
+
+    ffmpeg_wrapper::VideoGroup group(2);
+    CHECK(group.addVideo(video_filename) == 0);
+    // The second copy starts 200 frames earlier on the shared timeline
+    CHECK(group.addVideo(video_filename, time_100 - time_300) == 1);
+    CHECK(group.addVideo("data/does_not_exist.mp4") == -1);
+    CHECK(group.size() == 2);
+    group.setPrefetch(4);
+
+    auto const set = group.getFramesAtTime(time_100);
+    REQUIRE(set.images.size() == 2);
+    CHECK(set.frames == std::vector<int>{100, 300});
+    CHECK(calculate_pixel_difference(frame_100, set.images[0], tolerance) == 0);
+    CHECK(calculate_pixel_difference(frame_300, set.images[1], tolerance) == 0);
+
+    auto const next = group.getFramesAtTime(reference.getFrameTime(101));
+    CHECK(next.frames == std::vector<int>{101, 301});
+    CHECK(calculate_pixel_difference(reference.getFrame(101), next.images[0], 0) == 0);
+    CHECK(calculate_pixel_difference(reference.getFrame(301), next.images[1], 0) == 0);
+
+    // Repeating a request is always served from the caches
+    auto const hits = group.cacheHits();
+    group.getFramesAtTime(reference.getFrameTime(101));
+    CHECK(group.cacheHits() == hits + 2);
+    CHECK(group.cacheHits() + group.cacheMisses() == 6);
+}
+
+TEST_CASE("VideoDecoder shares frames through a SharedFrameCache", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::SharedFrameCacheOptions options;
+    options.name = "/ffmpeg_wrapper_test_frames";
+    options.capacity_bytes = size_t{64} << 20;
+    ffmpeg_wrapper::SharedFrameCache::remove(options.name);
+
+    auto cache = std::make_shared<ffmpeg_wrapper::SharedFrameCache>(options);
+    REQUIRE(cache->isOpen());
+
+    ffmpeg_wrapper::VideoDecoder first(video_filename);
+    first.setFrameCache(cache);
+    CHECK(calculate_pixel_difference(frame_300, first.getFrame(300), tolerance) == 0);
+
+    // A second mapping of the same object, as another process would see it
+    auto other = std::make_shared<ffmpeg_wrapper::SharedFrameCache>(options);
+    ffmpeg_wrapper::VideoDecoder second(video_filename);
+    second.setFrameCache(other);
+    CHECK(calculate_pixel_difference(frame_300, second.getFrame(300), tolerance) == 0);
+    CHECK(second.getStatistics().frame_cache_hits == 1);
+    CHECK(second.getStatistics().frames_decoded == 0);
+
+    auto const key = ffmpeg_wrapper::FrameCacheKey{ffmpeg_wrapper::computeFileId(video_filename),
+                                                   second.getVideoStreamIndex(), 300, 0};
+    auto handle = other->acquire(key);
+    REQUIRE(handle);
+    CHECK(handle.size() == frame_300.size());
+
+    ffmpeg_wrapper::SharedFrameCache::remove(options.name);
+}
+
+TEST_CASE("VideoDecoder 16 bit output formats", "[ffmpeg_wrapper]") {
+
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    auto const gray8 = decoder.getFrame(100);
+
+    decoder.setFormat(ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray16);
+    auto const gray16 = decoder.getFrame(100);
+    REQUIRE(gray16.size() == gray8.size() * 2);
+
+    // The 16 bit image carries the 8 bit one in its high byte
+    std::vector<uint16_t> samples(gray8.size());
+    std::memcpy(samples.data(), gray16.data(), gray16.size());
+    size_t differences = 0;
+    for (size_t i = 0; i < gray8.size(); ++i) {
+        if (std::abs(static_cast<int>(samples[i] >> 8) - static_cast<int>(gray8[i])) > 1) differences++;
+    }
+    CHECK(differences == 0);
+
+    decoder.setFormat(ffmpeg_wrapper::VideoDecoder::OutputFormat::RGB48);
+    auto const rgb48 = decoder.getFrame(100);
+    REQUIRE(rgb48.size() == gray8.size() * 6);
+
+    decoder.setFormat(ffmpeg_wrapper::VideoDecoder::OutputFormat::ARGB);
+    auto const argb = decoder.getFrame(100);
+    REQUIRE(argb.size() == gray8.size() * 4);
+
+    // The video is gray, so every channel follows Gray16, and carries the 8 bit channels in its high byte
+    std::vector<uint16_t> rgb(gray8.size() * 3);
+    std::memcpy(rgb.data(), rgb48.data(), rgb48.size());
+    size_t const width = static_cast<size_t>(decoder.getWidth());
+    // A pixel of the white background and one inside a digit
+    for (size_t pixel: {size_t{0}, 210 * width + 340}) {
+        for (size_t c = 0; c < 3; ++c) {
+            CHECK(std::abs(static_cast<int>(rgb[pixel * 3 + c] >> 8) - static_cast<int>(samples[pixel] >> 8)) <= 1);
+            CHECK(std::abs(static_cast<int>(rgb[pixel * 3 + c] >> 8) - static_cast<int>(argb[pixel * 4 + c])) <= 1);
+        }
+    }
+    differences = 0;
+    for (size_t i = 0; i < rgb.size(); ++i) {
+        if (std::abs(static_cast<int>(rgb[i] >> 8) - static_cast<int>(samples[i / 3] >> 8)) > tolerance) differences++;
+    }
+    CHECK(differences == 0);
+}
+
+/*
+A frame whose luma runs through every code of its bit depth, including those outside the limited range,
+with random chroma. Samples of 10 bit and deeper formats are native-endian uint16, shifted as the format
+stores them.
+*/
+static libav::AVFrame make_synthetic_frame(AVPixelFormat format, int width, int height, AVColorRange range) {
+    auto frame = libav::av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    frame->color_range = range;
+    REQUIRE(libav::av_frame_get_buffer(frame) == 0);
+
+    auto const * desc = av_pix_fmt_desc_get(format);
+    int const depth = desc->comp[0].depth;
+    int const shift = desc->comp[0].shift;
+    int const max_code = (1 << depth) - 1;
+    std::mt19937 random(static_cast<uint32_t>(format));
+    std::uniform_int_distribution<int> code(0, max_code);
+
+    for (int p = 0; p < av_pix_fmt_count_planes(format); ++p) {
+        bool const full_size = p == 0 || p == 3;
+        int const rows = full_size ? height : -((-height) >> desc->log2_chroma_h);
+        for (int y = 0; y < rows; ++y) {
+            uint8_t * row = frame->data[p] + static_cast<ptrdiff_t>(y) * frame->linesize[p];
+            if (depth > 8) {
+                int const samples = frame->linesize[p] / 2;
+                for (int x = 0; x < samples; ++x) {
+                    int const v = (p == 0 && x < width) ? (y * width + x) * 7 % (max_code + 1) : code(random);
+                    uint16_t const stored = static_cast<uint16_t>(v << shift);
+                    std::memcpy(row + 2 * x, &stored, sizeof(stored));
+                }
+            } else {
+                for (int x = 0; x < frame->linesize[p]; ++x) {
+                    row[x] = static_cast<uint8_t>((p == 0 && x < width) ? (y * width + x) * 7 % 256 : code(random));
+                }
+            }
+        }
+    }
+    return frame;
+}
+
+// The luma plane of frame as a gray frame, which swscale always treats as full range
+static libav::AVFrame luma_as_gray(::AVFrame const * frame, AVPixelFormat gray_format) {
+    auto gray = libav::av_frame_alloc();
+    gray->format = gray_format;
+    gray->width = frame->width;
+    gray->height = frame->height;
+    gray->data[0] = frame->data[0];
+    gray->linesize[0] = frame->linesize[0];
+    return gray;
+}
+
+static size_t count_gray8_differences(std::vector<uint8_t> const & image, ::AVFrame const * reference, int tolerance) {
+    size_t differences = 0;
+    for (int y = 0; y < reference->height; ++y) {
+        uint8_t const * row = reference->data[0] + static_cast<ptrdiff_t>(y) * reference->linesize[0];
+        for (int x = 0; x < reference->width; ++x) {
+            int const value = image[static_cast<size_t>(y) * static_cast<size_t>(reference->width) + static_cast<size_t>(x)];
+            if (std::abs(value - static_cast<int>(row[x])) > tolerance) differences++;
+        }
+    }
+    return differences;
+}
+
+TEST_CASE("VideoDecoder Gray8 conversion of YUV and gray formats", "[ffmpeg_wrapper]") {
+    // Not a multiple of the plane alignment, so every row has padding
+    int const width = 70;
+    int const height = 36;
+    ffmpeg_wrapper::VideoDecoder decoder;
+    std::vector<uint8_t> image;
+
+    SECTION("Limited range luma is expanded as swscale expands it") {
+        // swscale rounds and dithers differently from the exact expansion, by a few codes
+        for (auto format: {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_NV21, AV_PIX_FMT_YUV422P,
+                           AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_P010LE, AV_PIX_FMT_YUV444P12LE}) {
+            for (auto range: {AVCOL_RANGE_MPEG, AVCOL_RANGE_UNSPECIFIED}) {
+                INFO(av_get_pix_fmt_name(format) << ", color_range " << range);
+                auto frame = make_synthetic_frame(format, width, height, range);
+                decoder.convertFrame(frame.get(), image);
+                REQUIRE(image.size() == static_cast<size_t>(width * height));
+
+                auto reference = libav::convert_frame(frame.get(), width, height, AV_PIX_FMT_GRAY8);
+                CHECK(count_gray8_differences(image, reference.get(), tolerance) == 0);
+            }
+        }
+    }
+
+    SECTION("Full range formats are passed through") {
+        for (auto format: {AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ444P, AV_PIX_FMT_GRAY8,
+                           AV_PIX_FMT_GRAY10LE, AV_PIX_FMT_GRAY12LE}) {
+            INFO(av_get_pix_fmt_name(format));
+            auto frame = make_synthetic_frame(format, width, height, AVCOL_RANGE_UNSPECIFIED);
+            decoder.convertFrame(frame.get(), image);
+            REQUIRE(image.size() == static_cast<size_t>(width * height));
+
+            auto reference = libav::convert_frame(frame.get(), width, height, AV_PIX_FMT_GRAY8);
+            CHECK(count_gray8_differences(image, reference.get(), 1) == 0);
+        }
+    }
+
+    SECTION("color_range JPEG marks YUV formats as full range") {
+        // swscale ignores color_range, so the reference converts the luma plane on its own as gray
+        std::pair<AVPixelFormat, AVPixelFormat> const formats[] = {
+                {AV_PIX_FMT_YUV420P, AV_PIX_FMT_GRAY8},
+                {AV_PIX_FMT_NV12, AV_PIX_FMT_GRAY8},
+                {AV_PIX_FMT_YUV444P, AV_PIX_FMT_GRAY8},
+                {AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_GRAY10LE},
+        };
+        for (auto const & [format, gray_format]: formats) {
+            INFO(av_get_pix_fmt_name(format));
+            auto frame = make_synthetic_frame(format, width, height, AVCOL_RANGE_JPEG);
+            decoder.convertFrame(frame.get(), image);
+            REQUIRE(image.size() == static_cast<size_t>(width * height));
+
+            auto gray = luma_as_gray(frame.get(), gray_format);
+            auto reference = libav::convert_frame(gray.get(), width, height, AV_PIX_FMT_GRAY8);
+            CHECK(count_gray8_differences(image, reference.get(), 1) == 0);
+        }
+    }
+}
+
+TEST_CASE("VideoDecoder float tensor output", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    auto const gray8 = decoder.getFrame(100);
+    size_t const pixels = gray8.size();
+
+    ffmpeg_wrapper::TensorOptions options;
+    options.channels = 1;
+    REQUIRE(decoder.tensorFrameBytes(options) == pixels * sizeof(float));
+
+    // The luma tensor is the Gray8 image scaled to [0, 1]
+    std::vector<float> luma(pixels);
+    REQUIRE(decoder.getFrameTensor(100, options, luma.data()));
+    size_t differences = 0;
+    size_t out_of_range = 0;
+    for (size_t i = 0; i < pixels; ++i) {
+        if (std::abs(luma[i] * 255.0f - static_cast<float>(gray8[i])) > 1.5f) differences++;
+        if (luma[i] < 0.0f || luma[i] > 1.0f) out_of_range++;
+    }
+    CHECK(differences == 0);
+    CHECK(out_of_range == 0);
+
+    // Limited range samples below black and above white are clamped, as Gray8 clamps them
+    uint8_t const limited[4] = {0, 16, 235, 255};
+    float packed[4];
+    ffmpeg_wrapper::packTensorChannel(limited, sizeof(limited), 1, 4, 1, 1.0f / 219.0f, -16.0f / 219.0f, 0, options,
+                                      packed, 0.0f, 1.0f);
+    CHECK(packed[0] == 0.0f);
+    CHECK(packed[1] == 0.0f);
+    CHECK(std::abs(packed[2] - 1.0f) < 1e-6f);
+    CHECK(packed[3] == 1.0f);
+
+    options.channels = 3;
+    options.type = ffmpeg_wrapper::TensorType::Float16;
+    options.width = 64;
+    options.height = 32;
+    REQUIRE(decoder.tensorFrameBytes(options) == 64 * 32 * 3 * sizeof(uint16_t));
+    std::vector<uint16_t> batch(4 * 64 * 32 * 3);
+    REQUIRE(decoder.getTensorBatch(100, 4, options, batch.data()) == 4);
+    for (uint16_t half: batch) {
+        float const value = ffmpeg_wrapper::halfToFloat(half);
+        REQUIRE(value >= 0.0f);
+        REQUIRE(value <= 1.0f);
+    }
+
+    CHECK(ffmpeg_wrapper::halfToFloat(ffmpeg_wrapper::floatToHalf(0.5f)) == 0.5f);
+    CHECK(decoder.getTensorBatch(decoder.getFrameCount() - 2, 4, options, batch.data()) == 2);
+}
+
+TEST_CASE("VideoDecoder extracts a region of interest", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    int const width = decoder.getWidth();
+    auto const full = decoder.getFrame(100);
+
+    int const x = 17;
+    int const y = 9;
+    int const roi_width = 40;
+    int const roi_height = 30;
+    auto const roi = decoder.getFrameROI(100, x, y, roi_width, roi_height);
+    REQUIRE(roi.size() == static_cast<size_t>(roi_width * roi_height));
+    for (int row = 0; row < roi_height; ++row) {
+        REQUIRE(std::memcmp(roi.data() + row * roi_width, full.data() + (y + row) * width + x, roi_width) == 0);
+    }
+
+    // A persistent region applies to getFrame and is clipped to the frame
+    REQUIRE(decoder.setROI(width - 10, 0, 50, 20));
+    CHECK(decoder.getOutputWidth() == 10);
+    CHECK(decoder.getFrame(100).size() == 10 * 20);
+    decoder.clearROI();
+    CHECK(decoder.getFrame(100) == full);
+
+    CHECK_FALSE(decoder.setROI(width, 0, 10, 10));
+    CHECK(decoder.getFrameROI(100, -20, -20, 10, 10).empty());
+}
+
+TEST_CASE("ThumbnailDecoder decodes reduced frames", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    auto const full = decoder.getFrame(100);
+
+    // At scale 1 the thumbnail path gives the same image as VideoDecoder
+    ffmpeg_wrapper::ThumbnailOptions options;
+    options.scale = 1;
+    ffmpeg_wrapper::ThumbnailDecoder same_size(video_filename, options);
+    REQUIRE(same_size.isOpen());
+    auto const thumbnail = same_size.getFrame(100);
+    CHECK(thumbnail.frame == 100);
+    CHECK(thumbnail.image == full);
+
+    options.scale = 4;
+    options.keyframes_only = true;
+    ffmpeg_wrapper::ThumbnailDecoder quarter(video_filename, options);
+    CHECK(quarter.getWidth() == decoder.getWidth() / 4);
+    CHECK(quarter.getHeight() == decoder.getHeight() / 4);
+    auto const keys = decoder.getKeyFrames();
+    REQUIRE(keys.size() > 1);
+    auto const key = quarter.getFrame(static_cast<int>(keys[1]) + 1);
+    CHECK(key.frame == keys[1]);
+    CHECK(key.image.size() == static_cast<size_t>(quarter.getWidth() * quarter.getHeight()));
+
+    auto const thumbnails = ffmpeg_wrapper::makeThumbnails(video_filename, 0, options, 4);
+    REQUIRE(thumbnails.size() == keys.size());
+    for (size_t i = 0; i < thumbnails.size(); ++i) {
+        CHECK(thumbnails[i].frame == keys[i]);
+    }
+}
+
+TEST_CASE("Repeated thumbnail batches keep trace memory bounded", "[ffmpeg_wrapper]") {
+    namespace trace = ffmpeg_wrapper::trace;
+    trace::disable();
+    trace::clear();
+    size_t const before = trace::memoryBytes();
+
+    trace::enable(1024);
+    std::thread([]() { trace::TraceScope const scope("one thread"); }).join();
+    size_t const one_thread = trace::memoryBytes() - before;
+
+    // Every batch runs on a new pool of four workers
+    ffmpeg_wrapper::ThumbnailOptions options;
+    options.scale = 8;
+    options.keyframes_only = true;
+    for (int i = 0; i < 10; i++) {
+        CHECK_FALSE(ffmpeg_wrapper::makeThumbnails(video_filename, 0, options, 4).empty());
+    }
+    trace::disable();
+
+    // The kept buffers of exited workers, plus this thread
+    CHECK(trace::memoryBytes() - before <= (16 + 1) * one_thread);
+    trace::clear();
+}
+
+TEST_CASE("VideoDecoder decodes every Nth frame", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    ffmpeg_wrapper::VideoDecoder reference(video_filename);
+
+    std::vector<int> frames;
+    size_t mismatches = 0;
+    int const delivered = decoder.decodeSubsampled(3, 990, 97, [&](int frame, std::vector<uint8_t> const & image) {
+        frames.push_back(frame);
+        if (image != reference.getFrame(frame)) mismatches++;
+    });
+    CHECK(delivered == 11);
+    REQUIRE(frames.size() == 11);
+    CHECK(frames.front() == 3);
+    CHECK(frames.back() == 973);
+    CHECK(std::is_sorted(frames.begin(), frames.end()));
+    CHECK(mismatches == 0);
+
+    // The decoder is usable normally afterwards
+    CHECK(decoder.getFrame(500) == reference.getFrame(500));
+}
+
+TEST_CASE("analyzeVideo matches statistics of decoded frames", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::AnalyticsOptions options;
+    options.min_max = true;
+    options.histogram = true;
+    options.projections = true;
+    options.first_frame = 90;
+    options.last_frame = 209;
+    options.threads = 4;
+
+    ffmpeg_wrapper::VideoAnalytics analytics;
+    REQUIRE(ffmpeg_wrapper::analyzeVideo(video_filename, options, analytics));
+    REQUIRE(analytics.frame_count == 120);
+    CHECK(analytics.frames_analyzed == 120);
+
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    for (int frame: {90, 150, 209}) {
+        auto const image = decoder.getFrame(frame);
+        size_t const slot = static_cast<size_t>(frame - analytics.first_frame);
+        std::array<uint32_t, 256> histogram{};
+        uint64_t sum = 0;
+        for (uint8_t v: image) {
+            histogram[v]++;
+            sum += v;
+        }
+        CHECK(analytics.frames.histogram[slot] == histogram);
+        CHECK(std::abs(analytics.frames.mean[slot] - static_cast<float>(sum) / image.size()) < 1e-3f);
+        CHECK(analytics.frames.min[slot] == *std::min_element(image.begin(), image.end()));
+        CHECK(analytics.frames.max[slot] == *std::max_element(image.begin(), image.end()));
+    }
+
+    auto const & projections = analytics.projections;
+    REQUIRE(projections.mean.size() == static_cast<size_t>(decoder.getWidth() * decoder.getHeight()));
+    for (size_t i = 0; i < projections.mean.size(); i += 997) {
+        CHECK(projections.max[i] >= projections.mean[i]);
+        CHECK(projections.std[i] >= 0.0f);
+    }
+}
+
+TEST_CASE("Repeated analyzeVideo calls keep trace memory bounded", "[ffmpeg_wrapper]") {
+    namespace trace = ffmpeg_wrapper::trace;
+    trace::disable();
+    trace::clear();
+    size_t const before = trace::memoryBytes();
+
+    trace::enable(1024);
+    std::thread([]() { trace::TraceScope const scope("one thread"); }).join();
+    size_t const one_thread = trace::memoryBytes() - before;
+
+    // Every call runs on a new pool of four workers
+    ffmpeg_wrapper::AnalyticsOptions options;
+    options.first_frame = 0;
+    options.last_frame = 99;
+    options.threads = 4;
+    for (int i = 0; i < 10; i++) {
+        ffmpeg_wrapper::VideoAnalytics analytics;
+        REQUIRE(ffmpeg_wrapper::analyzeVideo(video_filename, options, analytics));
+    }
+    trace::disable();
+
+    // The kept buffers of exited workers, plus this thread
+    CHECK(trace::memoryBytes() - before <= (16 + 1) * one_thread);
+    trace::clear();
+}
+
+TEST_CASE("Compressed-domain analytics from the packet index", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    auto const & sizes = decoder.getPacketSizes();
+    REQUIRE(sizes.size() == static_cast<size_t>(decoder.getFrameCount()));
+    REQUIRE(decoder.getPacketFlags().size() == sizes.size());
+    CHECK((decoder.getPacketFlags()[0] & AV_PKT_FLAG_KEY) != 0);
+
+    // The curve accounts for every bit in the file
+    auto const curve = ffmpeg_wrapper::bitrateCurve(decoder, 0.5);
+    REQUIRE(!curve.empty());
+    double curve_bits = 0.0;
+    for (auto const & point: curve) curve_bits += point.bitrate * 0.5;
+    uint64_t total_bits = 0;
+    for (uint32_t size: sizes) total_bits += static_cast<uint64_t>(size) * 8;
+    CHECK(std::abs(curve_bits - static_cast<double>(total_bits)) < 1.0);
+
+    auto const activity = ffmpeg_wrapper::frameActivity(decoder);
+    CHECK(activity.size() == sizes.size());
+
+    auto const scenes = ffmpeg_wrapper::sceneChangeCandidates(decoder);
+    CHECK(std::is_sorted(scenes.begin(), scenes.end()));
+    for (auto const & segment: ffmpeg_wrapper::activeSegments(decoder)) {
+        CHECK(segment.first_frame <= segment.last_frame);
+        CHECK(segment.last_frame < decoder.getFrameCount());
+    }
+}
+
+TEST_CASE("Motion vectors are exported and rasterized", "[ffmpeg_wrapper]") {
+    SECTION("Rasterizing a synthetic field") {
+        ffmpeg_wrapper::MotionVectorField field;
+        field.width = 32;
+        field.height = 16;
+        // One bidirectional 16x16 block on the left; the right half is intra
+        field.vectors.push_back(ffmpeg_wrapper::MotionVector{8, 8, 3.0f, 4.0f, 16, 16, -1});
+        field.vectors.push_back(ffmpeg_wrapper::MotionVector{8, 8, -3.0f, -4.0f, 16, 16, 1});
+
+        auto const map = ffmpeg_wrapper::rasterizeMotionMagnitude(field, 16);
+        REQUIRE(map.columns == 2);
+        REQUIRE(map.rows == 1);
+        CHECK(std::abs(map.magnitude[0] - 5.0f) < 1e-5f);
+        CHECK(map.magnitude[1] == 0.0f);
+        CHECK(std::abs(ffmpeg_wrapper::motionEnergy(field) - 2.5f) < 1e-5f);
+    }
+
+    SECTION("Exporting from the decoder") {
+        ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+        ffmpeg_wrapper::MotionVectorField field;
+        CHECK_FALSE(decoder.getMotionVectors(0, field));
+
+        decoder.setExportMotionVectors(true);
+        REQUIRE(decoder.getMotionVectors(0, field));
+        CHECK(field.picture_type == 'I');
+        CHECK(field.vectors.empty());
+
+        bool found_vectors = false;
+        for (int frame = 1; frame < std::min(decoder.getFrameCount(), 30) && !found_vectors; ++frame) {
+            REQUIRE(decoder.getMotionVectors(frame, field));
+            CHECK(field.width == decoder.getWidth());
+            found_vectors = !field.vectors.empty();
+        }
+        CHECK(found_vectors);
+    }
+}
+
+TEST_CASE("VideoDecoder output cache serves converted frames", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    decoder.setFormat(ffmpeg_wrapper::VideoDecoder::OutputFormat::ARGB);
+    decoder.setOutputCacheBytes(size_t{64} << 20);
+
+    auto const first = decoder.getFrame(5);
+    decoder.resetStatistics();
+    auto const second = decoder.getFrame(5);
+    CHECK(second == first);
+    CHECK(decoder.getStatistics().output_cache_hits == 1);
+    CHECK(decoder.getStatistics().frames_converted == 0);
+
+    // Zero copy: both requests get the cache's own image
+    auto const shared_a = decoder.getFrameShared(5);
+    auto const shared_b = decoder.getFrameShared(5);
+    REQUIRE(shared_a);
+    CHECK(shared_a.get() == shared_b.get());
+    CHECK(*shared_a == first);
+
+    // Another format is another entry
+    decoder.setFormat(ffmpeg_wrapper::VideoDecoder::OutputFormat::Gray8);
+    CHECK(decoder.getFrame(5).size() * 4 == first.size());
+
+    decoder.setOutputCacheBytes(0);
+    CHECK(decoder.estimateMemoryBytes() > 0);
+    CHECK(decoder.getFrameShared(5).get() != decoder.getFrameShared(5).get());
+}
+
+TEST_CASE("VideoDecoder restores evicted frames from the compressed tier", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::VideoDecoder reference(video_filename);
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    decoder.setCompressedCacheBytes(size_t{64} << 20);
+
+    int const last = std::min(decoder.getFrameCount() - 1, 200);
+    for (int frame = 0; frame <= last; ++frame) {
+        decoder.getFrame(frame);
+    }
+    size_t const with_compressed = decoder.estimateMemoryBytes();
+    CHECK(with_compressed > 0);
+
+    // Going back to the start is answered without decoding, and the frames are exact
+    for (int frame: {1, 2, last / 2}) {
+        decoder.resetStatistics();
+        auto const restored = decoder.getFrame(frame);
+        CHECK(decoder.getStatistics().frames_decoded == 0);
+        CHECK(restored == reference.getFrame(frame));
+    }
+
+    decoder.setCompressedCacheBytes(0);
+    CHECK(decoder.estimateMemoryBytes() <= with_compressed);
+}
+
+// Rows and bytes per row of each plane, packed as CompressedFrameStore lays them out
+static std::vector<std::pair<int, int>> plane_shapes(::AVFrame const * frame) {
+    auto const format = static_cast<AVPixelFormat>(frame->format);
+    auto const * desc = av_pix_fmt_desc_get(format);
+    std::vector<std::pair<int, int>> shapes;
+    for (int p = 0; p < av_pix_fmt_count_planes(format); ++p) {
+        int const shift = (p == 1 || p == 2) ? desc->log2_chroma_h : 0;
+        shapes.emplace_back(-((-frame->height) >> shift), av_image_get_linesize(format, frame->width, p));
+    }
+    return shapes;
+}
+
+// Rows that change by a few levels per row, with a small block of noise that moves with frame_number.
+// With noise set, every byte is random instead.
+static libav::AVFrame make_store_frame(AVPixelFormat format, int width, int height, int frame_number,
+                                       bool noise = false) {
+    auto frame = libav::av_frame_alloc();
+    frame->format = format;
+    frame->width = width;
+    frame->height = height;
+    frame->pts = frame_number;
+    REQUIRE(libav::av_frame_get_buffer(frame) == 0);
+
+    std::mt19937 random(static_cast<uint32_t>(noise ? 1000 + frame_number : frame_number));
+    std::uniform_int_distribution<int> byte(0, 255);
+    auto const shapes = plane_shapes(frame.get());
+    for (size_t p = 0; p < shapes.size(); ++p) {
+        int const rows = shapes[p].first;
+        int const row_bytes = shapes[p].second;
+        // 16 x 16 luma samples, scaled to the plane
+        int const patch_rows = std::max(1, std::min(16 * rows / height, rows / 2));
+        int const patch_bytes = std::max(1, std::min(16 * row_bytes / shapes[0].second, row_bytes / 2));
+        int const patch_x = frame_number * 4 % (row_bytes - patch_bytes + 1);
+        int const patch_y = rows / 3;
+        for (int y = 0; y < rows; ++y) {
+            uint8_t * row = frame->data[p] + static_cast<ptrdiff_t>(y) * frame->linesize[p];
+            for (int x = 0; x < row_bytes; ++x) {
+                bool const in_patch = y >= patch_y && y < patch_y + patch_rows && x >= patch_x && x < patch_x + patch_bytes;
+                row[x] = static_cast<uint8_t>((noise || in_patch) ? byte(random) : (y * 5 + static_cast<int>(p) * 40) & 0xff);
+            }
+        }
+    }
+    return frame;
+}
+
+static bool same_pixels(::AVFrame const * a, ::AVFrame const * b) {
+    if (a->format != b->format || a->width != b->width || a->height != b->height || a->pts != b->pts) {
+        return false;
+    }
+    auto const shapes = plane_shapes(a);
+    for (size_t p = 0; p < shapes.size(); ++p) {
+        for (int y = 0; y < shapes[p].first; ++y) {
+            if (std::memcmp(a->data[p] + static_cast<ptrdiff_t>(y) * a->linesize[p],
+                            b->data[p] + static_cast<ptrdiff_t>(y) * b->linesize[p],
+                            static_cast<size_t>(shapes[p].second)) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static size_t frame_bytes(::AVFrame const * frame) {
+    size_t bytes = 0;
+    for (auto const & shape: plane_shapes(frame)) {
+        bytes += static_cast<size_t>(shape.first) * static_cast<size_t>(shape.second);
+    }
+    return bytes;
+}
+
+TEST_CASE("CompressedFrameStore stores synthetic frames", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::CompressedFrameStore store;
+    store.setCapacity(size_t{256} << 20);
+
+    SECTION("Frames round trip exactly") {
+        for (auto format: {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV420P16LE, AV_PIX_FMT_GRAY16LE}) {
+            for (auto size: {std::make_pair(64, 48), std::make_pair(33, 17)}) {
+                INFO(av_get_pix_fmt_name(format) << " " << size.first << "x" << size.second);
+                store.clear();
+
+                // Frames that differ from the first in a small block, then a noise frame that starts a group of its own
+                std::vector<libav::AVFrame> frames;
+                for (int i = 0; i < 5; ++i) {
+                    frames.push_back(make_store_frame(format, size.first, size.second, i));
+                }
+                frames.push_back(make_store_frame(format, size.first, size.second, 5, true));
+                for (size_t i = 0; i < frames.size(); ++i) {
+                    store.store(static_cast<int>(i), frames[i].get());
+                }
+                REQUIRE(store.size() == frames.size());
+
+                // Newest first, so each group's reference is decoded again after the other group's
+                for (size_t i = frames.size(); i-- > 0;) {
+                    auto restored = store.retrieve(static_cast<int>(i));
+                    REQUIRE(restored);
+                    CHECK(same_pixels(restored.get(), frames[i].get()));
+                }
+            }
+        }
+        CHECK_FALSE(store.retrieve(100));
+    }
+
+    int const width = 320;
+    int const height = 240;
+    size_t const raw_bytes = frame_bytes(make_store_frame(AV_PIX_FMT_YUV420P, width, height, 0).get());
+
+    SECTION("A frame whose difference does not compress starts a new group") {
+        for (int i = 0; i < 10; ++i) {
+            store.store(i, make_store_frame(AV_PIX_FMT_YUV420P, width, height, i).get());
+        }
+        store.store(10, make_store_frame(AV_PIX_FMT_YUV420P, width, height, 10, true).get());
+        REQUIRE(store.size() == 11);
+
+        // Room for the noise frame, coded at about its raw size, but not for the first ten frames as well.
+        // Groups are evicted whole, so only a separate group keeps the noise frame.
+        store.setCapacity(raw_bytes + raw_bytes / 16);
+        CHECK(store.size() == 1);
+        CHECK_FALSE(store.contains(0));
+        CHECK_FALSE(store.contains(9));
+        REQUIRE(store.contains(10));
+        CHECK(same_pixels(store.retrieve(10).get(), make_store_frame(AV_PIX_FMT_YUV420P, width, height, 10, true).get()));
+    }
+
+    SECTION("A group holds at most kMaxGroupFrames frames") {
+        int const group_frames = static_cast<int>(ffmpeg_wrapper::CompressedFrameStore::kMaxGroupFrames);
+        for (int i = 0; i <= group_frames; ++i) {
+            store.store(i, make_store_frame(AV_PIX_FMT_YUV420P, width, height, i).get());
+        }
+        REQUIRE(store.size() == static_cast<size_t>(group_frames + 1));
+
+        // The last frame compresses as well as the others, and is only in a group of its own because the first is full
+        store.setCapacity(raw_bytes / 8);
+        CHECK(store.size() == 1);
+        CHECK_FALSE(store.contains(0));
+        CHECK_FALSE(store.contains(group_frames - 1));
+        REQUIRE(store.contains(group_frames));
+        CHECK(same_pixels(store.retrieve(group_frames).get(),
+                          make_store_frame(AV_PIX_FMT_YUV420P, width, height, group_frames).get()));
+    }
+
+    SECTION("Least recently used groups are evicted under a small budget") {
+        // Noise frames do not compress, so each is a group of about raw_bytes
+        size_t const capacity = 3 * raw_bytes + raw_bytes / 4;
+        store.setCapacity(capacity);
+        for (int i = 0; i < 3; ++i) {
+            store.store(i, make_store_frame(AV_PIX_FMT_YUV420P, width, height, i, true).get());
+        }
+        REQUIRE(store.size() == 3);
+
+        // Using frame 0 makes frame 1 the least recently used
+        REQUIRE(store.retrieve(0));
+        store.store(3, make_store_frame(AV_PIX_FMT_YUV420P, width, height, 3, true).get());
+        CHECK(store.contains(0));
+        CHECK_FALSE(store.contains(1));
+        CHECK(store.contains(2));
+        CHECK(store.contains(3));
+
+        for (int i = 4; i < 12; ++i) {
+            store.store(i, make_store_frame(AV_PIX_FMT_YUV420P, width, height, i, true).get());
+            CHECK(store.size() <= 3);
+            // The compressed data stays within the budget; the rest is the reference and scratch buffers
+            CHECK(store.memoryBytes() <= capacity + 3 * raw_bytes);
+        }
+        CHECK(store.contains(11));
+        CHECK(same_pixels(store.retrieve(11).get(), make_store_frame(AV_PIX_FMT_YUV420P, width, height, 11, true).get()));
+
+        store.setCapacity(0);
+        CHECK(store.size() == 0);
+        CHECK(store.memoryBytes() == 0);
+    }
+
+    SECTION("A small moving patch on a static 4:2:0 background compresses at least 8x") {
+        int const frames = static_cast<int>(ffmpeg_wrapper::CompressedFrameStore::kMaxGroupFrames);
+        for (int i = 0; i < frames; ++i) {
+            store.store(i, make_store_frame(AV_PIX_FMT_YUV420P, width, height, i).get());
+        }
+        REQUIRE(store.size() == static_cast<size_t>(frames));
+        CHECK(store.uncompressedBytes() == static_cast<size_t>(frames) * raw_bytes);
+        // Including the reference and scratch buffers, which are three frames' worth on their own
+        CHECK(store.memoryBytes() * 8 <= store.uncompressedBytes());
+    }
+}
+
+TEST_CASE("VideoDecoder reuses frames from a DiskFrameCache across sessions", "[ffmpeg_wrapper]") {
+    ffmpeg_wrapper::DiskFrameCacheOptions options;
+    options.directory = (std::filesystem::temp_directory_path() / "ffmpeg_wrapper_test_disk_cache").string();
+    options.capacity_bytes = size_t{64} << 20;
+    std::filesystem::remove_all(options.directory);
+
+    std::vector<uint8_t> decoded;
+    {
+        auto cache = std::make_shared<ffmpeg_wrapper::DiskFrameCache>(options);
+        REQUIRE(cache->isOpen());
+        ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+        decoder.setFrameCache(cache);
+        decoded = decoder.getFrame(300);
+        CHECK(cache->fileCount() == 1);
+    }
+
+    // A new session rebuilds the index from the directory
+    auto cache = std::make_shared<ffmpeg_wrapper::DiskFrameCache>(options);
+    CHECK(cache->fileCount() == 1);
+    ffmpeg_wrapper::VideoDecoder decoder(video_filename);
+    decoder.setFrameCache(cache);
+    CHECK(decoder.getFrame(300) == decoded);
+    CHECK(decoder.getStatistics().frame_cache_hits == 1);
+    CHECK(decoder.getStatistics().frames_decoded == 0);
+
+    // A frame converted with another kFrameConversionRevision is a miss, and decoding it again replaces the file
+    {
+        std::fstream file(std::filesystem::directory_iterator(options.directory)->path(),
+                          std::ios::binary | std::ios::in | std::ios::out);
+        // The revision follows the magic, version, header size, file id, stream, frame and format
+        file.seekp(36);
+        uint32_t const stale = ffmpeg_wrapper::kFrameConversionRevision + 1;
+        file.write(reinterpret_cast<char const *>(&stale), sizeof(stale));
+    }
+    for (uint64_t const hits: {0, 1}) {
+        ffmpeg_wrapper::VideoDecoder session(video_filename);
+        session.setFrameCache(cache);
+        CHECK(session.getFrame(300) == decoded);
+        CHECK(session.getStatistics().frame_cache_hits == hits);
+        CHECK(cache->fileCount() == 1);
+    }
+
+    // Other formats are separate entries
+    decoder.setFormat(ffmpeg_wrapper::VideoDecoder::OutputFormat::ARGB);
+    decoder.getFrame(300);
+    CHECK(cache->fileCount() == 2);
+
+    cache->clear();
+    CHECK(cache->fileCount() == 0);
+    std::filesystem::remove_all(options.directory);
+}
@@ -0,0 +1,96 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "ffmpeg_wrapper/videodecoder.h"
+#include "ffmpeg_wrapper/videoencoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+static const int tolerance = 7; // Same as the decoder tests
+
+// A smooth gradient whose level rises with the frame number, so every frame is distinct and easy to compress
+std::vector<uint8_t> make_gradient(int width, int height, int frame) {
+    std::vector<uint8_t> image(static_cast<size_t>(width * height));
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            image[static_cast<size_t>(y * width + x)] = static_cast<uint8_t>(20 + frame * 8 + (x + y) * 100 / (width + height));
+        }
+    }
+    return image;
+}
+
+size_t count_pixel_differences(std::vector<uint8_t> const & original, std::vector<uint8_t> const & decoded) {
+    if (original.size() != decoded.size()) {
+        return std::max(original.size(), decoded.size());
+    }
+    size_t diff_count = 0;
+    for (size_t i = 0; i < original.size(); ++i) {
+        if (std::abs(original[i] - decoded[i]) > tolerance) {
+            ++diff_count;
+        }
+    }
+    return diff_count;
+}
+
+TEST_CASE("VideoEncoder software path round trips through VideoDecoder", "[ffmpeg_wrapper]") {
+    std::string codec;
+    for (char const * candidate: {"libx264", "mpeg4"}) {
+        if (::avcodec_find_encoder_by_name(candidate)) {
+            codec = candidate;
+            break;
+        }
+    }
+    if (codec.empty()) {
+        SKIP("No CPU encoder available in this FFmpeg build");
+    }
+
+    int const width = 128;
+    int const height = 96;
+    int const fps = 25;
+    int const total_frames = 12;
+    std::string const path = (std::filesystem::temp_directory_path() / "ffmpeg_wrapper_test_software_encode.mp4").string();
+    std::filesystem::remove(path);
+
+    {
+        ffmpeg_wrapper::VideoEncoder encoder;
+        encoder.setSavePath(path);
+        encoder.setHardwareEncode(false);
+        encoder.setEncoderName(codec);
+        encoder.setGopSize(5);
+        encoder.setMaxBFrames(0);
+        encoder.setEncoderOption("threads", "1");
+        // Generous bitrate so the gradient survives nearly untouched
+        encoder.setEncoderOption("b", std::to_string(width * height * fps * 4));
+        encoder.createContext(width, height, fps);
+        encoder.set_pixel_format(ffmpeg_wrapper::VideoEncoder::INPUT_PIXEL_FORMAT::GRAY8);
+        encoder.openFile();
+
+        for (int i = 0; i < total_frames; ++i) {
+            auto image = make_gradient(width, height, i);
+            REQUIRE(encoder.writeFrameGray8(image) >= 0);
+        }
+
+        encoder.enterDrainMode();
+        encoder.closeFile();
+    }
+
+    REQUIRE(std::filesystem::exists(path));
+
+    ffmpeg_wrapper::VideoDecoder decoder;
+    decoder.createMedia(path);
+
+    CHECK(decoder.getWidth() == width);
+    CHECK(decoder.getHeight() == height);
+    REQUIRE(decoder.getFrameCount() == total_frames);
+
+    // Forward through every frame, then a seek back across a keyframe
+    for (int i = 0; i < total_frames; ++i) {
+        CHECK(count_pixel_differences(make_gradient(width, height, i), decoder.getFrame(i)) == 0);
+    }
+    CHECK(count_pixel_differences(make_gradient(width, height, 3), decoder.getFrame(3)) == 0);
+
+    std::filesystem::remove(path);
+}